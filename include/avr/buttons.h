@@ -46,7 +46,7 @@ void button_init(uint8_t debounce_tm);
 
 // The buttons handler itself
 // If some buttons have been pressed, the linked callbacks will be executed
-// Returns 0 if no significant action was performed, non-zero otherwise
+// Meant to be the EV_BUTTON handler. Always returns 0
 uint8_t button_handler(void);
 
 // Set a callback for a button (NULL is non-sensical but accepted)
@@ -16,13 +16,18 @@ typedef enum ERR_CODE_E {
 
 // Type definition for a communication operation
 typedef uint8_t (*com_operation_f)(const packet_t *rx_pack);
-typedef com_operation_f* com_opmode_t;
+typedef const com_operation_f* com_opmode_t;  // Table in the program memory
+
+// Type definition for a task run while a sent packet is in flight
+typedef void (*com_background_f)(void);
 
 
 // Initialize the communication module
 void communication_init(void);
 
 // Get an incoming packet if data is available on the serial port (blocking)
+// With cumulative ACKs, its ACK is deferred to ride on the reply (see
+// 'communication_handler')
 // Returns 0 on success, 1 on failure
 uint8_t communication_recv(packet_t*);
 
@@ -35,8 +40,28 @@ uint8_t communication_send(const packet_t*);
 uint8_t communication_craft_and_send(packet_type_t type, const uint8_t *data,
     uint8_t data_size);
 
+// Zero-copy packet building: get a pointer to the data field of the packet
+// which will be sent, and fill it in place (at most the bytes given by
+// 'communication_data_max_size')
+uint8_t *communication_reserve(void);
+
+// Get the largest data size of a packet to send, i.e. larger with jumbo frames
+uint8_t communication_data_max_size(void);
+
+// Send the packet reserved with 'communication_reserve', carrying 'data_size'
+// bytes of data. Nothing must be sent between the reserve and the commit
+// Returns 0 if the packet is sent correctly, 1 otherwise
+uint8_t communication_commit(packet_type_t type, uint8_t data_size);
+
+// Set a task to run once for each packet sent, after it is handed to the serial
+// port and before waiting for its ACK, or NULL for none. It is reset when the
+// current command ends, and must take less than the RTO
+void communication_background_set(com_background_f task);
+
 // Perform a single "iteration" of the communication module activity
-// Returns 0 if no significant action was performed, non-zero otherwise
+// Meant to be the EV_COMMUNICATION handler. The ACK of an incoming packet is
+// sent once it is handled, unless a reply was sent meanwhile
+// Returns non-zero if a command is waiting to be iterated, 0 otherwise
 uint8_t communication_handler(void);
 
 // Switch communication opmode
@@ -3,6 +3,12 @@
 #ifndef __LMSENSOR_MODULE_H
 #define __LMSENSOR_MODULE_H
 #include <stdint.h>
+#include "temperature.h"
+
+// Oversampling: 4^n conversions are accumulated and decimated by 2^n to gain
+// n bits over the 10-bit ADC
+#define LM_EXTRA_BITS (TEMPERATURE_RAW_BITS - 10)
+#define LM_SAMPLES    (1 << (2 * LM_EXTRA_BITS))
 
 // Configurable ADC analog pin used for the LM35
 typedef enum ADC_PIN_E {
@@ -11,11 +17,16 @@ typedef enum ADC_PIN_E {
 
 
 // Initialize ADC and other required stuff
-void lm_init(uint8_t adc_pin);
+// A sensor (i.e. channel) is scanned for each bit set in 'adc_mask', from A0
+// Returns the number of channels
+uint8_t lm_init(uint8_t adc_mask);
+
+// Get the number of channels scanned by 'lm_convert'
+uint8_t lm_channels(void);
 
-// Start a conversion and enter in ADC Noise Reduction sleep mode until the
-// conversion completes
-// Returns the registered temperature, or 0 on failure
-uint8_t lm_convert(void);
+// Run LM_SAMPLES free-running conversions for each channel, sleeping until
+// they complete. 'dest' must have room for a temperature for each channel
+// Returns the number of temperatures, with TEMPERATURE_RAW_BITS bits each
+uint8_t lm_convert(uint16_t *dest);
 
 #endif  // __LMSENSOR_MODULE_H
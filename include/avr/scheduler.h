@@ -0,0 +1,50 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Event scheduler - Head file
+// ISRs post events, which are dispatched to their handlers in the main loop
+// Handlers run to completion, the most urgent pending event first
+#ifndef __SCHEDULER_MODULE_H
+#define __SCHEDULER_MODULE_H
+#include <stdint.h>
+#include "sleep_util.h"
+
+// Events, ordered by priority (lower values are more urgent)
+typedef enum SCHED_EVENT_E {
+  EV_TEMPERATURE = 0,  // A temperature must be registered
+  EV_COMMUNICATION,    // A packet is incoming, or a command must be iterated
+  EV_BUTTON,           // Buttons were debounced
+  EV_COUNT
+} sched_event_t;
+
+// Event handler, returns non-zero if it must be run again (i.e. re-posted)
+typedef uint8_t (*sched_handler_f)(void);
+
+// Initialize the scheduler, with no handlers and no pending events
+void scheduler_init(void);
+
+// Set the handler for an event
+void scheduler_handler_set(sched_event_t ev, sched_handler_f handler);
+
+// Post an event (ISR-safe). Posting an already pending event has no effect
+void scheduler_post(sched_event_t ev);
+
+// Is there any pending event more urgent than 'ev'? (EV_COUNT for any event)
+uint8_t scheduler_pending(sched_event_t ev);
+
+// Dispatch the most urgent pending event
+// Returns 0 if there was no pending event, 1 otherwise
+uint8_t scheduler_run(void);
+
+// Dispatch the most urgent pending event, if it is more urgent than 'ev'
+// Meant for handlers of 'ev' waiting for something to happen
+// Returns 0 if no event was dispatched, 1 otherwise
+uint8_t scheduler_yield(sched_event_t ev);
+
+// Sleep while 'expr' holds, dispatching the events more urgent than 'ev'
+// meanwhile. 'expr' is evaluated with interrupts disabled, as in 'sleep_on'
+#define scheduler_wait(ev,expr) do {\
+  while (expr)\
+    if (!scheduler_yield(ev))\
+      sleep_on(SLEEP_MODE_IDLE, (expr) && !scheduler_pending(ev));\
+} while (0)
+
+#endif  // __SCHEDULER_MODULE_H
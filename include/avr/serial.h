@@ -3,25 +3,41 @@
 #ifndef __SERIAL_MODULE_H
 #define __SERIAL_MODULE_H
 #include <stdint.h>
+#include "framing.h"
+#include "packet.h"
 
 // USART Parameters - Divider equals 8 as U2X is enabled
 #define BAUD_RATE 115200
 #define UBRR_VALUE (F_CPU / 8 / BAUD_RATE - 1)
 
-// Transmission buffer size - Default is 64
+// Transmission buffer size - Default is 128 (plus the framing overhead), it
+// must hold a whole framed packet
 #ifndef TX_BUFFER_SIZE
-#define TX_BUFFER_SIZE 32
+#define TX_BUFFER_SIZE (128 + FRAMING_OVERHEAD)
+#endif
+
+// Number of TX frames - One for each packet which can be in flight, kept to be
+// sent again until it is acknowledged, plus one to fill the next packet
+#ifndef TX_FRAMES
+#define TX_FRAMES (PACKET_ACK_WINDOW + 1)
 #endif
 
 // Reception buffer size - Default is 64
 #ifndef RX_BUFFER_SIZE
-#define RX_BUFFER_SIZE 32
+#define RX_BUFFER_SIZE 64
 #endif
 
 
+// Type definition for a handler of received bytes, called in ISR context
+typedef void (*serial_rx_handler_f)(uint8_t byte);
+
 // Initialize the UART
 void serial_init(void);
 
+// Hand each received byte to 'handler' as soon as it arrives, instead of
+// storing it to be read with 'serial_rx'. A NULL handler restores the latter
+void serial_rx_handler_set(serial_rx_handler_f handler);
+
 // Read 'size' bytes, storing them into 'buf' - Non-blocking
 // Returns the number of bytes read
 uint8_t serial_rx(void *buf, uint8_t size);
@@ -34,12 +50,27 @@ uint8_t serial_rx_blocking(void *buf, uint8_t size);
 #define serial_rx_getchar(c) serial_rx(c,1)
 
 // Send data stored in a buffer
-// The data will be copied into another buffer, so it can be reused immediately
+// The data will be copied into a TX frame, so it can be reused immediately
 // Returns 0 on success, 1 on failure
-// The function blocks until the previous transmission, if any, is completed,
-// and returns immediately, not waiting for all the data to be already sent
+// The function sleeps while the next TX frame is busy, and returns
+// immediately, not waiting for all the data to be already sent
 uint8_t serial_tx(const void *buf, uint8_t size);
 
+// Get a free TX frame (of TX_BUFFER_SIZE bytes), to fill it in place and send
+// it with 'serial_tx_commit'. There are TX_FRAMES frames, used in turn, so
+// that one can be filled while the other ones are being sent
+// The function sleeps while the frame is still being sent
+void *serial_tx_reserve(void);
+
+// Send the first 'size' bytes of the reserved TX frame, which is then released
+// Returns 0 on success, 1 on failure
+uint8_t serial_tx_commit(uint8_t size);
+
+// Send again the last 'count' committed frames (less than TX_FRAMES), in the
+// same order, as they are left untouched by the following reserve
+// Returns 0 on success, 1 if they were not all committed
+uint8_t serial_tx_resend(uint8_t count);
+
 // Return the number of bytes received
 uint8_t serial_rx_available(void);
 
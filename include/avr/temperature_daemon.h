@@ -5,8 +5,9 @@
 #include <stdint.h>
 
 // Initialize the daemon (inlcuding related timer and LM sensor)
+// A sensor is sampled for each ADC pin set in 'lm_adc_mask' (A0 if none)
 void temperature_daemon_init(uint16_t tim_resolution, uint16_t tim_interval,
-    uint8_t lm_adc_pin);
+    uint8_t lm_adc_mask);
 
 // Start/Stop the daemon -- Button friendly (but argument will be ignored)
 void temperature_daemon_start(uint8_t);
@@ -24,7 +25,7 @@ uint16_t temperature_daemon_get_interval(void);
 void temperature_daemon_set_resolution(uint16_t);
 void temperature_daemon_set_interval(uint16_t);
 
-// Handle daemon "notifications", must be run periodically
+// Handle daemon "notifications", i.e. the EV_TEMPERATURE event
 // Always returns 0
 uint8_t temperature_daemon_handler(void);
 
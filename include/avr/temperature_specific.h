@@ -7,32 +7,134 @@
 #error "Do not use implementation-specific temperature modules directly. Instead, '#include \"temperature.h\"'"
 #endif
 
-// Temperature database type definition
+// Temperatures are stored in the NVM as an append-only log of 16-bit words,
+// which wraps around the NVM so that every word is written once per lap
+// Each word carries the parity of the lap it was written in (i.e. its phase),
+// so the end of the log is found at boot by scanning it, without keeping any
+// counter in a fixed place. A word is either a temperature or a piece of a DB
+// header, and a DB is made of its header followed by its temperatures
+typedef uint16_t temperature_log_word_t;
+
+#define TEMP_LOG_PHASE   0x8000  // Parity of the lap the word was written in
+#define TEMP_LOG_META    0x4000  // Header word if set, temperature otherwise
+#define TEMP_LOG_VALUE   0x3FFF  // Temperature value (i.e. 14 bits)
+#define TEMP_LOG_ERASED  0xFFFF  // Never written (e.g. formatted) word
+
+// Header word tags (bits 12-13), each one carrying 12 bits of payload
+#define TEMP_LOG_TAG(w)      (((w) >> 12) & 0x3)
+#define TEMP_LOG_PAYLOAD(w)  ((w) & 0x0FFF)
+#define TEMP_LOG_TAG_DB      0  // First word of a DB header, carries the ID
+#define TEMP_LOG_TAG_ARG     1  // 12 bits of a 16-bit header field
+
+// A DB header is [DB id] [resolution lo, hi] [interval lo, hi]
+// The first word carries the DB flags in the upper 4 bits of its payload
+#define TEMP_LOG_HEADER_WORDS 5
+#define TEMP_LOG_DB_ID(w)     ((w) & 0x00FF)
+#define TEMP_LOG_DB_FLAGS(w)  (((w) >> 8) & 0xF)
+#define TEMP_LOG_DB_DELTA     0x1  // Temperatures are delta-compressed
+#define TEMP_LOG_DB_CHANNELS(f) ((((f) >> 1) & 0x7) + 1)  // Channels in a DB
+#define TEMP_LOG_DB_CHANNELS_FLAGS(n) ((((n) - 1) & 0x7) << 1)
+
+// A DB with more channels holds interleaved records, one temperature for each
+// channel in turn: the i-th temperature is of channel i % channels
+
+// Delta-compressed DBs start with a keyframe word, holding a temperature as-is,
+// followed by words packing the differences between each temperature and the
+// previous one as two's complement values: either three 4-bit deltas or an
+// 8-bit delta followed by a 4-bit one, from the lowest bits. Unused slots hold
+// the escape code (i.e. the lowest value), while a jump which does not fit in
+// 8 bits is stored as a new keyframe. Each channel has its own previous
+// temperature, and its first temperature is a keyframe
+#define TEMP_LOG_DELTA       0x2000  // Deltas word if set, keyframe otherwise
+#define TEMP_LOG_DELTA_WIDE  0x1000  // 8-bit + 4-bit deltas if set, 3 x 4-bit
+#define TEMP_LOG_KEY_VALUE   0x1FFF  // Keyframe temperature (i.e. 13 bits)
+#define TEMP_LOG_ESC4        0x8     // Escape code of a 4-bit slot
+#define TEMP_LOG_ESC8        0x80    // Escape code of an 8-bit slot
+#define TEMP_LOG_DELTA_SLOTS 3       // Max temperatures in a deltas word
+
+// Number of words staged in RAM before being committed to the NVM at once
+#define TEMP_STAGE_WORDS 16
+
+// Max number of DBs, each one having an entry in a directory kept in RAM
+#define TEMP_DB_MAX 64
+
+// Value of the 'magic' field of a formatted log
+#define TEMP_LOG_MAGIC 0x7E4A
+
+// Index of a word in the log. 16-bit indices address up to 32K words, which
+// is plenty for the AVR EEPROM; define TEMP_LOG_WIDE when building against a
+// larger NVM backend (e.g. a multi-megabyte host image)
+// The MSB of an index is reserved for the phase (see below)
+#ifdef TEMP_LOG_WIDE
+typedef uint32_t temperature_log_idx_t;
+#define TEMP_LOG_IDX_PHASE 0x80000000UL
+#else
+typedef uint16_t temperature_log_idx_t;
+#define TEMP_LOG_IDX_PHASE 0x8000
+#endif
+#define TEMP_LOG_IDX_MAX (TEMP_LOG_IDX_PHASE - 1)  // Max words in the log
+
+// NVM log control block, followed by the log itself
+// 'tail' is the index of the oldest word of the log, with the phase of its lap
+// in the MSB; it is written only when the DBs are reset
+typedef struct _temperature_log_s {
+  uint16_t magic;
+  temperature_log_idx_t tail;
+  temperature_log_word_t words[];
+} temperature_log_t;
+
+// Treat the NVM allocated space as a log of DBs
+typedef temperature_log_t temperature_db_seq_t;
+
+// Temperature database descriptor, kept in RAM
 // A temperature is registered every rto_resolution * reg_interval seconds
 typedef struct _temperature_db_s {
   temperature_id_t used;
   uint16_t reg_resolution; // Registration timer resolution
   uint16_t reg_interval;   // Registration timer interval
+  temperature_log_idx_t start;  // Log index of the first temperature
+  uint16_t words;          // Log words taken by the temperatures
   uint8_t id;
-  uint8_t locked; // If 'locked', no other temperatures can be added
-  temperature_t items[];
+  uint8_t flags;           // TEMP_LOG_DB_* header flags
 } temperature_db_t;
 
-// Treat the NVM allocated space as a sequence of immutable DB objects
-typedef temperature_db_t temperature_db_seq_t;
+// DB directory entry, built when scanning the log and when a DB is locked
+typedef struct _temperature_dir_entry_s {
+  temperature_log_idx_t header; // Log index of the DB header
+  uint16_t words;          // Log words taken by the temperatures
+  temperature_id_t used;
+} temperature_dir_entry_t;
 
 
 // Setup for using the temperature database
+// Scan the log to find the DBs in it; the log is formatted on the first boot
+// after the NVM image is flashed, which takes a while
 void temperature_init(void);
 
 // Lock the DB currently in use and create a new one
-// Returns 0 on success, 1 on insufficient space
+// Returns 0 on success, 1 on insufficient space or if there are TEMP_DB_MAX DBs
 uint8_t temperature_db_new(uint16_t reg_resolution, uint16_t reg_interval);
 
+// Choose whether the DBs created from now on are delta-compressed, which
+// stores about 3 temperatures per word if they change slowly
+void temperature_db_compression(uint8_t enable);
+
+// Set the number of channels of the DBs created from now on
+// Returns 0 on success, 1 if it is not in [1, TEMPERATURE_CHANNELS_MAX]
+uint8_t temperature_db_channels(uint8_t channels);
+
 // Register a new temperature in the database currently in use
-// Returns 0 on success, 1 otherwise (e.g. if there is no more space)
+// Each record takes a temperature for each channel, registered in order
+// Only the lower 14 bits of 'raw_val' are stored (13 if delta-compressed)
+// Returns 0 on success, 1 otherwise (e.g. if there is no more space, or the
+// DB already holds as many temperatures as a 'temperature_id_t' can count)
 uint8_t temperature_register(uint16_t raw_val);
 
+// Commit the temperatures staged in RAM to the NVM
+// Temperatures are staged and committed in blocks of TEMP_STAGE_WORDS words,
+// so the ones which are still staged are lost if power goes down
+void temperature_flush(void);
+
 // Get a temperature by id
 // Returns 0 if the temperature exists, 1 otherwise
 uint8_t temperature_get(uint8_t db_id, temperature_id_t temp_id,
@@ -0,0 +1,26 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// 16-bit timers prescaler computation - Head file
+// Given a period, compute the prescaler and compare value (CTC mode) which
+// cover it with the fewest compare matches, i.e. wakeups
+#ifndef __TIMER_PRESCALER_H
+#define __TIMER_PRESCALER_H
+#include <stdint.h>
+
+// Timer setup covering a period
+typedef struct _timer_setup_s {
+  uint8_t  cs;       // Clock select bits (i.e. CSn[2:0]) for the prescaler
+  uint16_t ocr;      // Compare value (the timer counts 'ocr + 1' ticks)
+  uint32_t matches;  // Compare matches in a period, 1 unless it is too long
+} timer_setup_t;
+
+// Get the prescaler value selected by some clock select bits (0 if stopped)
+uint16_t timer_prescaler_value(uint8_t cs);
+
+// Compute the setup for a period of 'period_ms' milliseconds
+// The smallest prescaler (i.e. the finest tick) which covers the whole period
+// with one compare match is chosen; longer periods are split evenly in the
+// fewest possible compare matches with the largest prescaler
+// Returns 0 on success, 1 if the period is 0
+uint8_t timer_prescaler_compute(uint32_t period_ms, timer_setup_t *setup);
+
+#endif  // __TIMER_PRESCALER_H
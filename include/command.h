@@ -46,20 +46,19 @@ typedef uint16_t command_download_arg_t;
 
 #ifdef AVR // AVR specific stuff
 #include "communication.h"
+#include "progmem.h"
 
 // Command function to be executed as its "launcher"
 typedef uint8_t (*command_action_f)(const void *arg);
 
 // Command data type definition
+// Commands are constant, and live in the program memory (i.e. PROGMEM)
 typedef struct _command_s {
   command_action_f start;   // Executed the first time a command is launched
   command_action_f iterate; // Executed every time the command "receives an event"
   com_opmode_t opmode;
 } command_t;
 
-// Initialize the commands table
-void command_init(void);
-
 // Start a command, given its ID and an optional argument
 // This will eventually alter the current opmode
 uint8_t command_start(command_id_t id, const void *arg);
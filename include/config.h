@@ -6,13 +6,15 @@
 
 
 // Number of field present in the configuration
-#define CONFIG_FIELD_COUNT 7
+#define CONFIG_FIELD_COUNT 9
 
 // Identifiers for each configuration field
 enum CONFIG_FIELD_E {
   CFG_TEMPERATURE_TIMER_RESOLUTION,
   CFG_TEMPERATURE_TIMER_INTERVAL,
+  CFG_TEMPERATURE_COMPRESSION,
   CFG_LMSENSOR_PIN,
+  CFG_LMSENSOR_CHANNELS,
   CFG_BTN_DEBOUNCE_TIME,
   CFG_POWEROFF_PIN,
   CFG_START_PIN,
@@ -25,7 +27,9 @@ typedef uint8_t config_field_t;
 typedef struct _config_s {
   uint16_t temperature_timer_resolution;
   uint16_t temperature_timer_interval;
+  uint8_t temperature_compression;
   uint8_t lmsensor_pin;
+  uint8_t lmsensor_channels;
   uint8_t btn_debounce_time;
   uint8_t poweroff_pin;
   uint8_t start_pin;
@@ -3,14 +3,61 @@
 #ifndef __CRC_MODULE_H
 #define __CRC_MODULE_H
 #include <stdint.h>
+#include <stddef.h>
 
 // CRC Algorithm parameters
 // The standard CRC-8 is used, but any other algorithm which does not make use
-// of data reflection or xorout is supported
+// of data reflection or xorout is supported, regenerating the lookup tables
+// (see 'resources/crc_table_generator.c')
 #define CRC_NAME "CRC-8"
 #define CRC_POLY 0x07
 #define CRC_INIT 0x00
 #define CRC_CHECK 0xF4
+#define CRC_RESIDUE 0x00  // Remainder of a sane message with its trailing CRC
+
+// Wide CRC algorithms, protecting longer frames (see 'packet.h')
+// Both are reflected (i.e. each byte is processed from its LSB, and the
+// polynomial is given in reversed bit order), and their trailing CRC is stored
+// with its least significant byte first
+#define CRC16_NAME "CRC-16/KERMIT (CCITT)"
+#define CRC16_POLY 0x8408  // 0x1021 reflected
+#define CRC16_INIT 0x0000
+#define CRC16_XOROUT 0x0000
+#define CRC16_CHECK 0x2189
+#define CRC16_RESIDUE 0x0000
+
+#define CRC32C_NAME "CRC-32C (Castagnoli)"
+#define CRC32C_POLY 0x82F63B78UL  // 0x1EDC6F41 reflected
+#define CRC32C_INIT 0xFFFFFFFFUL
+#define CRC32C_XOROUT 0xFFFFFFFFUL
+#define CRC32C_CHECK 0xE3069283UL
+#define CRC32C_RESIDUE 0xB798B438UL
+
+// Wide CRC in use, chosen at compile time: 16 (CRC-16) or 32 (CRC-32C)
+// Both the tmon and the host must be built with the same one
+#ifndef CRC_WIDE
+#define CRC_WIDE 32
+#endif
+
+#if CRC_WIDE == 16
+typedef uint16_t crc_wide_t;
+#define CRC_WIDE_NAME CRC16_NAME
+#define CRC_WIDE_POLY CRC16_POLY
+#define CRC_WIDE_INIT CRC16_INIT
+#define CRC_WIDE_XOROUT CRC16_XOROUT
+#define CRC_WIDE_CHECK CRC16_CHECK
+#define CRC_WIDE_RESIDUE CRC16_RESIDUE
+#elif CRC_WIDE == 32
+typedef uint32_t crc_wide_t;
+#define CRC_WIDE_NAME CRC32C_NAME
+#define CRC_WIDE_POLY CRC32C_POLY
+#define CRC_WIDE_INIT CRC32C_INIT
+#define CRC_WIDE_XOROUT CRC32C_XOROUT
+#define CRC_WIDE_CHECK CRC32C_CHECK
+#define CRC_WIDE_RESIDUE CRC32C_RESIDUE
+#else
+#error "CRC_WIDE must be either 16 or 32"
+#endif
 
 // CRC type definition
 // Makes the packet type definition resilient to a change (in size) of the CRC
@@ -19,7 +66,7 @@ typedef uint8_t crc_t;
 // Compute the CRC of a chunk of data
 // Do not include trailing zeroes as a room for the CRC (if there are, then
 // truncate the 'size' parameter so they are not counted)
-crc_t crc(const void *data, uint8_t size);
+crc_t crc(const void *data, size_t size);
 
 // Check a chunk of data with a trailing CRC
 // You have to count the bytes taken by the CRC in the 'size' parameter
@@ -28,6 +75,31 @@ crc_t crc(const void *data, uint8_t size);
 // a detectable error).
 // Returns the remainder of the division, but it can be safely converted to a
 // smaller data type if only knowing if the message is corrupted is relevant
-crc_t crc_check(const void *data, uint8_t size);
+crc_t crc_check(const void *data, size_t size);
+
+// Update a running CRC with a single byte, e.g. while the data is received
+// Starting from CRC_INIT gives the CRC of the data, while going on with the
+// trailing CRC gives CRC_RESIDUE if the data is not corrupted
+crc_t crc_update(crc_t current_crc, uint8_t byte);
+
+
+// Same as above, for the wide CRC
+// 'crc_wide_check' returns 0 if the data is not corrupted, while a running
+// CRC is started from CRC_WIDE_INIT and ends in CRC_WIDE_RESIDUE (its final
+// value, to be stored, is obtained by xoring it with CRC_WIDE_XOROUT)
+crc_wide_t crc_wide(const void *data, size_t size);
+crc_wide_t crc_wide_check(const void *data, size_t size);
+crc_wide_t crc_wide_update(crc_wide_t current_crc, uint8_t byte);
+
+// Locate a single flipped bit in a message of 'size' bytes with a trailing
+// wide CRC, given the value returned by 'crc_wide_check' (i.e. the syndrome)
+// Returns the index of the bit (8 times its byte plus its position, counted
+// from the LSB), or -1 if the syndrome is not the one of a single bit error
+int32_t crc_wide_locate(crc_wide_t syndrome, size_t size);
+
+// Name of the kernel computing the wide CRC in bulk
+#if defined(TEST) || !defined(AVR)
+const char *crc_wide_kernel(void);
+#endif
 
 #endif  // __CRC_MODULE_H
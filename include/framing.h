@@ -0,0 +1,52 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Packet framing (COBS) - Head file
+// Optionally, each packet is sent byte-stuffed with COBS (Consistent Overhead
+// Byte Stuffing) and followed by a delimiter byte, which never appears inside
+// a frame. A receiver can then drop a corrupted frame and lock onto the next
+// one as soon as the delimiter comes, instead of waiting for the RTO
+#ifndef __FRAMING_MODULE_H
+#define __FRAMING_MODULE_H
+#include <stdint.h>
+
+// Framing in use, chosen at compile time: 0 (raw packets) or 1 (COBS)
+// Both the tmon and the host must be built with the same one
+#ifndef COBS_FRAMING
+#define COBS_FRAMING 0
+#endif
+
+// Frame delimiter
+#define FRAMING_DELIMITER 0x00
+
+// Bytes added to a packet by the framing, i.e. the COBS code byte (a single
+// one, as packets are shorter than 254 bytes) and the delimiter
+#if COBS_FRAMING
+#define FRAMING_OVERHEAD 2
+#else
+#define FRAMING_OVERHEAD 0
+#endif
+
+// Values returned by 'framing_decode' which are not a decoded byte
+#define FRAMING_NONE -1  // Nothing decoded (i.e. a COBS code byte)
+#define FRAMING_END  -2  // Delimiter, i.e. the frame is over
+
+// COBS decoder state, to decode a frame byte by byte as it is received
+typedef struct _framing_decoder_s {
+  uint8_t code;  // Last code byte, or 0 at the beginning of a frame
+  uint8_t left;  // Bytes left in the current block
+} framing_decoder_t;
+
+
+// Encode 'size' bytes (less than 254) from 'src' into 'dest', delimiter
+// included. 'dest' must hold 'size + 2' bytes, and can be the same as 'src'
+// Returns the size of the frame
+uint8_t framing_encode(uint8_t *dest, const uint8_t *src, uint8_t size);
+
+// Reset a decoder, i.e. a new frame begins with the next byte
+void framing_decoder_reset(framing_decoder_t*);
+
+// Decode a single received byte
+// Returns the decoded byte, FRAMING_NONE or FRAMING_END (resetting the
+// decoder for the next frame)
+int16_t framing_decode(framing_decoder_t*, uint8_t byte);
+
+#endif  // __FRAMING_MODULE_H
@@ -0,0 +1,52 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperature aggregation - Head file
+#ifndef __AGGREGATE_MODULE_H
+#define __AGGREGATE_MODULE_H
+#include "temperature.h"
+
+// Summary of a window (i.e. bucket) of temperatures
+typedef struct _aggregate_s {
+  time_t start;    // Acquisition time of the first temperature of the bucket
+  unsigned count;  // Number of temperatures in the bucket
+  float min, max, mean;
+} aggregate_t;
+
+// Result of the aggregation of a whole database
+typedef struct _aggregate_db_s {
+  const temperature_db_t *db;
+  aggregate_t *buckets;
+  unsigned nbuckets;
+} aggregate_db_t;
+
+
+// Aggregate 'count' temperatures in a single pass
+// The 'start' field of the returned summary is left to 0
+aggregate_t aggregate_kernel(const float *items, unsigned count);
+
+// Aggregate a database in consecutive windows of 'window' seconds
+// A window is rounded to a whole number of temperatures (at least one)
+// Returns 0 on success, 1 otherwise. On success, 'dest->buckets' is allocated
+// and must be freed with 'aggregate_db_clear'
+int aggregate_db(const temperature_db_t *db, unsigned window,
+    aggregate_db_t *dest);
+
+// Aggregate many databases in parallel, on a pool of at most as many threads
+// as the online CPUs
+// 'dest' must be able to store 'ndbs' results
+// Returns 0 on success, 1 if the aggregation of at least one database failed
+int aggregate_db_parallel(temperature_db_t **dbs, unsigned ndbs,
+    unsigned window, aggregate_db_t *dest);
+
+// Free the buckets of an aggregated database
+void aggregate_db_clear(aggregate_db_t *agg);
+
+// Export an aggregated database as a text file, one bucket per line:
+// <seconds since start> <min> <mean> <max> <count>
+// Returns 0 on success, 1 otherwise
+int aggregate_db_export(const aggregate_db_t *agg, const char *fpath);
+
+// Parse a window size, in seconds or with a suffix among 's', 'm', 'h', 'd'
+// Returns 0 on success, 1 otherwise
+int aggregate_window_parse(const char *str, unsigned *window);
+
+#endif  // __AGGREGATE_MODULE_H
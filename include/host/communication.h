@@ -7,6 +7,8 @@
 #include "command.h"
 
 // RTO value in milliseconds
+// The module keeps its state in the serial context of each connection, so
+// different connections can be driven concurrently by different threads
 #define RTO_VALUE_MSEC 150
 
 // Number of maximum attempts to send/receive a single packet
@@ -19,12 +21,6 @@ typedef enum ERR_CODE_E {
 } err_code_t;
 
 
-// Initialize the communication module
-int communication_init(void);
-
-// Cleanup for the communication module
-void communication_cleanup(void);
-
 // Estabilish a connection, sending a handshake (HND) packet
 // Return 0 on success, 1 on failure
 int communication_connect(serial_context_t*);
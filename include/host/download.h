@@ -0,0 +1,43 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperatures downloader - Head file
+#ifndef __DOWNLOAD_MODULE_H
+#define __DOWNLOAD_MODULE_H
+#include "serial.h"
+#include "temperature.h"
+
+// Set of callbacks receiving the downloaded data as soon as it arrives
+// Every callback returns 0 to go on with the download, non-zero to abort it
+// 'env' is passed as-is to each callback
+typedef struct _download_handler_s {
+  // A new DB is incoming, with 'count' temperatures as interleaved records of
+  // 'channels' temperatures (i.e. the i-th one is of channel i % channels)
+  int (*db_begin)(void *env, uint8_t id, temperature_id_t count,
+      uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels);
+
+  // A burst of raw temperatures for the current DB was received
+  int (*db_data)(void *env, const temperature_t *raw, unsigned count);
+
+  // All the temperatures of the current DB were received
+  int (*db_end)(void *env);
+} download_handler_t;
+
+// Outcome of a download
+typedef enum DOWNLOAD_RET_E {
+  DOWNLOAD_OK = 0,
+  DOWNLOAD_E_SEND,      // Could not send the download command
+  DOWNLOAD_E_RECV,      // Could not receive a packet (e.g. timeout)
+  DOWNLOAD_E_PROTOCOL,  // Unexpected packet or inconsistent data received
+  DOWNLOAD_E_HANDLER    // A callback aborted the download
+} download_ret_t;
+
+
+// Download all the temperatures from a connected tmon
+// Nothing is stored: every DB and burst is handed to 'handler' on arrival
+// Returns a 'download_ret_t' code
+int download_run(serial_context_t*, const download_handler_t *handler,
+    void *env);
+
+// Get a string describing a 'download_ret_t' code
+const char *download_strerror(int ret);
+
+#endif  // __DOWNLOAD_MODULE_H
@@ -0,0 +1,22 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// File-backed NVM backend - Head file
+// An NVM image is a regular file mapped in memory, so the AVR-side storage
+// modules can run on the host against images much larger than the EEPROM
+// (e.g. to measure their capacity or to benchmark them)
+#ifndef __NVM_MMAP_H
+#define __NVM_MMAP_H
+#include <stddef.h>
+#include "nvm_backend.h"
+
+// Open (or create) an NVM image file of 'size' bytes, mapping it in memory
+// A newly created file, or the bytes it is extended with, are erased (i.e.
+// every bit is set to 1). If 'size' is 0, the file size is used as-is
+// Only an image can be opened at once
+// Returns the backend, or NULL on failure
+const nvm_backend_t *nvm_mmap_open(const char *path, size_t size);
+
+// Write back and close the NVM image currently open
+// Returns 0 on success, 1 on failure or if there is no open image
+int nvm_mmap_close(void);
+
+#endif  // __NVM_MMAP_H
@@ -0,0 +1,12 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// One-shot download ('avrtmon pull') - Head file
+#ifndef __PULL_MODULE_H
+#define __PULL_MODULE_H
+
+// Non-interactive download, meant to be run by cron and similar tools
+// Connect to a tmon, download all of its DBs streaming them to files and exit
+// Usage: avrtmon pull --dev <device> [--out <dir>] [--format bin|csv]
+// Returns an exit status as defined in sysexits.h (EX_OK on success)
+int pull_main(int argc, char *argv[]);
+
+#endif  // __PULL_MODULE_H
@@ -5,6 +5,7 @@
 #define __SERIAL_MODULE_H
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 #include "packet.h"
 #include "ringbuffer.h"
 
@@ -13,7 +14,7 @@
 #if defined(DEBUG) && !defined(RX_BUF_SIZE)
 #define RX_BUF_SIZE 512
 #elif !defined(RX_BUF_SIZE)
-#define RX_BUF_SIZE 64
+#define RX_BUF_SIZE 256  // Room for a couple of jumbo frames
 #endif
 
 
@@ -25,6 +26,14 @@ typedef struct _serial_context_s {
     pthread_t     thread;
     unsigned char ongoing;
   } rx;
+  struct { // Communication layer state, handled by the communication module
+    struct timespec rto_deadline;
+    unsigned char packet_id; // Next packet ID expected or to be used
+    unsigned char crc_flag;  // PACKET_CRC_WIDE if agreed on at handshake
+    unsigned char ack_deferred;  // BLK packets received and not ACKed yet
+    unsigned char rx_stashed;    // 1 if 'rx_stash' is the next received packet
+    packet_t rx_stash;  // Packet which carried the ACK of the one sent
+  } com;
 } serial_context_t;
 
 
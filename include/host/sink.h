@@ -0,0 +1,51 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Download sinks - Head file
+// A sink receives the temperatures of a download burst by burst, as they
+// arrive, so the memory used does not depend on the size of the DBs
+#ifndef __SINK_MODULE_H
+#define __SINK_MODULE_H
+#include "serial.h"
+#include "download.h"
+
+// Size of the (fixed) write buffer of a file sink
+#define SINK_BUF_SIZE 4096
+
+// Default number of temperatures between two fsync checkpoints
+#define SINK_CHECKPOINT_DEFAULT 1024
+
+// Output formats for file sinks
+typedef enum SINK_FORMAT_E {
+  SINK_FORMAT_BIN,  // Magic, version, little-endian header and raw samples
+  SINK_FORMAT_CSV   // 'seconds,celsius' rows (a column for each channel)
+} sink_format_t;
+
+typedef struct _sink_s sink_t;
+
+
+// Create a sink writing every DB to '<dir>/<prefix>-<db_id>.<bin|csv>'
+// A file is written as '<file>.part' and renamed only when its DB is complete
+// Data is flushed to disk every 'checkpoint' temperatures (0 means only when
+// a DB is complete)
+// Returns a pointer to the new sink, or NULL on failure
+sink_t *sink_file_new(const char *dir, const char *prefix,
+    sink_format_t format, unsigned checkpoint);
+
+// Create a sink handing every DB burst to user-defined callbacks
+// Returns a pointer to the new sink, or NULL on failure
+sink_t *sink_callback_new(const download_handler_t *handler, void *env);
+
+// Delete a sink. The file of an incomplete DB is left with its '.part' name
+void sink_delete(sink_t*);
+
+// Download all the DBs of a connected tmon into a sink
+// Returns a 'download_ret_t' code
+int sink_download(serial_context_t*, sink_t*);
+
+// Get the number of DBs completely written by a sink
+unsigned sink_db_count(const sink_t*);
+
+// Parse a format name (i.e. "bin" or "csv")
+// Returns 0 on success, 1 if the format is unknown
+int sink_format_parse(const char *str, sink_format_t *format);
+
+#endif  // __SINK_MODULE_H
@@ -6,6 +6,7 @@
 #ifndef __TEMPERATURE_INTERFACE_H
 #error "Do not use implementation-specific temperature modules directly. Instead, '#include \"temperature.h\"'"
 #endif
+#include <time.h>
 
 // Type definition for a single temperature database
 // A temperature is registered every rto_resolution * reg_interval milliseconds
@@ -18,6 +19,7 @@ typedef struct _temperature_db_s {
   unsigned reg_resolution; // Registration timer resolution
   unsigned reg_interval;   // Registration timer interval
   char *desc;     // Optional, brief description of the database
+  time_t anchor;  // Acquisition time of the first temperature (0 if unknown)
   float *items;
 } temperature_db_t;
 
@@ -41,6 +43,24 @@ char *temperature_db_get_desc(const temperature_db_t *db,
 // Set the description of a database -- 'dest' will be duplicated
 void temperature_db_set_desc(temperature_db_t *db, const char *dest);
 
+// Set the acquisition time of the first temperature of a database
+void temperature_db_set_anchor(temperature_db_t *db, time_t anchor);
+
+// Get the time between two temperatures of a database, in milliseconds
+unsigned temperature_db_period(const temperature_db_t *db);
+
+// Get the index of the first temperature registered at or after 't'
+// Temperatures are equally spaced, so the index is computed in constant time
+// Returns the index, which is 'used' if there is no such temperature
+unsigned temperature_db_time_index(const temperature_db_t *db, time_t t);
+
+// Get the temperatures registered in the time range [from, to), by reference
+// '*slice' will point to the first of them inside the database, and is valid
+// as long as the database is
+// Returns the number of temperatures in the slice (0 if none or on failure)
+unsigned temperature_db_slice(const temperature_db_t *db, time_t from,
+    time_t to, const float **slice);
+
 // Register a temperature
 // Returns 0 on success, 1 otherwise
 int temperature_register(temperature_db_t *db, float value);
@@ -59,6 +79,19 @@ unsigned temperature_get_bulk(const temperature_db_t *db, unsigned start_id,
 unsigned temperature_register_bulk(temperature_db_t *db,
     unsigned ntemps, const float *src);
 
+// Register interleaved records (i.e. a temperature for each channel in turn)
+// into a DB for each one of the 'channels'
+// '*next' is the channel of the first temperature, and is updated for the
+// following ones, so that the records can be split across many calls
+// Returns the number of temperatures registered
+unsigned temperature_register_interleaved(temperature_db_t **dbs,
+    unsigned channels, unsigned *next, unsigned ntemps, const float *src);
+
+// Get the number of temperatures of a channel, given the total number of
+// temperatures in interleaved records of 'channels' temperatures
+unsigned temperature_channel_count(unsigned count, unsigned channels,
+    unsigned channel);
+
 // Convert a raw temperature (i.e. uint16_t) coming from the avrtmon to a float
 float temperature_raw2float(temperature_t raw);
 
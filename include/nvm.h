@@ -2,14 +2,19 @@
 // Non-Volatile Memory interface (MCU: Atmel ATMega2560)
 // NOTE: the order of the arguments has been changed to gain consistency across
 // the interface and to fulfill UNIX standard functions (e.g. memcpy, read ...)
+// Every operation is dispatched to the backend in use (see 'nvm_backend.h')
 #ifndef __NVM_INTERFACE_H
 #define __NVM_INTERFACE_H
 #include <stddef.h>
 #include "config.h"
 #include "temperature.h"
+#include "nvm_backend.h"
+
+// Backend in use, the AVR EEPROM by default
+extern const nvm_backend_t *nvm_backend;
 
 // NVM size and limit pointer
-#define NVM_SIZE 4096
+#define NVM_SIZE (nvm_backend->size)
 #define NVM_LIMIT (((void*) nvm_image) + NVM_SIZE - 1)
 
 // Data type definition for the memory image
@@ -24,9 +29,13 @@ typedef struct _nvm_image_s {
 #define NVM_IMAGE_FULL_SIZE (NVM_IMAGE_META_SIZE + \
     TEMP_DB_CAPACITY * sizeof(temperature_t))
 
+// NVM pointer to the memory image (use as a 'nvm_image_t*' variable)
+#define nvm_image ((nvm_image_t*) nvm_backend->base)
+
 
 #ifdef TEST // Use mock interface when testing
 #include "nvm_mock.h"
+#define NVM_BACKEND_DEFAULT NULL  // Chosen by the test itself
 
 
 #else  // AVR real NVM interface
@@ -35,33 +44,51 @@ typedef struct _nvm_image_s {
 // Put a variable in the NVM image, if the operation is supported
 #define NVMMEM EEMEM
 
-// NVM pointer to the memory image (use as a 'nvm_image_t*' variable)
-#define nvm_image _nvm_image_ptr
+// EEPROM backend, whose asynchronous writes are queued and served by the
+// EE_READY interrupt
+extern const nvm_backend_t nvm_eeprom;
+#define NVM_BACKEND_DEFAULT (&nvm_eeprom)
 
-// Read a block of data to the NVM
-#define nvm_read(dst,src,size) eeprom_read_block(dst,src,size)
+#endif  // TEST/AVR
+
+
+// Read a block of data from the NVM
+static inline void nvm_read(void *dst, const void *src, size_t size) {
+  nvm_backend->read(dst, src, size);
+}
 
 // Write a block of data to the NVM
-#define nvm_write(dst,src,size) eeprom_write_block(src,dst,size)
+static inline void nvm_write(void *dst, const void *src, size_t size) {
+  nvm_backend->write(dst, src, size);
+}
 
 // Write a block of data to the NVM only if it differs from the existent one
-// Note that the order of the arguments has been changed to gain consistency
-// across the interface and to fulfill UNIX standard functions (e.g. memcpy)
-#define nvm_update(dst,src,size) eeprom_update_block(src,dst,size)
+static inline void nvm_update(void *dst, const void *src, size_t size) {
+  nvm_backend->update(dst, src, size);
+}
 
-// Is there an ongoing operation?  0 -> No, !0 -> Yes
-#define nvm_ongoing() (!eeprom_ready())
+// Queue a block of data to be written to the NVM, only where it differs from
+// the existent one. 'src' is copied, so it can be reused as soon as this
+// returns
+static inline void nvm_update_async(void *dst, const void *src, size_t size) {
+  nvm_backend->update_async(dst, src, size);
+}
+
+// Is there an ongoing operation (queued ones included)?  0 -> No, !0 -> Yes
+// This is the completion flag to poll after 'nvm_update_async'
+#define nvm_ongoing() (nvm_backend->pending())
 
 // Do nothing while an NVM operation is ongoing
-#define nvm_busy_wait() eeprom_busy_wait()
+#define nvm_busy_wait() (nvm_backend->wait())
 
-#endif  // TEST/AVR
 
+// The memory image, i.e. its default content in the EEPROM backend
+extern nvm_image_t _nvm_image;
 
 // Pointer to the memory image
 // It is safe to expose this as the image will be saved in the .eeprom section
 // Do not use this directly if you want to keep a module test-compatible.
 // You should use 'nvm_image' instead
-nvm_image_t *_nvm_image_ptr;
+extern nvm_image_t *_nvm_image_ptr;
 
 #endif  // __NVM_INTERFACE_H
@@ -0,0 +1,30 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Non-Volatile Memory backend - Head file
+// A backend is a storage device (e.g. the AVR EEPROM, an SPI flash or FRAM, a
+// file on the host) behind a table of operations. Addresses are pointers in
+// the NVM address space, which starts at 'base' and spans 'size' bytes
+#ifndef __NVM_BACKEND_H
+#define __NVM_BACKEND_H
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _nvm_backend_s {
+  void *base;          // Address of the first byte of the NVM
+  size_t size;         // Size of the NVM, in bytes
+  size_t erase_block;  // Smallest erasable unit, in bytes (1 for an EEPROM)
+
+  // Read/Write a block of data. 'update' writes only the bytes which differ
+  void (*read)(void *dst, const void *src, size_t size);
+  void (*write)(void *dst, const void *src, size_t size);
+  void (*update)(void *dst, const void *src, size_t size);
+
+  // Asynchronous update: 'src' is copied, and the write is completed later
+  // Synchronous operations always see the data queued before them
+  void (*update_async)(void *dst, const void *src, size_t size);
+
+  // Completion of the asynchronous writes
+  uint8_t (*pending)(void);  // Is any write still ongoing?  0 -> No, !0 -> Yes
+  void (*wait)(void);        // Wait for every write to be completed
+} nvm_backend_t;
+
+#endif  // __NVM_BACKEND_H
@@ -8,43 +8,97 @@
 // Packet hardcoded properties and parameters
 #define PACKET_ID_WIDTH_BIT 4
 #define PACKET_ID_MAX_VAL (1 << PACKET_ID_WIDTH_BIT)
+#define PACKET_SIZE_WIDTH_BIT 7
 #define PACKET_DATA_MAX_SIZE 28
 #define PACKET_HEADER_SIZE 2
 #define PACKET_MIN_SIZE (PACKET_HEADER_SIZE + sizeof(crc_t))
 #define PACKET_MAX_SIZE sizeof(packet_t)
 
+// Jumbo frames: packets protected by the wide CRC may fill the whole size
+// field, carrying up to PACKET_JUMBO_DATA_MAX_SIZE bytes instead of 28
+#define PACKET_JUMBO_DATA_MAX_SIZE (((1 << PACKET_SIZE_WIDTH_BIT) - 1)\
+    - PACKET_HEADER_SIZE - sizeof(crc_wide_t))
+
+// Largest data size of a packet, given its CRC flag (see below)
+#define packet_data_max_size(crc_flag) \
+  ((crc_flag) ? PACKET_JUMBO_DATA_MAX_SIZE : PACKET_DATA_MAX_SIZE)
+
+// The MSB of the type field tells that the packet is protected by the wide
+// CRC instead of CRC-8 (see 'crc.h'). Pass it together with the type when
+// crafting a packet; ACK and ERR packets inherit it from the acknowledged one
+// The host offers the wide CRC with its handshake, and both peers use it from
+// then on if the tmon can check it. Otherwise, the host falls back to CRC-8
+// Agreeing on the wide CRC also enables jumbo frames, see above
+#define PACKET_CRC_WIDE 0x08
+
+// Forward error correction, chosen at compile time: if enabled (1), a single
+// flipped bit in a packet protected by the wide CRC is corrected in place by
+// the receiver, instead of asking for the packet again. The CRC is used as an
+// error correcting code, so packets with two flipped bits are still detected
+// but some detection strength is lost with more of them (none with CRC-32C up
+// to four). Each side can enable it on its own
+#ifndef PACKET_FEC
+#define PACKET_FEC 0
+#endif
+
+// Acknowledgement window, chosen at compile time: up to PACKET_ACK_WINDOW bulk
+// (BLK) packets can be in flight, acknowledged by a single cumulative ACK,
+// i.e. an ACK acknowledges its packet and all the previous ones. Besides, the
+// ACK of a packet rides on the reply to it, whose ID follows it. With 1, each
+// packet is acknowledged by its own ACK before the next one is sent
+// Both the tmon and the host must be built with the same one
+#ifndef PACKET_ACK_WINDOW
+#define PACKET_ACK_WINDOW 4
+#endif
+#if PACKET_ACK_WINDOW < 1 || PACKET_ACK_WINDOW > PACKET_ID_MAX_VAL / 2 - 1
+#error "PACKET_ACK_WINDOW must be between 1 and 7"
+#endif
+
 // Packet types
-#define PACKET_TYPE_COUNT 6
+#define PACKET_TYPE_COUNT 7
 typedef enum PACKET_TYPE_E {
   PACKET_TYPE_HND = 0x00, // Handshake
   PACKET_TYPE_ACK = 0x01, // Acknowledgement
   PACKET_TYPE_ERR = 0x02, // Communication error
   PACKET_TYPE_CMD = 0x03, // Command
   PACKET_TYPE_CTR = 0x04, // Control sequence (e.g. for commands)
-  PACKET_TYPE_DAT = 0x05  // Data
+  PACKET_TYPE_DAT = 0x05, // Data
+  PACKET_TYPE_BLK = 0x06  // Bulk data, always followed by another packet
 } packet_type_t;
 
 // Packet type definition
 typedef struct _packet_s {
   uint8_t header[PACKET_HEADER_SIZE];
-    //unsigned type      : 4;
+    //unsigned type      : 4;  // MSB is PACKET_CRC_WIDE
     //unsigned id        : 4;
     //unsigned size      : 7;
     //unsigned header_par: 1; // Even parity bit for the header
-  uint8_t data[PACKET_DATA_MAX_SIZE + sizeof(crc_t)];  // Data + trailing CRC
+  uint8_t data[PACKET_JUMBO_DATA_MAX_SIZE + sizeof(crc_wide_t)]; // Data + CRC
 } packet_t;
 
 
 // Craft a packet (which is preallocated as 'dest')
 // Note that the passed data is sent 'as is', without caring about endianess
+// 'type' can be or'ed with PACKET_CRC_WIDE
 // Returns 0 if the passed parameters are consistent, or 1 otherwise
 uint8_t packet_craft(uint8_t id, packet_type_t type, const uint8_t *data,
     uint8_t data_size, packet_t *dest);
 
+// Same as 'packet_craft', but the first 'data_size' bytes of 'p->data' are
+// used as they are, so that a packet can be built in place
+// Returns 0 if the passed parameters are consistent, or 1 otherwise
+uint8_t packet_seal(packet_t *p, uint8_t id, packet_type_t type,
+    uint8_t data_size);
+
 // Compute the next or previous packet ID
 #define packet_next_id(id) (((id) + 1) % PACKET_ID_MAX_VAL)
 #define packet_prev_id(id) (((id) + PACKET_ID_MAX_VAL - 1) % PACKET_ID_MAX_VAL)
 
+// Compute how many packets precede the one with ID 'to', starting from the
+// one with ID 'from' (e.g. 0 if they are the same)
+#define packet_id_distance(from,to) \
+  (((to) + PACKET_ID_MAX_VAL - (from)) % PACKET_ID_MAX_VAL)
+
 // Check the packet header via parity bit
 // Returns 0 if the header is sane, 1 if it is corrupted
 uint8_t packet_check_header(const packet_t*);
@@ -59,6 +113,12 @@ uint8_t packet_header_parity(const packet_t*);
 // Returns 0 if the packet is sane, 1 if it is corrupted
 uint8_t packet_check_crc(const packet_t*);
 
+// Correct a single flipped bit (header included) in a packet protected by the
+// wide CRC, given the number of bytes actually received (as the size field
+// itself could be the corrupted one)
+// Returns 0 if the packet is sane, 1 if it could not be corrected
+uint8_t packet_correct(packet_t*, uint8_t size);
+
 // Acknowledge a packet, passing the packet itself or its id
 // Returns 0 on success, 1 otherwise
 uint8_t packet_ack(const packet_t*, packet_t *dest);
@@ -78,6 +138,12 @@ uint8_t packet_get_type(const packet_t*);
 uint8_t packet_get_size(const packet_t*);
 uint8_t packet_get_id(const packet_t*);
 
+// Is the packet protected by the wide CRC?  Returns PACKET_CRC_WIDE if so
+uint8_t packet_crc_wide(const packet_t*);
+
+// Get the size of the trailing CRC of a packet
+uint8_t packet_crc_size(const packet_t*);
+
 // Compute the data size of a packet
 uint8_t packet_data_size(const packet_t*);
 
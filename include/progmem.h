@@ -0,0 +1,24 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Program memory access layer - Head file
+// Constant tables shared by the AVR and the host are declared with PROGMEM and
+// read with the 'pgm_read_*' accessors: on the AVR they live in flash, sparing
+// the SRAM, while on the host (and in the test units) they are plain memory
+#ifndef __PROGMEM_MODULE_H
+#define __PROGMEM_MODULE_H
+#include <stdint.h>
+
+#if defined(AVR) && !defined(TEST)
+#include <avr/pgmspace.h>
+
+#else  // Host
+#include <string.h>
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr)  (*(const uint8_t*)  (addr))
+#define pgm_read_word(addr)  (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t*) (addr))
+#define pgm_read_ptr(addr)   (*(void* const*)    (addr))
+#define memcpy_P(dest, src, size) memcpy(dest, src, size)
+#endif  // AVR/Host
+
+#endif  // __PROGMEM_MODULE_H
@@ -12,25 +12,35 @@ typedef uint16_t temperature_id_t;
 // data type could be changed in any moment to store additional informations
 typedef uint16_t temperature_t;
 
+// Resolution of a raw temperature, i.e. an LM35 reading (10mV/C) against the
+// 2.56V ADC reference, oversampled from 10 to TEMPERATURE_RAW_BITS bits
+#define TEMPERATURE_RAW_BITS 12
+
+// Max number of channels (i.e. sensors) sampled together into a DB
+#define TEMPERATURE_CHANNELS_MAX 8
+
 
 // To safely share databases metadata, a data structure with a fixed, machine
 // and compiler independent size is used. Do not try to access it directly in
 // any way.
 #define SIZEOF_TEMPERATURE_DB_INFO\
-  (sizeof(temperature_id_t) + sizeof(uint8_t) + 2*sizeof(uint16_t))
+  (sizeof(temperature_id_t) + 2*sizeof(uint8_t) + 2*sizeof(uint16_t))
 typedef uint8_t temperature_db_info_t[SIZEOF_TEMPERATURE_DB_INFO];
 
 // Pack a data stucture of fixed, machine-independent size containing info on
 // a temperature database
+// 'count' is the number of temperatures of all the 'channels' together
 // Returns 0 on success, 1 if 'dest' is not valid
 uint8_t temperature_db_info_pack(temperature_db_info_t dest, uint8_t id,
-    temperature_id_t count, uint16_t reg_resolution, uint16_t reg_interval);
+    temperature_id_t count, uint16_t reg_resolution, uint16_t reg_interval,
+    uint8_t channels);
 
 // Extract data from a packet database info structure
 // Returns 0 on success, 1 if 'src' is not valid
 // NULL pointers will be accepted and ignored (and won't cause any error)
 uint8_t temperature_db_info_extract(const temperature_db_info_t src, uint8_t *id,
-    temperature_id_t *count, uint16_t *reg_resolution, uint16_t *reg_interval);
+    temperature_id_t *count, uint16_t *reg_resolution, uint16_t *reg_interval,
+    uint8_t *channels);
 
 
 // Import AVR/Host side specific interface
@@ -1,58 +1,103 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// CRC lookup tables generator
+// Prints the head file holding every lookup table used by the CRC module,
+// computed from the parameters in 'include/crc.h' (i.e. 'make crc-tables')
+// Wide CRC tables come in 8 slices for the host, the k-th slice holding the
+// CRC of each byte followed by k zero bytes; the AVR uses only the first one
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <stdint.h>
 
 #include "../include/crc.h"
 
-#define ONE_BYTE_STR_MAX_SPACE 6
+#define SLICES 8
+#define LINE_MAX_LEN 80
 #define TAB "  "
 
-static inline size_t print_byte(unsigned char byte, int space, int comma) {
-  char fmt[16];
-  unsigned char i = 0;
 
-  if (space) fmt[i++] = ' ';
+// Compute the CRC-8 lookup table (most significant bit first)
+static void crc8_table(uint8_t table[256]) {
+  for (unsigned i=0; i < 256; ++i) {
+    uint8_t crc = i;
+    for (uint8_t k=0; k < 8; ++k)
+      crc = (crc & 0x80) ? (crc << 1) ^ CRC_POLY : crc << 1;
+    table[i] = crc;
+  }
+}
 
-  const char *fmt_byte = byte & 0xF0 ? "0x%2hhx" : "0x0%1hhx";
-  unsigned char fmt_byte_len = strlen(fmt_byte);
-  memcpy(fmt + i, fmt_byte, fmt_byte_len);
-  i += fmt_byte_len;
+// Compute the slices of a reflected CRC lookup table
+static void crc_reflected_table(uint32_t table[SLICES][256], uint32_t poly) {
+  for (unsigned i=0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (uint8_t k=0; k < 8; ++k)
+      crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+    table[0][i] = crc;
+  }
+  for (unsigned s=1; s < SLICES; ++s)
+    for (unsigned i=0; i < 256; ++i)
+      table[s][i] = (table[s-1][i] >> 8) ^ table[0][table[s-1][i] & 0xFF];
+}
 
-  if (comma) fmt[i++] = ',';
-  fmt[i] = '\0';
 
-  return printf(fmt, byte);
+// Print the 256 entries of a table, 'digits' hex digits each
+static void print_entries(const uint32_t *entries, unsigned digits,
+    const char *indent) {
+  const unsigned entry_len = digits + 4;  // "0x", the digits, ", "
+  unsigned line = 0;
+  for (unsigned i=0; i < 256; ++i) {
+    if (line + entry_len > LINE_MAX_LEN) {
+      putchar('\n');
+      line = 0;
+    }
+    if (!line) line += printf("%s", indent);
+    else line += printf(" ");
+    line += printf("0x%0*X%s", digits, entries[i], i == 255 ? "" : ",");
+  }
+  putchar('\n');
 }
 
-static inline size_t byte_str_space(unsigned char byte, int space, int comma) {
-  return (space ? 1 : 0) + (comma ? 1 : 0) + 4;
+// Print a sliced table of a wide CRC, compiled in only when it is in use
+static void print_sliced(const char *name, const char *type, unsigned width,
+    uint32_t poly) {
+  static uint32_t table[SLICES][256];
+  crc_reflected_table(table, poly);
+
+  printf("\n#if CRC_WIDE == %u\n", width);
+  printf("static const %s %s[CRC_TABLE_SLICES][256] CRC_TABLE_ATTR = {\n",
+      type, name);
+  for (unsigned s=0; s < SLICES; ++s) {
+    if (s == 1) printf("#if CRC_TABLE_SLICES == %u\n", SLICES);
+    printf(TAB "{\n");
+    print_entries(table[s], width / 4, TAB TAB);
+    printf(TAB "},\n");
+  }
+  printf("#endif\n};\n#endif\n");
 }
 
 
 int main(int argc, const char *argv[]) {
-  if (argc != 2) {
-    printf("Usage: %s <table-name>\n", argv[0]);
-    return 1;
-  }
+  printf("// AVR Temperature Monitor -- Paolo Lucchesi\n"
+      "// CRC lookup tables - Head file\n"
+      "// Generated by resources/crc_table_generator.c, do not edit\n"
+      "// Include only from the CRC module, after defining CRC_TABLE_ATTR "
+      "and\n// CRC_TABLE_SLICES (either 1 or %u)\n"
+      "#ifndef __CRC_TABLES_H\n#define __CRC_TABLES_H\n"
+      "#include <stdint.h>\n#include \"crc.h\"\n", SLICES);
 
-  // Compute CRC for each byte of data
-  static unsigned char crc_table[0x0100];
-  for (unsigned short i=0; i <= 0xFF; ++i) {
-    unsigned char byte = (unsigned char) i;
-    crc_table[i] = crc(&byte, 1);
-  }
+  uint8_t table8[256];
+  uint32_t entries[256];
+  crc8_table(table8);
+  for (unsigned i=0; i < 256; ++i)
+    entries[i] = table8[i];
+  printf("\n// %s, polynomial 0x%02X\n", CRC_NAME, CRC_POLY);
+  printf("static const uint8_t crc8_table[256] CRC_TABLE_ATTR = {\n");
+  print_entries(entries, 2, TAB);
+  printf("};\n");
 
-  // Print the table C-friendly
-  printf("\nstatic const uint8_t %s[] = {\n", argv[1]);
-  for (unsigned short i=0; i <= 0xFF; ) {
-    unsigned char line = 0;
-    line += printf("%s", TAB);
-    line += print_byte(crc_table[i++], 0, (i == 0xFF) ? 0 : 1);
-    while (i <= 0xFF && line < 80 - byte_str_space(crc_table[i], 1, (i == 0xFF) ? 0 : 1))
-      line += print_byte(crc_table[i++], 1, (i == 0xFF) ? 0 : 1);
-    if (i <= 0xFF) putchar('\n');
-  }
+  printf("\n// %s, reflected polynomial 0x%04X", CRC16_NAME, CRC16_POLY);
+  print_sliced("crc16_table", "uint16_t", 16, CRC16_POLY);
+  printf("\n// %s, reflected polynomial 0x%08lX", CRC32C_NAME, CRC32C_POLY);
+  print_sliced("crc32c_table", "uint32_t", 32, CRC32C_POLY);
 
-  printf("\n};\n\n");
+  printf("\n#endif  // __CRC_TABLES_H\n");
   return 0;
 }
@@ -17,14 +17,19 @@ else
 endif
 
 
+# Let GCC vectorize the aggregation kernels also at -O2
+VECTFLAGS := -fvect-cost-model=dynamic
+$(OBJDIR)/aggregate.o: CFLAGS += $(VECTFLAGS)
+
+
 TARGET := target/host/avrtmon
 $(TARGET): $(OBJECTS)
 	$(CC) $(CFLAGS) -o $@ $^
 
 
-resources/bin/crc-table-generator: \
-  resources/crc-table-generator.c $(OBJDIR)/crc.o
-	$(CC) -O2 -I$(INCDIR) -o $@ $^
+resources/bin/crc-table-generator: resources/crc_table_generator.c \
+  $(INCDIR)/crc.h
+	$(CC) -O2 -I$(INCDIR) -o $@ $<
 
 
 # Host-side testing canned recipe
@@ -49,5 +54,13 @@ host-test-serial: $(OBJDIR)/ringbuffer.o $(OBJDIR)/serial.o
 host-test-ringbuffer: $(OBJDIR)/ringbuffer.o
 	$(call host_test)
 
+host-test-temperature:
+	$(call host_test, $(SRCDIR)/host/temperature_specific.c)
+
+host-test-aggregate: CFLAGS += $(VECTFLAGS)
+host-test-aggregate:
+	$(call host_test, $(SRCDIR)/host/temperature_specific.c \
+	  $(SRCDIR)/host/aggregate.c -lm)
+
 
 .PHONY: install-host install-docs host-test-%
@@ -2,6 +2,7 @@
 // Buttons Handler - Source file
 #include <avr/interrupt.h>
 #include "buttons.h"
+#include "scheduler.h"
 
 #define OCR_ONE_MSEC 15.625
 
@@ -66,7 +67,10 @@ ISR(TIMER4_COMPA_vect) {
     else int0_sei();
   }
 
-  if (!debouncing) tim4_cli(); // All debounced
+  if (!debouncing) { // All debounced
+    tim4_cli();
+    scheduler_post(EV_BUTTON);
+  }
 }
 
 
@@ -103,23 +107,17 @@ void button_init(uint8_t debounce_tm) {
 }
 
 
-// The buttons handler itself
-// Returns 0 if no significant action was performed, non-zero otherwise
+// The buttons handler itself, run on the EV_BUTTON event
+// Always returns 0
 uint8_t button_handler(void) {
-  uint8_t ret = 0;
-
   for (uint8_t btn=0; btn < BUTTON_COUNT; ++btn) {
-    if (buttons[btn].enabled && buttons[btn].action) {
-      if (buttons[btn].status == BTN_STAT_PRESSING)
-        ret = 1;
-      else if (buttons[btn].status == BTN_STAT_PRESSED) {
-        buttons[btn].action(buttons[btn].status);
-        buttons[btn].status = BTN_STAT_OPEN;
-      }
+    if (buttons[btn].enabled && buttons[btn].action &&
+        buttons[btn].status == BTN_STAT_PRESSED) {
+      buttons[btn].action(buttons[btn].status);
+      buttons[btn].status = BTN_STAT_OPEN;
     }
   }
-
-  return ret;
+  return 0;
 }
 
 
@@ -5,57 +5,63 @@
 #include "communication.h"
 
 
+// Imported commands
+extern const command_t cmd_config_get_field;
+extern const command_t cmd_config_set_field;
+extern const command_t cmd_temperatures_download;
+extern const command_t cmd_temperatures_reset;
+extern const command_t cmd_set_resolution;
+extern const command_t cmd_set_interval;
+extern const command_t cmd_start;
+extern const command_t cmd_stop;
+extern const command_t cmd_echo;
+
 // Commands table -- Each command is identified by a pointer to its data struct
-static command_t *cmd_table[COMMAND_COUNT];
+// Both the table and the commands live in the program memory
+static const command_t * const cmd_table[COMMAND_COUNT] PROGMEM = {
+  [CMD_CONFIG_GET_FIELD]      = &cmd_config_get_field,
+  [CMD_CONFIG_SET_FIELD]      = &cmd_config_set_field,
+  [CMD_TEMPERATURES_DOWNLOAD] = &cmd_temperatures_download,
+  [CMD_TEMPERATURES_RESET]    = &cmd_temperatures_reset,
+  [CMD_SET_RESOLUTION]        = &cmd_set_resolution,
+  [CMD_SET_INTERVAL]          = &cmd_set_interval,
+  [CMD_START]                 = &cmd_start,
+  [CMD_STOP]                  = &cmd_stop,
+  [CMD_ECHO]                  = &cmd_echo
+};
 
-// Imported commands
-extern command_t *cmd_config_get_field;
-extern command_t *cmd_config_set_field;
-extern command_t *cmd_temperatures_download;
-extern command_t *cmd_temperatures_reset;
-extern command_t *cmd_set_resolution;
-extern command_t *cmd_set_interval;
-extern command_t *cmd_start;
-extern command_t *cmd_stop;
-extern command_t *cmd_echo;
+// [AUX] Fetch a command from the program memory
+static inline void _cmd_fetch(command_id_t id, command_t *dest) {
+  memcpy_P(dest, pgm_read_ptr(cmd_table + id), sizeof(command_t));
+}
 
 
 // Execute the start routine of a command, given its ID and an optional argument
 // Returns a 'command_retval_t' code
 uint8_t command_start(command_id_t id, const void *arg) {
   if (id >= COMMAND_COUNT) return CMD_RET_NOT_EXISTS;
-  uint8_t has_opmode  = cmd_table[id]->opmode  != NULL ? 1 : 0;
-  uint8_t has_iterate = cmd_table[id]->iterate != NULL ? 1 : 0;
+  command_t cmd;
+  _cmd_fetch(id, &cmd);
+  uint8_t has_opmode  = cmd.opmode  != NULL ? 1 : 0;
+  uint8_t has_iterate = cmd.iterate != NULL ? 1 : 0;
 
-  if (has_opmode) communication_opmode_switch(cmd_table[id]->opmode);
+  if (has_opmode) communication_opmode_switch(cmd.opmode);
 
   // A command with no 'start', 'iterate' and 'opmode' should not be created,
   // nevertheless, better safe than sorry...
-  if (!cmd_table[id]->start)
+  if (!cmd.start)
     return (has_opmode || has_iterate) ? CMD_RET_ONGOING : CMD_RET_FINISHED;
 
-  return cmd_table[id]->start(arg);
+  return cmd.start(arg);
 }
 
 
 // Execute the routine of a command, given its ID and an optional argument
 uint8_t command_iterate(command_id_t id, const void *arg) {
 // Returns a 'command_retval_t' code
-  if (id >= COMMAND_COUNT)     return CMD_RET_NOT_EXISTS;
-  if (!cmd_table[id]->iterate) return CMD_RET_NOT_IMPLEMENTED;
-  return cmd_table[id]->iterate(arg);
-}
-
-
-// Initialize the command table
-void command_init(void) {
-  cmd_table[CMD_CONFIG_GET_FIELD]      = cmd_config_get_field;
-  cmd_table[CMD_CONFIG_SET_FIELD]      = cmd_config_set_field;
-  cmd_table[CMD_TEMPERATURES_DOWNLOAD] = cmd_temperatures_download;
-  cmd_table[CMD_TEMPERATURES_RESET]    = cmd_temperatures_reset;
-  cmd_table[CMD_SET_RESOLUTION]        = cmd_set_resolution;
-  cmd_table[CMD_SET_INTERVAL]          = cmd_set_interval;
-  cmd_table[CMD_START]                 = cmd_start;
-  cmd_table[CMD_STOP]                  = cmd_stop;
-  cmd_table[CMD_ECHO]                  = cmd_echo;
+  if (id >= COMMAND_COUNT) return CMD_RET_NOT_EXISTS;
+  command_t cmd;
+  _cmd_fetch(id, &cmd);
+  if (!cmd.iterate) return CMD_RET_NOT_IMPLEMENTED;
+  return cmd.iterate(arg);
 }
@@ -11,22 +11,19 @@
 // Command starter
 static uint8_t _start(const void *arg) {
   config_field_t field = *((config_field_t*) arg);
-  uint8_t field_size = config_get_size(field);
-  uint8_t val[field_size];  // Field value will be stored here
+  uint8_t *val = communication_reserve();  // Field value will be stored here
 
   // Send the field value, or an empty CTR packet if the field does not exist
-  if (config_get(field, val) != 0)  
-    communication_craft_and_send(PACKET_TYPE_CTR, NULL, 0);
+  if (config_get(field, val) != 0)
+    communication_commit(PACKET_TYPE_CTR, 0);
   else
-    communication_craft_and_send(PACKET_TYPE_DAT, val, field_size);
+    communication_commit(PACKET_TYPE_DAT, config_get_size(field));
 
   return CMD_RET_FINISHED;
 }
 
-static command_t _cmd = {
+const command_t COMMAND_NAME PROGMEM = {
   .start   = _start,
   .iterate = NULL,
   .opmode  = NULL
 };
-
-command_t *COMMAND_NAME = &_cmd;
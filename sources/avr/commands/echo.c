@@ -17,10 +17,8 @@ static uint8_t _start(const void *arg) {
   return CMD_RET_FINISHED;
 }
 
-static command_t _cmd = {
+const command_t COMMAND_NAME PROGMEM = {
   .start   = _start,
   .iterate = NULL,
   .opmode  = NULL
 };
-
-command_t *COMMAND_NAME = &_cmd;
@@ -5,9 +5,13 @@
 // 2] [AVR]  If next (or first) DB is not empty:
 //             <CTR> send DB info
 // 3] [AVR]  While there are temperatures in the current DB:
-//             <DAT> Send temperatures in data bursts (i.e. in bulk)
+//             <BLK> Send temperatures in data bursts (i.e. in bulk), with a
+//             cumulative ACK for each window of them
 // 4] [AVR]  If there is another DB, goto [2]
 // 5] [AVR]  <CTR> Piggyback CTR packet with no carried data means end of comm.
+// While a packet is in flight, the next burst is read from the NVM straight
+// into the next TX frame, so that it is ready to be sent as soon as the window
+// of the packets in flight allows it
 #include <stddef.h>  // NULL
 #include "command.h"
 #include "temperature.h"
@@ -15,33 +19,51 @@
 #include "packet.h" // Just packet types
 
 #define COMMAND_NAME cmd_temperatures_download
-#define TEMP_BURST (PACKET_DATA_MAX_SIZE / sizeof(temperature_t))
+#define TEMP_BURST (communication_data_max_size() / sizeof(temperature_t))
 #define MIN(x,y) ((x) > (y) ? (y) : (x))
 
-// Common, side-independent data structure to share DB informations
-static temperature_db_info_t db_info;
-
 // Keep track of the download state across different received packets
+// 'temp_idx' is the ID of the first temperature which was not sent yet
 static uint8_t temp_db_id;
 static temperature_id_t temp_idx = 0, temp_count;
-static temperature_t temp_buf[TEMP_BURST];
+
+// Next burst, read in the reserved TX frame
+static temperature_id_t prefetch_count;   // Temperatures in the next burst
+static uint8_t prefetch_ready;
+
+
+// Read the next burst of the current DB, if not done yet
+static void _prefetch(void) {
+  if (prefetch_ready || temp_idx == temp_count) return;
+  prefetch_count = temperature_get_bulk(temp_db_id, temp_idx,
+      MIN(temp_count - temp_idx, TEMP_BURST),
+      (temperature_t*) communication_reserve());
+  prefetch_ready = 1;
+}
 
 
 // Change DB currently in use
 // Returns 0 on success, 1 if the DB does not exist
 static uint8_t _change_current_db(uint8_t db_id) {
+  // Common, side-independent data structure to share DB informations, built
+  // directly in the packet to send
+  uint8_t *db_info = communication_reserve();
+
   for (uint8_t loading_db = 1; loading_db; ) { // Skip empty DBs
     if (temperature_db_info(db_id++, db_info) != 0) {
-      communication_craft_and_send(PACKET_TYPE_CTR, NULL, 0);
+      communication_commit(PACKET_TYPE_CTR, 0);
       return 1;
     }
-    temperature_db_info_extract(db_info, &temp_db_id, &temp_count, NULL, NULL);
+    temperature_db_info_extract(db_info, &temp_db_id, &temp_count, NULL, NULL,
+        NULL);
     if (temp_count != 0) loading_db = 0;
   }
 
-  // Next non-empty DB successfully loaded
+  // Next non-empty DB successfully loaded. Its first burst is read while its
+  // info is in flight
   temp_idx = 0;
-  communication_craft_and_send(PACKET_TYPE_CTR, db_info, SIZEOF_TEMPERATURE_DB_INFO);
+  prefetch_ready = 0;
+  communication_commit(PACKET_TYPE_CTR, SIZEOF_TEMPERATURE_DB_INFO);
   return 0;
 }
 
@@ -49,30 +71,36 @@ static uint8_t _change_current_db(uint8_t db_id) {
 // Single command iteration of the temperature uploader
 static uint8_t _iterate(const void *arg) {
   if (temp_idx == temp_count) {
-    if (_change_current_db(temp_db_id + 1) != 0)
+    if (_change_current_db(temp_db_id + 1) != 0) {
+      communication_background_set(NULL);
       return CMD_RET_FINISHED;
+    }
     else return CMD_RET_ONGOING;
   }
 
-  temperature_id_t to_get = MIN(temp_count-temp_idx, TEMP_BURST);
-  temperature_get_bulk(temp_db_id, temp_idx, to_get, temp_buf);
-  communication_craft_and_send(PACKET_TYPE_DAT,
-      (void*) temp_buf, to_get * sizeof(temperature_t));
-  temp_idx += to_get;
+  // Send the prefetched burst, while the next one is read in the next frame
+  // A BLK packet is always followed by the next burst, or by a CTR one
+  _prefetch();  // Usually done already, while the last packet was in flight
+  prefetch_ready = 0;
+  temp_idx += prefetch_count;
+  communication_commit(PACKET_TYPE_BLK, prefetch_count * sizeof(temperature_t));
   return CMD_RET_ONGOING;
 }
 
 
 // Command starter
 static uint8_t _start(const void *arg) {
-  return (_change_current_db(0) != 0) ? CMD_RET_FINISHED : CMD_RET_ONGOING;
+  communication_background_set(_prefetch);
+  if (_change_current_db(0) != 0) {
+    communication_background_set(NULL);
+    return CMD_RET_FINISHED;
+  }
+  return CMD_RET_ONGOING;
 }
 
 
-static command_t _cmd = {
+const command_t COMMAND_NAME PROGMEM = {
   .start   = _start,
   .iterate = _iterate,
   .opmode  = NULL
 };
-
-command_t *COMMAND_NAME = &_cmd;
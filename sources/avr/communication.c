@@ -4,14 +4,26 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <stddef.h>
-#include "sleep_util.h"
+#include "scheduler.h"
 
 #include "communication.h"
 #include "command.h"
 #include "packet.h"
+#include "crc.h"
+#include "framing.h"
 #include "serial.h"
 #include "led.h"
 
+// TX frames are filled in place with whole packets, framed in place as well
+#if (1 << PACKET_SIZE_WIDTH_BIT) - 1 + FRAMING_OVERHEAD > TX_BUFFER_SIZE
+#error "TX_BUFFER_SIZE must hold a whole (jumbo) frame"
+#endif
+
+// Each packet in flight is kept in its TX frame, besides the one being filled
+#if TX_FRAMES <= PACKET_ACK_WINDOW
+#error "TX_FRAMES must be greater than PACKET_ACK_WINDOW"
+#endif
+
 #define COMMAND_NONE COMMAND_COUNT
 
 
@@ -19,6 +31,20 @@
 // The variable name is long on purpose (global variable)
 static uint8_t packet_global_id;
 
+// CRC of the packets sent, i.e. PACKET_CRC_WIDE if the last handshake was
+// protected by the wide CRC, 0 for CRC-8
+static uint8_t packet_crc_flag;
+
+// Packets sent and not acknowledged yet, i.e. the ones preceding the one with
+// ID 'packet_global_id'. They are kept in their TX frames to be sent again
+static uint8_t tx_inflight;
+
+// ACK or ERR of the last received packet. An ACK rides on the next packet
+// sent, whose ID follows the acknowledged one, or it is sent on its own when
+// the received packet has been handled with no reply
+static packet_t rx_response[1];
+static uint8_t ack_pending;
+
 
 // RTO variables
 static const uint16_t rto = 150; // RTO in milliseconds
@@ -47,16 +73,113 @@ ISR(TIMER3_COMPA_vect) {
 }
 
 
+// RX frame assembly, performed byte by byte by the serial RX ISR
+// When a frame is over (or a definite error occurs) 'rx_status' is set and the
+// frame is left untouched until released, dropping the following bytes
+#define RX_PENDING 0xFF  // Frame not over yet
+#define RX_DISCARD 0xFE  // Frame being released
+static packet_t rx_frame[1];
+static volatile uint8_t rx_status = RX_DISCARD;  // 'err_code_t' when done
+static volatile uint8_t rx_received;
+static uint8_t rx_size, rx_wide;
+static uint8_t rx_header_bad;  // Corrupted header, still to be corrected
+static crc_wide_t rx_crc;
+#if COBS_FRAMING
+static framing_decoder_t rx_decoder;
+static uint8_t rx_skip;  // Skip bytes until the next delimiter
+#endif
+
+// [AUX] Check a frame which is over
+static inline uint8_t _rx_frame_status(void) {
+  if (rx_received < PACKET_HEADER_SIZE || rx_header_bad)
+    return E_CORRUPTED_HEADER;
+  if (rx_received != rx_size) return E_CORRUPTED_CHECKSUM;
+  return (rx_crc != (rx_wide ? CRC_WIDE_RESIDUE : CRC_RESIDUE)) ?
+    E_CORRUPTED_CHECKSUM : E_SUCCESS;
+}
+
+// [AUX] RX frame state machine, fed with each received byte (ISR context)
+// The header is checked as soon as it is complete, and the CRC is computed on
+// the fly so that nothing is left to do when the last byte comes. The first
+// byte tells which CRC protects the frame
+// With COBS framing, a frame is over at its delimiter, and the bytes of a
+// frame which cannot be received (e.g. corrupted, or coming while the previous
+// one is not released yet) are skipped up to the next delimiter
+static void _rx_frame_byte(uint8_t c) {
+#if COBS_FRAMING
+  if (c == FRAMING_DELIMITER) {
+    if (!rx_skip && rx_status == RX_PENDING && rx_received)
+      rx_status = _rx_frame_status();
+    rx_skip = 0;
+    framing_decoder_reset(&rx_decoder);
+    return;
+  }
+  if (rx_skip) return;
+  if (rx_status != RX_PENDING) {
+    rx_skip = 1;
+    return;
+  }
+  const int16_t decoded = framing_decode(&rx_decoder, c);
+  if (decoded == FRAMING_NONE) return;
+  if (rx_received == sizeof(packet_t)) {  // Too long, i.e. delimiter lost
+    rx_status = E_CORRUPTED_CHECKSUM;
+    rx_skip = 1;
+    return;
+  }
+  c = decoded;
+
+#else
+  if (rx_status != RX_PENDING) return;  // Previous frame not released yet
+#endif
+
+  ((uint8_t*) rx_frame)[rx_received++] = c;
+  if (rx_received == 1) {  // Frame incoming
+    rx_wide = packet_crc_wide(rx_frame);
+    rx_crc = rx_wide ? CRC_WIDE_INIT : CRC_INIT;
+    scheduler_post(EV_COMMUNICATION);
+  }
+  rx_crc = rx_wide ? crc_wide_update(rx_crc, c) : crc_update(rx_crc, c);
+
+  // With FEC, a corrupted header is corrected along with the rest of the
+  // frame, which is received anyway if its size is plausible
+  if (rx_received == PACKET_HEADER_SIZE) {
+    rx_size = packet_get_size(rx_frame);
+    rx_header_bad = packet_check_header(rx_frame) != 0;
+    if (rx_header_bad && (!PACKET_FEC || rx_size < PACKET_MIN_SIZE)) {
+      rx_status = E_CORRUPTED_HEADER;
+#if COBS_FRAMING
+      rx_skip = 1;  // The rest of the frame must not look like a new one
+#endif
+    }
+  }
+#if !COBS_FRAMING
+  else if (rx_received > PACKET_HEADER_SIZE && rx_received == rx_size)
+    rx_status = _rx_frame_status();
+#endif
+}
+
+// [AUX] Release the RX frame, discarding any partially received one
+static inline void rx_frame_reset(void) {
+  rx_status = RX_DISCARD;  // The ISR drops any byte meanwhile
+  rx_received = 0;
+  rx_status = RX_PENDING;
+}
+
+
 // Communication Opmode variables
-static com_operation_f opmode_default[];
+static const com_operation_f opmode_default[] PROGMEM;
 static com_opmode_t opmode = opmode_default;
 
 static command_id_t command_current = COMMAND_NONE; // Command currently in use
 static uint8_t command_notified = 0; // Handle command notifications
 
+// Task run while a sent packet is in flight
+static com_background_f background;
+
 // End the current command
 static inline void command_end(void) {
   command_current = COMMAND_NONE;
+  background = NULL;
   communication_opmode_restore();
 }
 
@@ -65,6 +188,9 @@ static inline void command_end(void) {
 void communication_init(void) {
   serial_init(); // Initialize serial port
 
+  rx_frame_reset();  // Assemble the received frames in the RX ISR
+  serial_rx_handler_set(_rx_frame_byte);
+
   // Initialize the RTO Timer
   TCCR3A = 0;
   TCCR3B = (1 << WGM52) | (1 << CS50) | (1 << CS52);
@@ -72,66 +198,95 @@ void communication_init(void) {
 
   // Initialize variables
   packet_global_id = 0;
+  packet_crc_flag = 0;
+  tx_inflight = 0;
+  ack_pending = 0;
   rto_elapsed = 0;
   rto_ongoing = 0;
 }
 
 
+// [AUX] Send the packet in the reserved TX frame, framing it in place
+// Returns 0 on success, 1 on failure
+static uint8_t _tx_commit(uint8_t size) {
+#if COBS_FRAMING
+  uint8_t *frame = serial_tx_reserve();
+  size = framing_encode(frame, frame, size);
+#endif
+  return serial_tx_commit(size);
+}
+
+// [AUX] Send a packet which is not in a TX frame, i.e. an ACK or ERR one
+// It takes a TX frame as well, so no packet must be in flight
+// Returns 0 on success, 1 on failure
+static uint8_t _tx_packet(const packet_t *p) {
+  const uint8_t size = packet_get_size(p);
+  uint8_t *frame = serial_tx_reserve();
+  for (uint8_t i=0; i < size; ++i)
+    frame[i] = ((const uint8_t*) p)[i];
+  return _tx_commit(size);
+}
+
+// [AUX] Send the deferred ACK, if the received packet got no reply
+static inline void _ack_flush(void) {
+  if (!ack_pending) return;
+  ack_pending = 0;
+  _tx_packet(rx_response);
+}
+
+
 // Single attempt to receive a packet
-// Return 0 on a successful attempt, 1 otherwise
-// TODO: Optimize to get all the available characters in a stroke
+// Return 0 on a successful attempt, an 'err_code_t' code otherwise
 static uint8_t _recv_attempt(packet_t *p) {
-  uint8_t *p_raw = (uint8_t*) p;
-
-  // Start Round-Trip Time timeout
   if (!rto_ongoing) return 1;
-  uint8_t type, id, size=0, received=0;
-
-  while (1) {
-    if (rto_elapsed) return E_TIMEOUT_ELAPSED;
-
-    if (serial_rx_getchar(p_raw + received)) { // New data to process
-      switch (++received) { // Received i-th byte
-
-        case 1:
-          // Early fail on mismatching ID
-          type = packet_get_type(p);
-          id = packet_get_id(p);
-          if ((type == PACKET_TYPE_HND && id != 0) && id != packet_global_id)
-            return E_ID_MISMATCH;
-          break;
-
-        case 2:
-          // Check packet header integrity
-          if (packet_check_header(p) != 0) return E_CORRUPTED_HEADER;
-          size = packet_get_size(p);
-          break;
-
-        default:
-          if (received >= size) // Last byte
-            return (packet_check_crc(p) != 0) ? E_CORRUPTED_CHECKSUM : E_SUCCESS;
-          break;
-      }
-    }
-  }
+
+  // Sleep until the RX ISR has a whole frame (or an error) or the RTO elapses,
+  // registering the temperatures which are due meanwhile
+  scheduler_wait(EV_COMMUNICATION, !rto_elapsed && rx_status == RX_PENDING);
+  if (rx_status == RX_PENDING) return E_TIMEOUT_ELAPSED;
+
+  *p = *rx_frame;
+  uint8_t ret = rx_status;
+  const uint8_t size = rx_received;
+  rx_frame_reset();
+
+  // Correct a single flipped bit, if possible, instead of asking for the
+  // packet again
+  if (PACKET_FEC && (ret == E_CORRUPTED_HEADER || ret ==
+        E_CORRUPTED_CHECKSUM) && packet_correct(p, size) == 0)
+    ret = E_SUCCESS;
+  if (ret != E_SUCCESS) return ret;
+
+  const uint8_t type = packet_get_type(p), id = packet_get_id(p);
+  if ((type == PACKET_TYPE_HND && id != 0) && id != packet_global_id)
+    return E_ID_MISMATCH;
+  return E_SUCCESS;
 }
 
 
 // Get an incoming packet if data is available on the serial port (blocking)
 // Returns 0 on success, 1 on failure
 uint8_t communication_recv(packet_t *p) {
-  static packet_t response[1];
-
   for (uint8_t attempt=0; attempt < MAXIMUM_RECV_ATTEMPTS; ++attempt) {
     rto_timer_start();
     uint8_t ret = _recv_attempt(p);
 
+    // A late ACK or ERR (e.g. a cumulative ACK sent again) is just dropped
+    if (ret == E_SUCCESS && !packet_brings_data(p) &&
+        packet_get_type(p) != PACKET_TYPE_HND) {
+      rto_timer_stop();
+      return 1;
+    }
+
     if (ret == E_SUCCESS) {
-      packet_ack(p, response);
-      serial_tx(response, PACKET_MIN_SIZE);
+      packet_ack(p, rx_response);
+      ack_pending = 1;
+      if (PACKET_ACK_WINDOW == 1) _ack_flush();
       rto_timer_stop();
-      if (packet_get_type(p) == PACKET_TYPE_HND)
+      if (packet_get_type(p) == PACKET_TYPE_HND) {
         packet_global_id = 1;
+        packet_crc_flag = packet_crc_wide(p);  // Agreed on by the host
+      }
       else packet_global_id = packet_next_id(packet_global_id);
       return 0;
     }
@@ -141,15 +296,15 @@ uint8_t communication_recv(packet_t *p) {
 
     // Single recv failure
     // Send ERR packet
-    packet_err(p, response);
-    serial_tx(response, PACKET_MIN_SIZE);
-
-    // Wait and discard data until RTO elapses
-    while (1) {
-      serial_rx_reset();
-      sleep_on(SLEEP_MODE_IDLE, !rto_elapsed);
-      if (rto_elapsed) break;
-    }
+    packet_err(p, rx_response);
+    _tx_packet(rx_response);
+
+    // Wait and discard data until RTO elapses, or just until the next frame
+    // if the frames are delimited
+#if !COBS_FRAMING
+    scheduler_wait(EV_COMMUNICATION, !rto_elapsed);
+#endif
+    rx_frame_reset();
   }
 
   packet_global_id = 0;
@@ -157,6 +312,87 @@ uint8_t communication_recv(packet_t *p) {
 }
 
 
+// [AUX] Handle an ACK or ERR received for the packets in flight: an ACK
+// acknowledges its packet and the previous ones, an ERR the previous ones only,
+// so that the packets are sent again from its own on
+// Returns 1 if the response is about a packet in flight, 0 otherwise
+static uint8_t _tx_acknowledge(const packet_t *response) {
+  const uint8_t type = packet_get_type(response);
+  const uint8_t is_ack = (type == PACKET_TYPE_ACK) ? 1 : 0;
+  const uint8_t sent = packet_id_distance(packet_get_id(response),
+      packet_global_id);  // From the packet of the response on
+  if ((!is_ack && type != PACKET_TYPE_ERR) || sent == 0 || sent > tx_inflight)
+    return 0;  // e.g. a duplicate ACK, or an ERR about no packet in flight
+  tx_inflight = sent - is_ack;
+  return 1;
+}
+
+
+// [AUX] Wait until at most 'left' packets are in flight, sending them again if
+// they are lost or corrupted
+// Returns 0 on success, 1 on too many consecutive failures
+static uint8_t _send_wait(uint8_t left) {
+  static packet_t response[1];
+
+  for (uint8_t attempt=0; tx_inflight > left; ) {
+    // Any packet different from an ACK one is taken as a failure
+    uint8_t ret = _recv_attempt(response);
+    if (ret == E_SUCCESS && packet_get_type(response) == PACKET_TYPE_ACK) {
+      if (_tx_acknowledge(response)) {  // Stale ACKs are just ignored
+        attempt = 0;
+        rto_timer_start();
+      }
+      continue;
+    }
+
+    if (++attempt == MAXIMUM_SEND_ATTEMPTS) {
+      packet_global_id = 0;
+      tx_inflight = 0;
+      return 1; // Too many consecutive failures
+    }
+    // Wait for the receiver to give up the frame, unless frames are delimited
+    // A whole RTO, as it could have refused a packet sent before the last one
+    if (ret != E_TIMEOUT_ELAPSED) {
+      if (ret == E_SUCCESS) _tx_acknowledge(response);  // ERR
+#if !COBS_FRAMING
+      rto_timer_start();
+      scheduler_wait(EV_COMMUNICATION, !rto_elapsed);
+#endif
+      rx_frame_reset();  // Discard what was received meanwhile
+    }
+
+    // The packets in flight are still in their TX frames
+    rto_timer_start();
+    serial_tx_resend(tx_inflight);
+  }
+
+  rto_timer_stop();
+  return 0;
+}
+
+
+// [AUX] Send the packet built in the serial TX buffer, waiting for its ACK
+// A BLK packet is always followed by another one, so it is acknowledged along
+// with the following ones, and its ACK is waited for only if the window is full
+// Returns 0 if the packet is sent correctly, 1 otherwise
+static uint8_t _send_reserved(uint8_t size) {
+  const uint8_t bulk = packet_get_type(serial_tx_reserve()) == PACKET_TYPE_BLK;
+  ack_pending = 0;  // Carried by this packet, whose ID follows the ACKed one
+
+  // Asynchronous send, overlapped with the background task
+  rto_timer_start();
+  _tx_commit(size);
+  packet_global_id = packet_next_id(packet_global_id);
+  ++tx_inflight;
+  if (background) background();
+
+  if (_send_wait(bulk ? PACKET_ACK_WINDOW - 1 : 0) != 0)
+    return 1;
+  command_notified = 1;
+  return 0;
+}
+
+
 // Send a packet (blocking)
 // Returns 0 if the packet is sent correctly, 1 otherwise
 uint8_t communication_send(const packet_t *p) {
@@ -164,68 +400,80 @@ uint8_t communication_send(const packet_t *p) {
   if (!p || !size || size > sizeof(packet_t))
     return 1;
 
-  for (uint8_t attempt=0; attempt < MAXIMUM_SEND_ATTEMPTS; ++attempt) {
-    rto_timer_start(); // Restart RTO timer for each attempt
+  uint8_t *dest = serial_tx_reserve();
+  for (uint8_t i=0; i < size; ++i)
+    dest[i] = ((const uint8_t*) p)[i];
+  return _send_reserved(size);
+}
 
-    // Blocking send
-    serial_tx(p, size);
-    while (serial_tx_ongoing()) ;
 
-    // Attempt to receive ACK/ERR
-    // Assertion on ACK/ERR id is made inside the receive attempt function
-    // If any packet different from an ACK one is received, take it as a failure
-    static packet_t response[1];
-    uint8_t ret = _recv_attempt(response);
+// Send an in-place crafted packet, crafting it directly in the TX buffer
+// Returns 0 if the packet is sent correctly, 1 otherwise
+uint8_t communication_craft_and_send(packet_type_t type, const uint8_t *data,
+    uint8_t data_size) {
+  packet_t *p = serial_tx_reserve();
+  if (packet_craft(packet_global_id, type | packet_crc_flag, data, data_size,
+        p) != 0)
+    return 1;
+  return _send_reserved(packet_get_size(p));
+}
 
-    if (ret == E_SUCCESS && packet_get_type(response) == PACKET_TYPE_ACK) {
-      rto_timer_stop();
-      packet_global_id = packet_next_id(packet_global_id);
-      command_notified = 1;
-      return 0;
-    }
-    else if (ret != E_TIMEOUT_ELAPSED)
-      sleep_while(SLEEP_MODE_IDLE, !rto_elapsed);
-  }
 
-  packet_global_id = 0;
-  return 1; // Too many consecutive failures
+// Get a pointer to the data of the packet to send, to fill it in place
+uint8_t *communication_reserve(void) {
+  return ((packet_t*) serial_tx_reserve())->data;
 }
 
+// Get the largest data size of a packet to send
+uint8_t communication_data_max_size(void) {
+  return packet_data_max_size(packet_crc_flag);
+}
 
-// Send an in-place crafted packet
+// Send the packet reserved with 'communication_reserve'
 // Returns 0 if the packet is sent correctly, 1 otherwise
-uint8_t communication_craft_and_send(packet_type_t type, const uint8_t *data,
-    uint8_t data_size) {
-  static packet_t p[1];
-  if (packet_craft(packet_global_id, type, data, data_size, p) != 0)
+uint8_t communication_commit(packet_type_t type, uint8_t data_size) {
+  packet_t *p = serial_tx_reserve();  // Same frame, with data filled in
+  if (packet_seal(p, packet_global_id, type | packet_crc_flag, data_size) != 0)
     return 1;
-  return communication_send(p);
+  return _send_reserved(packet_get_size(p));
 }
 
 
-// Transfer control flow to the communication layer
-// Returns 0 if no significant action was performed, non-zero otherwise
+// Set a task to run while each sent packet is in flight
+void communication_background_set(com_background_f task) {
+  background = task;
+}
+
+
+// Transfer control flow to the communication layer, i.e. the EV_COMMUNICATION
+// event handler. A single command iteration or incoming packet is handled
+// Returns non-zero if a command is waiting to be iterated, 0 otherwise
 uint8_t communication_handler(void) {
-  uint8_t ret = 0;
   if (command_notified) {
     command_notified = 0;
     if (command_iterate(command_current, NULL) != CMD_RET_ONGOING)
       command_end();
-    ret = 1;
+    return command_notified;
   }
 
-  if (!serial_rx_available()) return ret;
+  if (rx_status == RX_PENDING && !rx_received) return 0;  // Nothing incoming
 
   // If data is available, attempt to receive a new packet
   static packet_t p[1];
-  if (communication_recv(p) != 0) return 1;
+  if (communication_recv(p) != 0) return 0;
 
-  // The incoming packet have been received correctly
+  // The incoming packet have been received correctly. Its ACK rides on the
+  // reply, if the action sends any
   const uint8_t type = packet_get_type(p);
-  com_operation_f action = opmode[type] ? opmode[type] : opmode_default[type];
+  com_operation_f action = NULL;
+  if (type < PACKET_TYPE_COUNT) {
+    action = pgm_read_ptr(opmode + type);
+    if (!action) action = pgm_read_ptr(opmode_default + type);
+  }
   if (action && action(p) != CMD_RET_ONGOING)
     communication_opmode_restore();
-  return 1;
+  _ack_flush();
+  return command_notified;
 }
 
 
@@ -259,6 +507,6 @@ static uint8_t _op_cmd(const packet_t *rx_pack) {
 }
 
 // The opmode itself
-static com_operation_f opmode_default[] = {
-  _op_hnd, NULL, NULL, _op_cmd, NULL, NULL
+static const com_operation_f opmode_default[] PROGMEM = {
+  _op_hnd, NULL, NULL, _op_cmd, NULL, NULL, NULL
 };
@@ -1,53 +1,97 @@
 // AVR Temperature Monitor -- Paolo Lucchesi
 // LM Sensor layer - Source file
+// The ADC runs free, and its ISR accumulates the conversions of each channel
+// in turn; the CPU sleeps in between. Idle sleep mode is used rather than ADC
+// noise reduction, which would stop the timers and the USART for the whole scan
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
 #include "sleep_util.h"
 #include "lmsensor.h"
 
-// Set/Clear ADC interrupt flag
-#define lm_sei() do { ADCSRA |=  (1 << ADIE); } while (0)
-#define lm_cli() do { ADCSRA &= ~(1 << ADIE); } while (0)
+#if LM_SAMPLES * 1023UL > UINT16_MAX
+#error "Too many oversampling bits for a 16-bit accumulator"
+#endif
 
-volatile uint16_t adc_result;
-volatile uint8_t  adc_ongoing;
+// REFS1 -> Internal 2.56V Reference (no external AREF)
+#define ADMUX_PIN(pin) ((1 << REFS1) | ((pin) & 0x07))
+
+// Pins of the channels, in scan order
+static uint8_t lm_pins[TEMPERATURE_CHANNELS_MAX];
+static uint8_t lm_count;
+
+static uint16_t adc_acc[TEMPERATURE_CHANNELS_MAX];  // Accumulated conversions
+static volatile uint8_t adc_channel;  // Channel being converted
+static volatile uint8_t adc_pending;  // Conversions left for the channel
+static volatile uint8_t adc_skip;     // Next conversion is of the old channel
 
 
 // ADC conversion complete ISR
 ISR(ADC_vect) {
-  adc_ongoing = 0;
-  adc_result = ADC;
-  lm_cli(); // Do not raise interrupts further
+  const uint16_t result = ADC;
+  if (adc_skip) {  // Started before the pin was switched
+    adc_skip = 0;
+    return;
+  }
+
+  adc_acc[adc_channel] += result;
+  if (--adc_pending) return;
+
+  if (++adc_channel == lm_count) {
+    ADCSRA &= ~((1 << ADATE) | (1 << ADIE));  // Stop running free
+    return;
+  }
+
+  // Switch to the next pin. The conversion already started in free running
+  // mode still samples the previous one, so it is dropped
+  ADMUX = ADMUX_PIN(lm_pins[adc_channel]);
+  adc_pending = LM_SAMPLES;
+  adc_skip = 1;
 }
 
 
 // Initialize ADC and other required stuff
-void lm_init(uint8_t adc_pin) {
-  adc_ongoing = 0;
+// Returns the number of channels
+uint8_t lm_init(uint8_t adc_mask) {
+  lm_count = 0;
+  for (uint8_t pin=A0; pin <= A7; ++pin)
+    if (adc_mask & (1 << pin))
+      lm_pins[lm_count++] = pin;
+  if (!lm_count) lm_pins[lm_count++] = A0;
 
-  // REFS1 -> Internal 2.56V Reference (no external AREF)
-  // Select ADC pin configured to handle the LM35 sensor
-  ADMUX = (1 << REFS1) | (adc_pin & 0x1F);
+  ADMUX = ADMUX_PIN(lm_pins[0]);
+  ADCSRB = 0;  // Free running trigger source (and MUX5 cleared)
 
   // ADEN  -> Enable ADC
-  // ADIE  -> Enable Conversion Complete Interrupt
   // ADPS* -> Set prescaler to 128 (i.e. ADC Frequency = F_CPU / Psc. = 125kHz)
   ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
 
-  lm_convert(); // Perform and discard first conversion
+  uint16_t discarded[TEMPERATURE_CHANNELS_MAX];
+  lm_convert(discarded); // Perform and discard first scan
+  return lm_count;
 }
 
 
-// Start a conversion and enter in ADC Noise Reduction sleep mode until the
-// conversion completes
-// Returns the registered temperature, or 0 on failure
-uint8_t lm_convert(void) {
-  lm_sei();
-  sleep(SLEEP_MODE_ADC); // Automatically starts conversion
+// Get the number of channels scanned by 'lm_convert'
+uint8_t lm_channels(void) { return lm_count; }
+
+
+// Run LM_SAMPLES free-running conversions for each channel, sleeping until
+// they complete
+// Returns the number of temperatures, with TEMPERATURE_RAW_BITS bits each
+uint8_t lm_convert(uint16_t *dest) {
+  while (ADCSRA & (1 << ADSC)) ;  // Trailing conversion of the last scan
+  for (uint8_t c=0; c < lm_count; ++c)
+    adc_acc[c] = 0;
+  adc_channel = adc_skip = 0;
+  adc_pending = LM_SAMPLES;
+  ADMUX = ADMUX_PIN(lm_pins[0]);
 
-  // Busy wait if the conversion was interrupted (unlikely but possible)
-  while (adc_ongoing) ;
+  // Clear a stale completion flag, then start running free with interrupts
+  ADCSRA |= (1 << ADIF) | (1 << ADATE) | (1 << ADIE) | (1 << ADSC);
+  sleep_while(SLEEP_MODE_IDLE, adc_channel < lm_count);
 
-  return adc_result;
+  for (uint8_t c=0; c < lm_count; ++c)
+    dest[c] = adc_acc[c] >> LM_EXTRA_BITS;
+  return lm_count;
 }
@@ -6,6 +6,7 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include "sleep_util.h"
+#include "scheduler.h"
 
 #include "temperature_daemon.h"
 #include "temperature.h"
@@ -15,6 +16,7 @@
 #include "command.h"
 
 #include "config.h"
+#include "nvm.h"
 #include "buttons.h"
 #include "led.h"
 
@@ -22,10 +24,6 @@
 // Perform setup routine?
 static uint8_t perform_setup = 1;
 
-// Counter for actions performed by the handlers
-// Shall be changed to 'volatile' if interrupts will be involved in future
-static uint8_t act_perf;
-
 // Buttons, dynamically loaded from the configuration
 static uint8_t btn_start, btn_stop, btn_poweroff;
 
@@ -39,7 +37,8 @@ static inline void poweroff(uint8_t pressed) {
   led_off(POWER_ON_LED);
   led_off(POWER_ACT_LED);
 
-  // Good night (go to sleep)
+  // Good night (go to sleep), after the pending NVM writes were committed
+  nvm_busy_wait();
   cli(); // No interrupts after waking up (sleep() sets interrupts to wake up)
   sleep(SLEEP_MODE_PWR_DOWN);
 
@@ -55,13 +54,20 @@ static inline void temperature_setup(void) {
   config_get(CFG_TEMPERATURE_TIMER_RESOLUTION, &resolution);
   config_get(CFG_TEMPERATURE_TIMER_INTERVAL,   &interval);
 
-  // Get ADC/LM35 parameters
-  uint8_t lm_pin;
+  // Get ADC/LM35 parameters. The pin is used if no channel is configured
+  uint8_t lm_pin, lm_channels;
   config_get(CFG_LMSENSOR_PIN, &lm_pin);
+  config_get(CFG_LMSENSOR_CHANNELS, &lm_channels);
+
+  // Get the storage parameters
+  uint8_t compression;
+  config_get(CFG_TEMPERATURE_COMPRESSION, &compression);
 
   // Initialize temperature modules
   temperature_init();
-  temperature_daemon_init(resolution, interval, lm_pin);
+  temperature_db_compression(compression);
+  temperature_daemon_init(resolution, interval,
+      lm_channels ? lm_channels : 1 << lm_pin);
 }
 
 
@@ -132,21 +138,21 @@ int main(void) {
     temperature_setup();
     buttons_setup();
 
-    command_init();
     communication_init();
 
+    // Dispatch the events posted by the ISRs to the handlers
+    scheduler_init();
+    scheduler_handler_set(EV_TEMPERATURE,   temperature_daemon_handler);
+    scheduler_handler_set(EV_COMMUNICATION, communication_handler);
+    scheduler_handler_set(EV_BUTTON,        button_handler);
+
     perform_setup = 0;
     sei();
 
     // Power-on application loop
-    while (!perform_setup) {
-      act_perf = 0;
-      act_perf |= communication_handler();      // Check for incoming packets
-      act_perf |= temperature_daemon_handler(); // Check for new temperatures
-      act_perf |= button_handler();             // Check for user interaction
-
-      // Enter (interruptable) sleep mode if no action request was performed
-      sleep_on(SLEEP_MODE_IDLE, !act_perf);
-    }
+    // Enter (interruptable) sleep mode when no event is pending
+    while (!perform_setup)
+      if (!scheduler_run())
+        sleep_on(SLEEP_MODE_IDLE, !scheduler_pending(EV_COUNT));
   }
 }
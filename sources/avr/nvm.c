@@ -12,7 +12,9 @@ nvm_image_t NVMMEM _nvm_image = {
   .config = {
     .temperature_timer_resolution = 1000,
     .temperature_timer_interval = 2,
+    .temperature_compression = 1,
     .lmsensor_pin = A0,
+    .lmsensor_channels = 0,
     .btn_debounce_time = 20,
     .poweroff_pin = D21,
     .start_pin = D50,
@@ -24,3 +26,6 @@ nvm_image_t NVMMEM _nvm_image = {
 
 // Pointer to the memory image, relative to the .eeprom section
 nvm_image_t *_nvm_image_ptr = &_nvm_image;
+
+// NVM backend in use
+const nvm_backend_t *nvm_backend = NVM_BACKEND_DEFAULT;
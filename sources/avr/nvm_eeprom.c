@@ -0,0 +1,122 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Non-Volatile Memory EEPROM backend - Source file
+// Bytes written asynchronously are queued together with their address, and
+// written one at a time by the EE_READY ISR, so the main loop never waits for
+// the EEPROM
+// The main loop is the only producer and the ISR the only consumer: each one
+// modifies a single 8-bit index, thus no critical section is needed
+// Reads do not wait for the queue, as a download must not stall on the EEPROM
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include "nvm.h"
+
+// Queue size, must be a power of 2 (one slot is always left free)
+#define NVM_QUEUE_SIZE 64
+#define NVM_QUEUE_MASK (NVM_QUEUE_SIZE - 1)
+
+typedef struct _nvm_queue_item_s {
+  uint16_t addr;
+  uint8_t data;
+} nvm_queue_item_t;
+
+static nvm_queue_item_t queue[NVM_QUEUE_SIZE];
+static volatile uint8_t queue_head, queue_tail;  // Push to head, pop from tail
+
+
+// EEPROM ready ISR: write the next queued byte which differs from the stored
+// one, or stop raising interrupts if the queue is empty
+ISR(EE_READY_vect) {
+  while (queue_tail != queue_head) {
+    const nvm_queue_item_t *item = queue + queue_tail;
+    queue_tail = (queue_tail + 1) & NVM_QUEUE_MASK;
+
+    EEAR = item->addr;
+    EECR |= 1 << EERE;
+    if (EEDR == item->data) continue;
+
+    EEDR = item->data;
+    EECR |= 1 << EEMPE;  // EEPE must be set within 4 cycles from EEMPE
+    EECR |= 1 << EEPE;
+    return;
+  }
+  EECR &= ~(1 << EERIE);
+}
+
+
+// [AUX] Queue a block of data to be written to the NVM, only where it differs
+// from the existent one; this blocks only while the queue is full
+static void _queue_update(void *dst, const void *src, size_t size) {
+  const uint8_t *bytes = src;
+  uint16_t addr = (uintptr_t) dst;
+
+  for (size_t i=0; i < size; ++i) {
+    const uint8_t next = (queue_head + 1) & NVM_QUEUE_MASK;
+    while (next == queue_tail)  // Queue full, wait for the ISR
+      EECR |= 1 << EERIE;
+    queue[queue_head] = (nvm_queue_item_t) { addr++, bytes[i] };
+    queue_head = next;
+  }
+
+  EECR |= 1 << EERIE;  // Fires as soon as the EEPROM is ready
+}
+
+
+// [AUX] Wait for the write queue to be drained
+static void _queue_wait(void) {
+  while (queue_tail != queue_head)
+    ;
+  eeprom_busy_wait();  // Last byte written by the ISR
+}
+
+
+// [AUX] Is there an ongoing write (queued ones included)?
+static uint8_t _queue_pending(void) {
+  return queue_tail != queue_head || !eeprom_is_ready();
+}
+
+
+// [AUX] Read a block of data without draining the queue: the ISR is held
+// back, only the byte being written is waited for, and then the queued bytes
+// falling in the block (the latest ones last) replace the stored ones
+static void _eeprom_read(void *dst, const void *src, size_t size) {
+  EECR &= ~(1 << EERIE);
+  eeprom_busy_wait();
+  eeprom_read_block(dst, src, size);
+
+  uint8_t *bytes = dst;
+  const uint16_t first = (uintptr_t) src;
+  for (uint8_t i = queue_tail; i != queue_head; i = (i + 1) & NVM_QUEUE_MASK)
+    if ((uint16_t) (queue[i].addr - first) < size)
+      bytes[queue[i].addr - first] = queue[i].data;
+
+  if (queue_tail != queue_head)
+    EECR |= 1 << EERIE;
+}
+
+
+// [AUX] Synchronous writes wait for the queue to be drained before starting,
+// so the queued data never overwrites them
+static void _eeprom_write(void *dst, const void *src, size_t size) {
+  _queue_wait();
+  eeprom_write_block(src, dst, size);
+}
+
+static void _eeprom_update(void *dst, const void *src, size_t size) {
+  _queue_wait();
+  eeprom_update_block(src, dst, size);
+}
+
+
+// The EEPROM backend, holding the memory image
+const nvm_backend_t nvm_eeprom = {
+  .base = &_nvm_image,
+  .size = E2END + 1,  // Whole EEPROM of the device
+  .erase_block = 1,
+  .read = _eeprom_read,
+  .write = _eeprom_write,
+  .update = _eeprom_update,
+  .update_async = _queue_update,
+  .pending = _queue_pending,
+  .wait = _queue_wait
+};
@@ -0,0 +1,62 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Event scheduler - Source file
+// The pending events are kept in a bitmask, one bit per event, so the queue
+// has a fixed size, posting is a single OR and the most urgent event is the
+// lowest set bit
+#include <stddef.h>
+#include <util/atomic.h>
+#include "scheduler.h"
+
+static volatile uint8_t sched_pending;
+static sched_handler_f sched_handler[EV_COUNT];
+
+
+// [AUX] Dispatch the most urgent pending event among the ones below 'limit'
+// Returns 0 if no event was dispatched, 1 otherwise
+static uint8_t _dispatch(uint8_t limit) {
+  const uint8_t pending = sched_pending;
+  uint8_t ev;
+  for (ev=0; ev < limit && !(pending & (1 << ev)); ++ev) ;
+  if (ev >= limit) return 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { sched_pending &= ~(1 << ev); }
+  if (sched_handler[ev] && sched_handler[ev]())
+    scheduler_post(ev);
+  return 1;
+}
+
+
+// Initialize the scheduler, with no handlers and no pending events
+void scheduler_init(void) {
+  sched_pending = 0;
+  for (uint8_t ev=0; ev < EV_COUNT; ++ev)
+    sched_handler[ev] = NULL;
+}
+
+// Set the handler for an event
+void scheduler_handler_set(sched_event_t ev, sched_handler_f handler) {
+  if (ev < EV_COUNT) sched_handler[ev] = handler;
+}
+
+// Post an event (ISR-safe). Posting an already pending event has no effect
+void scheduler_post(sched_event_t ev) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { sched_pending |= 1 << ev; }
+}
+
+// Is there any pending event more urgent than 'ev'? (EV_COUNT for any event)
+uint8_t scheduler_pending(sched_event_t ev) {
+  return sched_pending & ((1 << ev) - 1);
+}
+
+
+// Dispatch the most urgent pending event
+// Returns 0 if there was no pending event, 1 otherwise
+uint8_t scheduler_run(void) {
+  return _dispatch(EV_COUNT);
+}
+
+// Dispatch the most urgent pending event, if it is more urgent than 'ev'
+// Returns 0 if no event was dispatched, 1 otherwise
+uint8_t scheduler_yield(sched_event_t ev) {
+  return _dispatch(ev);
+}
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include "serial.h"
 #include "ringbuffer.h"
+#include "sleep_util.h"
 
 // Polling time for blocking RX in milliseconds
 #define RX_BLOCKING_POLLING_TIME_MS 5
@@ -14,10 +15,18 @@
 static volatile uint8_t rx_buffer_raw[RX_BUFFER_SIZE];
 static volatile ringbuffer_t rx_buffer[1];
 static uint8_t rx_ongoing;
+static volatile serial_rx_handler_f rx_handler;
 
 // TX variables
-static uint8_t tx_buffer[TX_BUFFER_SIZE];
-static uint8_t tx_to_transmit;
+// The TX frames are used in turn, so that one can be filled while the other
+// ones are being sent or kept to be sent again. Frames are sent in the same
+// order they are committed
+static uint8_t tx_frames[TX_FRAMES][TX_BUFFER_SIZE];
+static volatile uint8_t tx_size[TX_FRAMES];  // Bytes to send, 0 if free
+static uint8_t tx_committed[TX_FRAMES];      // Bytes of the last commit
+static uint8_t tx_fill;              // Frame given by 'serial_tx_reserve'
+static uint8_t tx_last;              // Last committed frame
+static volatile uint8_t tx_drain;    // Frame being sent
 static volatile uint8_t tx_transmitted;
 static volatile uint8_t tx_ongoing;
 
@@ -25,8 +34,13 @@ static volatile uint8_t tx_ongoing;
 // [AUX] Enable and disable RX and TX interrupts
 static inline void rx_sei(void) { UCSR0B |=   1 << RXCIE0 ; }
 static inline void rx_cli(void) { UCSR0B &= ~(1 << RXCIE0); }
-static inline void tx_sei(void) { UCSR0B |=   1 << TXCIE0 ; }
-static inline void tx_cli(void) { UCSR0B &= ~(1 << TXCIE0); }
+static inline void tx_sei(void) { UCSR0B |=   1 << UDRIE0 ; }
+static inline void tx_cli(void) { UCSR0B &= ~(1 << UDRIE0); }
+
+// [AUX] Get the TX frame following another one
+static inline uint8_t tx_next(uint8_t frame) {
+  return (frame + 1 == TX_FRAMES) ? 0 : frame + 1;
+}
 
 
 // Initialize the USART
@@ -54,17 +68,33 @@ void serial_init(void) {
 
 // RX Interrupt Service Routine
 ISR(USART0_RX_vect) {
-  if (!ringbuffer_isfull((ringbuffer_t*) rx_buffer))
-    ringbuffer_push((ringbuffer_t*) rx_buffer, UDR0);
+  const uint8_t c = UDR0;  // Always read, or the interrupt fires again
+  if (rx_handler)
+    rx_handler(c);
+  else if (!ringbuffer_isfull((ringbuffer_t*) rx_buffer))
+    ringbuffer_push((ringbuffer_t*) rx_buffer, c);
 }
 
 
-// TX Interrupt Service Routine
-ISR(USART0_TX_vect) {
-  ++tx_transmitted;
-  if (tx_transmitted < tx_to_transmit)
-    UDR0 = tx_buffer[tx_transmitted];
-  else serial_tx_reset();
+// Hand each received byte to a handler, in the RX ISR
+void serial_rx_handler_set(serial_rx_handler_f handler) {
+  rx_handler = handler;
+}
+
+
+// TX Interrupt Service Routine -- Fired while the USART data register is empty
+// Send the next byte, going on with the other frame when one is over
+ISR(USART0_UDRE_vect) {
+  UDR0 = tx_frames[tx_drain][tx_transmitted];
+  if (++tx_transmitted < tx_size[tx_drain]) return;
+
+  tx_size[tx_drain] = 0;
+  tx_transmitted = 0;
+  tx_drain = tx_next(tx_drain);
+  if (!tx_size[tx_drain]) {  // Nothing else to send
+    tx_cli();
+    tx_ongoing = 0;
+  }
 }
 
 
@@ -104,21 +134,62 @@ uint8_t serial_tx(const void *buf, uint8_t size) {
   // Test against inconsistent parameters
   if (!buf || !size || size > TX_BUFFER_SIZE) return 1;
 
-  // Block until the previous transmission is finished
-  while (tx_ongoing) ;
+  uint8_t *dest = serial_tx_reserve();
+  for (uint8_t i=0; i < size; ++i)
+    dest[i] = ((const uint8_t*) buf)[i];
+  return serial_tx_commit(size);
+}
 
-  // Setup for transmission
-  tx_ongoing = 1;
-  tx_to_transmit = size;
-  tx_transmitted = 0;
-  for (int i=0; i < size; ++i)
-    tx_buffer[i] = ((uint8_t*) buf)[i];
 
-  // Enable TX interrupt, and send the first byte;
-  // the others will be sent by the TX ISR
-  tx_sei();
-  UDR0 = tx_buffer[0];
+// [AUX] Queue a frame for transmission, starting it if the USART is idle
+static void _tx_queue(uint8_t frame, uint8_t size) {
+  tx_cli();  // The ISR must not switch frame meanwhile
+  tx_size[frame] = size;
+  if (!tx_ongoing) {
+    tx_drain = frame;
+    tx_transmitted = 0;
+    tx_ongoing = 1;
+  }
+  tx_sei();  // The ISR sends the first byte as soon as it is enabled
+}
+
+
+// Get a free TX frame to fill it in place
+void *serial_tx_reserve(void) {
+  sleep_while(SLEEP_MODE_IDLE, tx_size[tx_fill]);  // Still being sent
+  return tx_frames[tx_fill];
+}
+
+
+// Send the first 'size' bytes of the reserved TX frame
+// Returns 0 on success, 1 on failure
+uint8_t serial_tx_commit(uint8_t size) {
+  if (!size || size > TX_BUFFER_SIZE) return 1;
+  sleep_while(SLEEP_MODE_IDLE, tx_size[tx_fill]);
+
+  _tx_queue(tx_fill, size);
+  tx_committed[tx_fill] = size;
+  tx_last = tx_fill;
+  tx_fill = tx_next(tx_fill);
+  return 0;
+}
+
 
+// Send again the last 'count' committed frames, in the same order
+// Returns 0 on success, 1 if they were not all committed
+uint8_t serial_tx_resend(uint8_t count) {
+  if (!count || count >= TX_FRAMES) return 1;
+  uint8_t frame = tx_last;
+  for (uint8_t i=1; i < count; ++i)  // Go back to the first one
+    frame = (frame == 0) ? TX_FRAMES - 1 : frame - 1;
+  for (uint8_t f=frame, i=0; i < count; ++i, f = tx_next(f))
+    if (!tx_committed[f]) return 1;
+
+  // Wait for the queued frames to be sent, so that the ISR goes on from the
+  // first frame to send again to the last one
+  sleep_while(SLEEP_MODE_IDLE, tx_ongoing);
+  for (uint8_t i=0; i < count; ++i, frame = tx_next(frame))
+    _tx_queue(frame, tx_committed[frame]);
   return 0;
 }
 
@@ -143,10 +214,11 @@ void serial_rx_reset(void) {
   rx_sei();
 }
 
-// Reset indexes for transmitting data with the serial
+// Reset indexes for transmitting data with the serial, dropping queued frames
 void serial_tx_reset(void) {
   tx_cli();
-  tx_to_transmit = 0;
+  for (uint8_t i=0; i < TX_FRAMES; ++i)
+    tx_size[i] = 0;
   tx_transmitted = 0;
   tx_ongoing = 0;
 }
@@ -4,60 +4,69 @@
 #include <util/delay.h>
 
 #include "temperature_daemon.h"
+#include "scheduler.h"
+#include "timer_prescaler.h"
 #include "temperature.h"
 #include "lmsensor.h"
 #include "led.h"
 
 #define MIN_REGISTRATION_INTERVAL 50
-#define OCR_ONE_MSEC 15.625
 
 
 // Timer variables
-static volatile uint16_t timer_counter;
+// The timer covers a whole registration period (i.e. resolution * interval)
+// with a single compare match, unless the period is longer than ~4 seconds
+static volatile uint32_t timer_counter;
 static volatile uint8_t timer_ongoing;
-static volatile uint8_t timer_elapsed;
 static uint16_t timer_resolution;
 static uint16_t timer_interval;
+static timer_setup_t timer_setup;
 
 
-// Start/Stop the daemon timer
-static inline void timd_stop(void) { TIMSK1 &= ~(1 << OCIE1A); }
+// Start/Stop the daemon timer (the timer clock is stopped too)
+static inline void timd_stop(void) {
+  TIMSK1 &= ~(1 << OCIE1A);
+  TCCR1B = 1 << WGM52;
+}
+
 static inline void timd_start(void) {
-  OCR1A = (uint16_t)(OCR_ONE_MSEC * timer_resolution);
+  OCR1A = timer_setup.ocr;
   TCNT1 = 0;
+  TCCR1B = (1 << WGM52) | timer_setup.cs;
   TIMSK1 |=  (1 << OCIE1A);
 }
 
 // Timer ISR -- Timer 1 is used
 ISR(TIMER1_COMPA_vect) {
-  if (++timer_counter != timer_interval) return;
+  if (++timer_counter != timer_setup.matches) return;
   timer_counter = 0;
-  timer_elapsed = 1;
+  scheduler_post(EV_TEMPERATURE);
 }
 
 
 // Initialize the daemon (inlcuding related timer and LM sensor)
 void temperature_daemon_init(uint16_t tim_resolution, uint16_t tim_interval,
-    uint8_t lm_adc_pin) {
+    uint8_t lm_adc_mask) {
   led_enable(TEMPERATURE_REGISTERING_LED);
 
-  // Set the prescaler to 1024
+  // CTC mode, the prescaler is set when the daemon starts
   TCCR1A = 0;
-  TCCR1B = (1 << WGM52) | (1 << CS50) | (1 << CS52);
+  TCCR1B = 1 << WGM52;
 
   timer_resolution = tim_resolution;
   timer_interval = tim_interval;
 
-  // Initialize LM sensor module
-  lm_init(lm_adc_pin);
+  // Initialize LM sensor module, with a DB channel for each sensor
+  temperature_db_channels(lm_init(lm_adc_mask));
 }
 
 
 // Start/Stop the daemon -- Button friendly (but 'pressed' will be ignored)
 void temperature_daemon_start(uint8_t pressed) {
-  if (timer_ongoing ||
-      temperature_db_new(timer_resolution, timer_interval) != 0 ||
-      timer_resolution * timer_interval < MIN_REGISTRATION_INTERVAL)
+  const uint32_t period = (uint32_t) timer_resolution * timer_interval;
+  if (timer_ongoing || period < MIN_REGISTRATION_INTERVAL ||
+      timer_prescaler_compute(period, &timer_setup) != 0 ||
+      temperature_db_new(timer_resolution, timer_interval) != 0)
     return;
 
   led_on(TEMPERATURE_REGISTERING_LED);
@@ -70,6 +79,7 @@ void temperature_daemon_start(uint8_t pressed) {
 void temperature_daemon_stop(uint8_t pressed) {
   timd_stop();
   timer_ongoing = 0;
+  temperature_flush();  // Commit the staged temperatures
   led_off(TEMPERATURE_REGISTERING_LED);
 }
 
@@ -91,13 +101,18 @@ void temperature_daemon_set_interval(uint16_t tint) {
 }
 
 
-// Handle daemon "notifications", must be run periodically
-// In practice, register new temperatures if there is any
+// Handle daemon "notifications", i.e. the EV_TEMPERATURE event
+// In practice, register a new temperature
 uint8_t temperature_daemon_handler(void) {
-  if (!timer_elapsed) return 0;
-  timer_elapsed = 0;
-
-  if (temperature_register(lm_convert()) != 0)
-    temperature_daemon_stop(1);
+  if (!timer_ongoing) return 0;  // Stopped after the event was posted
+
+  // A record takes a temperature for each channel
+  uint16_t raw[TEMPERATURE_CHANNELS_MAX];
+  const uint8_t channels = lm_convert(raw);
+  for (uint8_t c=0; c < channels; ++c)
+    if (temperature_register(raw[c]) != 0) {
+      temperature_daemon_stop(1);
+      break;
+    }
   return 0; // Always returns 0
 }
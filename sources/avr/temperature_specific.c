@@ -1,82 +1,186 @@
 // AVR Temperature Monitor -- Paolo Lucchesi
 // Temperature database - Source file
+// The DBs are stored in a log which wraps around the NVM (see the head file)
+// Appending a temperature writes at most a single word, and no counter or
+// header is ever rewritten: the wear is spread evenly across the whole NVM
 #include <stddef.h>  // offsetof macro
-#include <string.h>  // memcpy
 
 #include "temperature.h"
 #include "nvm.h"
 
 
-// Cache memory to avoid an excessive number of NVM read operations
-// WARNING: Do NOT try to access items from the 'meta' structure!
-// 'local_db_aux' is used to make 'cache_db' independent from any use of any
-// auxiliary function (e.g.: download all the temperatures while registering)
-typedef struct _cache_db_s {
-  temperature_db_t meta;  // Metadata of the currently loaded DB
-  void *nvm_addr;         // NVM base address of the currently loaded DB
-} cache_db_t;
-cache_db_t local_db, local_db_aux;
+// NVM address of the idx-th word of the log
+#define LOG_ADDR(idx) (nvm_image->db_seq.words + (idx))
 
-// Room necessary for a DB with just one temperature
-#define TEMP_DB_MIN_SIZE (sizeof(temperature_db_t) + sizeof(temperature_t))
+// Number of words in the log, depending on the size of the NVM backend
+static temperature_log_idx_t log_words;
 
-// Get the address of an arbitrary field in an NVM, passing the field name
-#define NVM_ADDR_FIELD(db_nvm_addr, field) \
-  (((void*) db_nvm_addr) + offsetof(temperature_db_t, field))
+// Write position (i.e. head) and oldest word (i.e. tail) of the log, with the
+// phase of their respective laps
+static temperature_log_idx_t log_head, log_tail;
+static temperature_log_word_t head_phase, tail_phase;
+
+// Words appended to the log but not committed to the NVM yet
+// They are written in a single block when the stage is full or when flushed
+static temperature_log_word_t stage[TEMP_STAGE_WORDS];
+static temperature_log_idx_t stage_idx;  // Log index of the first staged word
+static uint8_t staged;      // Number of staged words
+
+// DB currently in use. Its header is appended together with its first
+// temperature, so an empty DB never takes room in the log
+static temperature_db_t local_db;
+static uint8_t local_db_logged;
+
+// Directory of the DBs preceding 'local_db', indexed by ID
+// DB IDs are consecutive starting from 0, so 'local_db.id' entries are used
+static temperature_dir_entry_t db_dir[TEMP_DB_MAX];
+
+// Last DB looked up by ID, so its header is read only once when downloading
+// It is always a DB preceding 'local_db', thus it cannot change
+static temperature_db_t local_db_aux;
+static uint8_t local_db_aux_valid;
+
+// Flags of the DBs created from now on
+static uint8_t db_flags;
+
+// Delta encoding state of the DB currently in use: last temperature registered
+// for each channel (if any, see the 'pack_keyed' bitmask) and first free slot
+// of the last word, if it is staged and not full
+// Only a staged word can be filled in, as the NVM is never rewritten
+static temperature_t pack_last[TEMPERATURE_CHANNELS_MAX];
+static uint8_t pack_keyed, pack_open, pack_slot;
+
+// Position of the last word decoded in a delta-compressed DB, i.e. its log
+// index, the ID of its first temperature and the temperatures preceding it
+// Sequential reads (e.g. downloads) resume from there instead of decoding the
+// whole DB from its first keyframe each time
+static temperature_log_idx_t cursor_idx;
+static temperature_id_t cursor_id;
+static temperature_t cursor_last[TEMPERATURE_CHANNELS_MAX];
+static uint8_t cursor_db, cursor_valid;
 
 
 // Auxiliary functions -- See at the bottom of this source file
-static inline void *_item_nvm_addr(void *db_nvm_addr, temperature_id_t t_id);
-static inline void *_db_nvm_addr(uint8_t db_id);
-static void *_db_nvm_addr_next(const cache_db_t *current);
-static uint8_t _db_fetch_next(cache_db_t *dest, const cache_db_t *current);
-static uint8_t _db_fetch_by_id(cache_db_t *dest, uint8_t db_id);
-static inline void _db_fetch(cache_db_t *dest, void *nvm_addr);
-static inline void _db_sync(const cache_db_t *db);
-#define _db_load(nvm_addr) _db_fetch(&local_db, nvm_addr)
-#define _db_load_next() _db_fetch_next(&local_db, &local_db)
+static inline temperature_log_idx_t _log_next(temperature_log_idx_t idx,
+    temperature_log_word_t *phase);
+static inline temperature_log_idx_t _log_used(void);
+static inline temperature_log_idx_t _log_free(void);
+static inline temperature_log_word_t _log_phase(temperature_log_idx_t idx);
+static inline temperature_log_word_t _log_read(temperature_log_idx_t idx);
+static void _log_append(temperature_log_word_t word, uint8_t open);
+static void _log_stage_overlay(temperature_t *dest, temperature_log_idx_t idx,
+    uint16_t n);
+static void _log_read_block(temperature_t *dest, temperature_log_idx_t idx,
+    uint16_t n);
+static void _log_format(void);
+static void _log_control_sync(void);
+static uint8_t _db_header_read(temperature_db_t *dest,
+    temperature_log_idx_t idx, temperature_log_word_t phase);
+static void _db_header_append(const temperature_db_t *db);
+static void _db_lock(void);
+static uint8_t _db_fetch_by_id(temperature_db_t *dest, uint8_t db_id);
+static uint8_t _db_word_count(const temperature_db_t *db,
+    temperature_log_word_t word);
+static uint8_t _delta_append(temperature_t value);
+static uint8_t _delta_decode(temperature_log_word_t word, temperature_t *last,
+    uint8_t channel, uint8_t channels, temperature_t *dest);
+static temperature_id_t _delta_read(const temperature_db_t *db,
+    temperature_id_t start_id, temperature_id_t n, temperature_t *dest);
 
 
 // Setup for using the temperature database
-// This just loads the last used DB
+// Scan the log from its tail to find its head and the DB currently in use
 void temperature_init(void) {
-  // Load the last database in memory, locked or not
-  _db_load(&nvm_image->db_seq); // <- First DB
-  while (local_db.meta.locked && _db_load_next() != 0)
-    ;
+  const size_t words = (NVM_SIZE - offsetof(nvm_image_t, db_seq.words)) /
+    sizeof(temperature_log_word_t);
+  log_words = (words > TEMP_LOG_IDX_MAX) ? TEMP_LOG_IDX_MAX : words;
+
+  temperature_log_t control;
+  nvm_read(&control, &nvm_image->db_seq, sizeof(control));
+  if (control.magic != TEMP_LOG_MAGIC ||
+      (control.tail & ~TEMP_LOG_IDX_PHASE) >= log_words) {
+    _log_format();
+    nvm_read(&control, &nvm_image->db_seq, sizeof(control));
+  }
+
+  log_tail = control.tail & ~TEMP_LOG_IDX_PHASE;
+  tail_phase = (control.tail & TEMP_LOG_IDX_PHASE) ? TEMP_LOG_PHASE : 0;
+  local_db = (temperature_db_t) { 0 };
+  local_db_logged = local_db_aux_valid = cursor_valid = 0;
+  staged = pack_keyed = pack_open = 0;  // Resume from a keyframe
+
+  // The log ends at the first word written in a previous lap (or never)
+  temperature_log_idx_t idx = log_tail, scanned = 0;
+  temperature_log_word_t phase = tail_phase;
+  while (scanned < log_words - 1) {
+    const temperature_log_word_t word = _log_read(idx);
+    if (word == TEMP_LOG_ERASED || (word & TEMP_LOG_PHASE) != phase)
+      break;
+
+    if (!(word & TEMP_LOG_META)) {  // Temperature
+      if (!local_db_logged) break;  // Should never happen
+      local_db.used += _db_word_count(&local_db, word);
+      local_db.words++;
+      idx = _log_next(idx, &phase);
+      scanned++;
+    }
+
+    else {  // DB header. A torn one (e.g. power loss) ends the log
+      temperature_db_t db;
+      if (_db_header_read(&db, idx, phase) != 0 ||
+          db.id != (local_db_logged ? local_db.id + 1 : 0) ||
+          db.id >= TEMP_DB_MAX)
+        break;
+      if (local_db_logged) _db_lock();
+      local_db = db;
+      local_db_logged = 1;
+      for (uint8_t i=0; i < TEMP_LOG_HEADER_WORDS; ++i)
+        idx = _log_next(idx, &phase);
+      scanned += TEMP_LOG_HEADER_WORDS;
+    }
+  }
+
+  log_head = idx;
+  head_phase = phase;
 }
 
 
 // Lock the DB currently in use and create a new one
-// Returns 0 on success, 1 on insufficient space
+// Returns 0 on success, 1 on insufficient space or if there are TEMP_DB_MAX DBs
 uint8_t temperature_db_new(uint16_t reg_resolution, uint16_t reg_interval) {
-  if (local_db.meta.used == 0) { // No need to create new DB, use current one
-    local_db.meta.locked = 0;
-    local_db.meta.reg_resolution = reg_resolution;
-    local_db.meta.reg_interval = reg_interval;
-    _db_sync(&local_db);
+  if (!local_db_logged) { // No need to create new DB, use current one
+    local_db.reg_resolution = reg_resolution;
+    local_db.reg_interval = reg_interval;
     return 0;
   }
 
-  // Lock currently loaded DB
-  if (!local_db.meta.locked) {
-    local_db.meta.locked = 1;
-    _db_sync(&local_db);
-  }
+  // There must be room for the new header and at least one temperature
+  if (local_db.id == TEMP_DB_MAX - 1 ||
+      _log_free() < TEMP_LOG_HEADER_WORDS + 1)
+    return 1;
 
-  // Compute next DB address and check against insufficient space
-  void *nvm_next = _db_nvm_addr_next(&local_db);
-  if (!nvm_next) return 1; // No more space
+  _db_lock();
+  local_db = (temperature_db_t) {
+    .id = local_db.id + 1,
+    .reg_resolution = reg_resolution,
+    .reg_interval = reg_interval
+  };
+  local_db_logged = 0;
+  return 0;
+}
 
-  // Create the new database
-  local_db.meta.used = 0;
-  local_db.meta.reg_resolution = reg_resolution;
-  local_db.meta.reg_interval = reg_interval;
-  local_db.meta.id++;
-  local_db.meta.locked = 0;
-  local_db.nvm_addr = nvm_next;
-  _db_sync(&local_db);
 
+// Choose whether the DBs created from now on are delta-compressed
+void temperature_db_compression(uint8_t enable) {
+  db_flags = (db_flags & ~TEMP_LOG_DB_DELTA) | (enable ? TEMP_LOG_DB_DELTA : 0);
+}
+
+// Set the number of channels of the DBs created from now on
+// Returns 0 on success, 1 if it is not in [1, TEMPERATURE_CHANNELS_MAX]
+uint8_t temperature_db_channels(uint8_t channels) {
+  if (!channels || channels > TEMPERATURE_CHANNELS_MAX) return 1;
+  db_flags = (db_flags & TEMP_LOG_DB_DELTA) |
+    TEMP_LOG_DB_CHANNELS_FLAGS(channels);
   return 0;
 }
 
@@ -84,33 +188,53 @@ uint8_t temperature_db_new(uint16_t reg_resolution, uint16_t reg_interval) {
 // Register a new temperature
 // Returns 0 on success, 1 otherwise (e.g. if there is no more space)
 uint8_t temperature_register(uint16_t raw_val) {
-  if (local_db.meta.locked || _item_nvm_addr(local_db.nvm_addr, local_db.meta.used)
-      + sizeof(temperature_t) - 1 > NVM_LIMIT)
-    return 1;
-
-  nvm_update(_item_nvm_addr(local_db.nvm_addr, local_db.meta.used),
-      &raw_val, sizeof(temperature_t));
-  local_db.meta.used++;
+  if (!local_db_logged) {
+    if (_log_free() < TEMP_LOG_HEADER_WORDS + 1) return 1;
+    local_db.start = log_head;
+    for (uint8_t i=0; i < TEMP_LOG_HEADER_WORDS; ++i)
+      local_db.start = _log_next(local_db.start, NULL);
+    local_db.flags = db_flags;
+    _db_header_append(&local_db);
+    local_db_logged = 1;
+    pack_keyed = 0;
+  }
 
-  nvm_update(NVM_ADDR_FIELD(local_db.nvm_addr, used),
-      &local_db.meta.used, sizeof(local_db.meta.used));
+  if (local_db.used == (temperature_id_t) -1) return 1;  // Cannot be counted
+  if (local_db.flags & TEMP_LOG_DB_DELTA) {
+    if (_delta_append(raw_val) != 0) return 1;
+  }
+  else {
+    if (_log_free() < 1) return 1;
+    _log_append(raw_val & TEMP_LOG_VALUE, 0);
+    local_db.words++;
+  }
 
+  local_db.used++;
   return 0;
 }
 
 
+// Commit the staged temperatures to the NVM
+// The words are queued and written in background by the NVM write queue
+void temperature_flush(void) {
+  if (!staged) return;
+  temperature_log_idx_t before_end = log_words - stage_idx;
+  if (before_end > staged) before_end = staged;
+
+  nvm_update_async(LOG_ADDR(stage_idx), stage,
+      before_end * sizeof(temperature_log_word_t));
+  if (staged > before_end)
+    nvm_update_async(LOG_ADDR(0), stage + before_end,
+        (staged - before_end) * sizeof(temperature_log_word_t));
+  staged = pack_open = 0;
+}
+
+
 // Get a temperature by id
 // Returns 0 if the temperature exists, 1 otherwise
 uint8_t temperature_get(uint8_t db_id, temperature_id_t temp_id,
     temperature_t *dest) {
-  if (!dest || _db_fetch_by_id(&local_db_aux, db_id) != 0 ||
-      temp_id >= local_db_aux.meta.used)
-    return 1;
-
-  nvm_read(dest, _item_nvm_addr(local_db_aux.nvm_addr, temp_id),
-      sizeof(temperature_t));
-
-  return 0;
+  return (temperature_get_bulk(db_id, temp_id, 1, dest) == 1) ? 0 : 1;
 }
 
 
@@ -120,142 +244,384 @@ uint8_t temperature_get(uint8_t db_id, temperature_id_t temp_id,
 // present in the DB
 temperature_t temperature_get_bulk(uint8_t db_id, temperature_id_t start_id,
     temperature_id_t ntemps, temperature_t *dest) {
-  if (!dest || _db_fetch_by_id(&local_db_aux, db_id) != 0 ||
-      start_id >= local_db_aux.meta.used)
+  temperature_db_t db;
+  if (!dest || _db_fetch_by_id(&db, db_id) != 0 || start_id >= db.used)
     return 0;
 
-  temperature_id_t to_read = local_db_aux.meta.used - start_id;
+  temperature_id_t to_read = db.used - start_id;
   to_read = to_read >= ntemps ? ntemps : to_read;
-  nvm_read(dest, _item_nvm_addr(local_db_aux.nvm_addr, start_id),
-      to_read * sizeof(temperature_t));
+  if (db.flags & TEMP_LOG_DB_DELTA)
+    return _delta_read(&db, start_id, to_read, dest);
+
+  temperature_log_idx_t first = db.start + start_id;
+  if (first >= log_words) first -= log_words;
+  _log_read_block(dest, first, to_read);
 
+  for (temperature_id_t i=0; i < to_read; ++i)
+    dest[i] &= TEMP_LOG_VALUE;
   return to_read;
 }
 
 
 // Returns the number of temperatures actually present in a database
 temperature_id_t temperature_count(uint8_t db_id) {
-  if (db_id == local_db.meta.id) return local_db.meta.used;
-
-  void *nvm_addr = _db_nvm_addr(db_id);
-  if (!nvm_addr) return 0;
-
-  temperature_id_t used;
-  nvm_read(&used, NVM_ADDR_FIELD(nvm_addr, used), sizeof(temperature_t));
-
-  return used;
+  temperature_db_t db;
+  return (_db_fetch_by_id(&db, db_id) == 0) ? db.used : 0;
 }
 
 
 // Returns the number of temperatures present in all the databases
 temperature_id_t temperature_count_all(void) {
-  temperature_id_t count = 0;
-
-  _db_fetch(&local_db_aux, &nvm_image->db_seq);
-  while (local_db_aux.meta.locked) {
-    count += local_db_aux.meta.used;
-    if (_db_fetch_next(&local_db_aux, &local_db_aux) != 0)
-      return count;
-  }
-
-  return count + local_db_aux.meta.used; // Last DB was not locked
+  temperature_id_t count = local_db_logged ? local_db.used : 0;
+  for (uint8_t id=0; id < local_db.id; ++id)
+    count += db_dir[id].used;
+  return count;
 }
 
 
 // Reset the database sequence, deleting all temperatures
+// The log is not erased: its tail is just moved to its head
 void temperature_db_reset(void) {
-  uint16_t last_res = local_db.meta.reg_resolution;
-  uint16_t last_int = local_db.meta.reg_interval;
-  local_db.nvm_addr = &nvm_image->db_seq;
-  local_db.meta = (temperature_db_t) {
-    .reg_resolution = last_res, .reg_interval = last_int, .used = 0, .locked = 0
+  if (staged) {  // Staged words are dropped, as they were never written
+    log_head = stage_idx;
+    head_phase = _log_phase(stage_idx);
+    staged = pack_open = 0;
+  }
+  log_tail = log_head;
+  tail_phase = head_phase;
+  _log_control_sync();
+
+  local_db = (temperature_db_t) {
+    .reg_resolution = local_db.reg_resolution,
+    .reg_interval = local_db.reg_interval
   };
-  _db_sync(&local_db);
+  local_db_logged = local_db_aux_valid = cursor_valid = 0;
 }
 
 
 // Craft a 'temperature_db_info_t' struct from an existent database
 // Returns 0 on success, 1 if some parameter is not valid
 uint8_t temperature_db_info(uint8_t db_id, temperature_db_info_t dest) {
-  if (!dest || _db_fetch_by_id(&local_db_aux, db_id) != 0)
+  temperature_db_t db;
+  if (!dest || _db_fetch_by_id(&db, db_id) != 0)
     return 1;
-  temperature_db_info_pack(dest, local_db_aux.meta.id, local_db_aux.meta.used,
-      local_db_aux.meta.reg_resolution, local_db_aux.meta.reg_interval);
+  temperature_db_info_pack(dest, db.id, db.used, db.reg_resolution,
+      db.reg_interval, TEMP_LOG_DB_CHANNELS(db.flags));
+  return 0;
+}
+
+
+
+// [AUX] Get the index following 'idx', flipping 'phase' (if not NULL) when
+// the end of the NVM is reached
+static inline temperature_log_idx_t _log_next(temperature_log_idx_t idx,
+    temperature_log_word_t *phase) {
+  if (++idx < log_words) return idx;
+  if (phase) *phase ^= TEMP_LOG_PHASE;
   return 0;
 }
 
 
+// [AUX] Get the number of words used by the log
+static inline temperature_log_idx_t _log_used(void) {
+  return (log_head >= log_tail) ? log_head - log_tail :
+    log_words - log_tail + log_head;
+}
+
+// [AUX] Get the number of words which can be appended to the log
+// A word is always left free, or a full log could not be told from an empty one
+static inline temperature_log_idx_t _log_free(void) {
+  return log_words - 1 - _log_used();
+}
+
+
+// [AUX] Get the phase of a word in the live part of the log
+static inline temperature_log_word_t _log_phase(temperature_log_idx_t idx) {
+  return (idx >= log_tail) ? tail_phase : tail_phase ^ TEMP_LOG_PHASE;
+}
 
-// [AUX] Get the NVM memory address of an arbitrary temperature database
-// Returns NULL on failure
-static void *_db_nvm_addr(uint8_t db_id) {
-  if (local_db.meta.id == db_id) return local_db.nvm_addr;
-  if (local_db.meta.id < db_id)
-    memcpy(&local_db_aux, &local_db, sizeof(local_db));
-  else
-    _db_fetch(&local_db_aux, &nvm_image->db_seq);
 
-  // Attempt to retrieve the db_id-th database
-  while (local_db_aux.meta.id != db_id) {
-    void *nvm_next = _db_nvm_addr_next(&local_db_aux);
-    if (!nvm_next) return NULL;
-    _db_fetch(&local_db_aux, nvm_next);
+// [AUX] Read a single word from the log
+static inline temperature_log_word_t _log_read(temperature_log_idx_t idx) {
+  temperature_log_word_t word;
+  nvm_read(&word, LOG_ADDR(idx), sizeof(word));
+  _log_stage_overlay(&word, idx, 1);
+  return word;
+}
+
+
+// [AUX] Append a word at the head of the log, staging it
+// An open word (i.e. with room for more deltas) keeps a full stage from being
+// committed until it is closed or another word is appended
+static void _log_append(temperature_log_word_t word, uint8_t open) {
+  if (staged == TEMP_STAGE_WORDS) temperature_flush();
+  if (!staged) stage_idx = log_head;
+  stage[staged++] = (word & ~TEMP_LOG_PHASE) | head_phase;
+  log_head = _log_next(log_head, &head_phase);
+  pack_open = open;
+  if (staged == TEMP_STAGE_WORDS && !open)
+    temperature_flush();
+}
+
+
+// [AUX] Replace the words in [idx, idx+n) which are still staged
+static void _log_stage_overlay(temperature_t *dest, temperature_log_idx_t idx,
+    uint16_t n) {
+  temperature_log_idx_t word_idx = stage_idx;
+  for (uint8_t i=0; i < staged; ++i, word_idx = _log_next(word_idx, NULL)) {
+    const temperature_log_idx_t offset = (word_idx >= idx) ? word_idx - idx :
+      log_words - idx + word_idx;
+    if (offset < n) dest[offset] = stage[i];
   }
+}
 
-  return local_db_aux.nvm_addr;
+
+// [AUX] Read 'n' consecutive words, wrapping around the end of the NVM
+static void _log_read_block(temperature_t *dest, temperature_log_idx_t idx,
+    uint16_t n) {
+  temperature_log_idx_t before_end = log_words - idx;
+  if (before_end > n) before_end = n;
+  nvm_read(dest, LOG_ADDR(idx), before_end * sizeof(temperature_log_word_t));
+  if (n > before_end)
+    nvm_read(dest + before_end, LOG_ADDR(0),
+        (n - before_end) * sizeof(temperature_log_word_t));
+  _log_stage_overlay(dest, idx, n);
 }
 
 
-// [AUX] Get the next temperature DB NVM address, or 0 if no other is present
-// Returns NULL if the currently loaded database is the last one
-static void *_db_nvm_addr_next(const cache_db_t *current) {
-  if (!current->meta.locked) return NULL;
-  void *next = ((void*) (((temperature_db_t*) current->nvm_addr)->items +
-        current->meta.used));
+// [AUX] Erase the whole log and make it empty, starting from its first word
+// Done once, as the NVM could contain anything before
+static void _log_format(void) {
+  static const temperature_log_word_t erased[8] = {
+    TEMP_LOG_ERASED, TEMP_LOG_ERASED, TEMP_LOG_ERASED, TEMP_LOG_ERASED,
+    TEMP_LOG_ERASED, TEMP_LOG_ERASED, TEMP_LOG_ERASED, TEMP_LOG_ERASED
+  };
+  const uint16_t chunk = sizeof(erased) / sizeof(*erased);
+
+  for (temperature_log_idx_t idx=0; idx < log_words; idx += chunk) {
+    const uint16_t n = (log_words - idx < chunk) ? log_words - idx : chunk;
+    nvm_update(LOG_ADDR(idx), erased, n * sizeof(temperature_log_word_t));
+  }
+
+  log_tail = 0;
+  tail_phase = 0;
+  _log_control_sync();
+}
+
+
+// [AUX] Write the log control block (i.e. magic and tail) in the NVM
+static void _log_control_sync(void) {
+  const temperature_log_t control = {
+    .magic = TEMP_LOG_MAGIC,
+    .tail = log_tail | (tail_phase ? TEMP_LOG_IDX_PHASE : 0)
+  };
+  nvm_update(&nvm_image->db_seq, &control, sizeof(control));
+}
+
+
+// [AUX] Read the DB header starting at 'idx', whose word has phase 'phase'
+// 'dest->used' is set to 0
+// Returns 0 on success, 1 if there is no valid DB header at 'idx'
+static uint8_t _db_header_read(temperature_db_t *dest,
+    temperature_log_idx_t idx, temperature_log_word_t phase) {
+  temperature_log_word_t words[TEMP_LOG_HEADER_WORDS];
+  _log_read_block(words, idx, TEMP_LOG_HEADER_WORDS);
+  for (uint8_t i=0; i < TEMP_LOG_HEADER_WORDS; ++i) {
+    if (words[i] == TEMP_LOG_ERASED || (words[i] & TEMP_LOG_PHASE) != phase ||
+        !(words[i] & TEMP_LOG_META) || TEMP_LOG_TAG(words[i]) !=
+        (i == 0 ? TEMP_LOG_TAG_DB : TEMP_LOG_TAG_ARG))
+      return 1;
+    idx = _log_next(idx, &phase);
+  }
+
+  *dest = (temperature_db_t) {
+    .id = TEMP_LOG_DB_ID(words[0]),
+    .flags = TEMP_LOG_DB_FLAGS(words[0]),
+    .reg_resolution = TEMP_LOG_PAYLOAD(words[1]) |
+      (TEMP_LOG_PAYLOAD(words[2]) << 12),
+    .reg_interval = TEMP_LOG_PAYLOAD(words[3]) |
+      (TEMP_LOG_PAYLOAD(words[4]) << 12),
+    .start = idx,
+    .used = 0,
+    .words = 0
+  };
+  return 0;
+}
+
 
-  if (next + sizeof(temperature_db_t) + sizeof(temperature_t) >
-      NVM_LIMIT - TEMP_DB_MIN_SIZE)
-    return NULL;
-  else return next;
+// [AUX] Append the header of a DB to the log
+static void _db_header_append(const temperature_db_t *db) {
+  #define ARG(val) (TEMP_LOG_META | (TEMP_LOG_TAG_ARG << 12) | ((val) & 0x0FFF))
+  _log_append(TEMP_LOG_META | (TEMP_LOG_TAG_DB << 12) | (db->flags << 8) |
+      db->id, 0);
+  _log_append(ARG(db->reg_resolution), 0);
+  _log_append(ARG(db->reg_resolution >> 12), 0);
+  _log_append(ARG(db->reg_interval), 0);
+  _log_append(ARG(db->reg_interval >> 12), 0);
+  #undef ARG
 }
 
 
-// [AUX] Fetch an entire database given its base NVM address
-static inline void _db_fetch(cache_db_t *dest, void *nvm_addr) {
-  nvm_read(&dest->meta, nvm_addr, sizeof(temperature_db_t));
-  dest->nvm_addr = nvm_addr;
+// [AUX] Lock the DB currently in use, adding it to the directory
+static void _db_lock(void) {
+  temperature_log_idx_t header = local_db.start + log_words -
+    TEMP_LOG_HEADER_WORDS;
+  if (header >= log_words) header -= log_words;
+  db_dir[local_db.id] = (temperature_dir_entry_t) {
+    .header = header,
+    .words = local_db.words,
+    .used = local_db.used
+  };
 }
 
 
-// [AUX] Given a database in 'cache_db', load the next db in the cache
-// Returns 0 on success, 1 if the currently loaded database is the last one
-// 'dest' and 'current' can point to the same area
-static uint8_t _db_fetch_next(cache_db_t *dest, const cache_db_t *current) {
-  void *nvm_next = _db_nvm_addr_next(current);
-  if (!nvm_next) return 1;
-  _db_fetch(dest, nvm_next);
+// [AUX] Fetch a DB given its ID
+// Returns 0 on success, 1 if the DB does not exist
+static uint8_t _db_fetch_by_id(temperature_db_t *dest, uint8_t db_id) {
+  if (local_db_logged && db_id == local_db.id) {
+    *dest = local_db;
+    return 0;
+  }
+  if (db_id >= local_db.id) return 1;
+
+  if (local_db_aux_valid && local_db_aux.id == db_id) {
+    *dest = local_db_aux;
+    return 0;
+  }
+
+  // Only the header is read, the rest is in the directory
+  const temperature_dir_entry_t *entry = db_dir + db_id;
+  if (_db_header_read(dest, entry->header, _log_phase(entry->header)) != 0)
+    return 1;
+  dest->words = entry->words;
+  dest->used = entry->used;
+
+  local_db_aux = *dest;
+  local_db_aux_valid = 1;
   return 0;
 }
 
 
-// [AUX] Fetch the entire database from the NVM
-// Returns 0 on success, 1 on failure
-static uint8_t _db_fetch_by_id(cache_db_t *dest, uint8_t db_id) {
-  void *nvm_addr = _db_nvm_addr(db_id);
-  if (!nvm_addr) return 1;
-  _db_fetch(dest, nvm_addr);
+// [AUX] Get the number of temperatures in a word of a DB
+static uint8_t _db_word_count(const temperature_db_t *db,
+    temperature_log_word_t word) {
+  if (!(db->flags & TEMP_LOG_DB_DELTA)) return 1;
+  temperature_t last = 0, decoded[TEMP_LOG_DELTA_SLOTS];
+  return _delta_decode(word, &last, 0, 1, decoded);
+}
+
+
+// [AUX] Append a temperature to the delta-compressed DB currently in use
+// The delta from the previous temperature of the same channel is packed in the
+// last word if possible, or in a new one
+// Returns 0 on success, 1 if a new word is needed but there is no room for it
+static uint8_t _delta_append(temperature_t value) {
+  const uint8_t channel = local_db.used % TEMP_LOG_DB_CHANNELS(local_db.flags);
+  value &= TEMP_LOG_KEY_VALUE;
+  const int16_t delta = (int16_t) value - (int16_t) pack_last[channel];
+  const uint8_t narrow = (delta >= -7 && delta <= 7);
+
+  if (pack_open && narrow) {  // Fill in the next slot of the staged word
+    const uint8_t shift = pack_slot << 2;
+    stage[staged - 1] = (stage[staged - 1] & ~(0xF << shift)) |
+      ((delta & 0xF) << shift);
+    if (++pack_slot == TEMP_LOG_DELTA_SLOTS) {
+      pack_open = 0;
+      if (staged == TEMP_STAGE_WORDS) temperature_flush();
+    }
+  }
+
+  else {
+    if (_log_free() < 1) return 1;
+    temperature_log_word_t word;
+    if (!(pack_keyed & (1 << channel)) || delta < -127 || delta > 127) {
+      word = value;
+      pack_slot = TEMP_LOG_DELTA_SLOTS;
+    }
+    else if (narrow) {
+      word = TEMP_LOG_DELTA | (TEMP_LOG_ESC4 << 8) | (TEMP_LOG_ESC4 << 4) |
+        (delta & 0xF);
+      pack_slot = 1;
+    }
+    else {
+      word = TEMP_LOG_DELTA | TEMP_LOG_DELTA_WIDE | (TEMP_LOG_ESC4 << 8) |
+        (delta & 0xFF);
+      pack_slot = 2;
+    }
+    _log_append(word, pack_slot < TEMP_LOG_DELTA_SLOTS);
+    local_db.words++;
+  }
+
+  pack_last[channel] = value;
+  pack_keyed |= 1 << channel;
   return 0;
 }
 
 
-// [AUX] Get the NVM address of a temperature item (giving its NVM DB address)
-// Deliberately don't check for errors
-static inline void *_item_nvm_addr(void *db_nvm_addr, temperature_id_t t_id) {
-  return ((temperature_db_t*) db_nvm_addr)->items + t_id;
+// [AUX] Decode a word of a delta-compressed DB, whose first temperature is of
+// 'channel', updating the last temperature of each channel in 'last'
+// Returns the number of temperatures written to 'dest' (at most 3)
+static uint8_t _delta_decode(temperature_log_word_t word, temperature_t *last,
+    uint8_t channel, uint8_t channels, temperature_t *dest) {
+  if (!(word & TEMP_LOG_DELTA)) {
+    *dest = last[channel] = word & TEMP_LOG_KEY_VALUE;
+    return 1;
+  }
+
+  uint8_t n = 0, shift = 0;
+  if (word & TEMP_LOG_DELTA_WIDE) {
+    if ((word & 0xFF) == TEMP_LOG_ESC8) return 0;
+    last[channel] += (int8_t) (word & 0xFF);
+    dest[n++] = last[channel];
+    if (++channel == channels) channel = 0;
+    shift = 8;
+  }
+
+  for (; shift < 12; shift += 4) {
+    const uint8_t nibble = (word >> shift) & 0xF;
+    if (nibble == TEMP_LOG_ESC4) break;  // The following slots are unused
+    last[channel] += (int8_t) (nibble ^ 0x8) - 0x8;  // Sign extension
+    dest[n++] = last[channel];
+    if (++channel == channels) channel = 0;
+  }
+  return n;
 }
 
 
-// [AUX] Synchronize the modifications between the cache and the actual NVM
-static inline void _db_sync(const cache_db_t *db) {
-  nvm_update(db->nvm_addr, &db->meta, sizeof(temperature_db_t));
+// [AUX] Read 'n' temperatures of a delta-compressed DB, starting from
+// 'start_id'. There must be at least 'start_id' + 'n' temperatures in the DB
+// Returns the number of temperatures read
+static temperature_id_t _delta_read(const temperature_db_t *db,
+    temperature_id_t start_id, temperature_id_t n, temperature_t *dest) {
+  const uint8_t channels = TEMP_LOG_DB_CHANNELS(db->flags);
+  temperature_log_idx_t idx = db->start;
+  temperature_id_t id = 0, got = 0;
+  temperature_t last[TEMPERATURE_CHANNELS_MAX] = { 0 };
+  temperature_t decoded[TEMP_LOG_DELTA_SLOTS];
+
+  const uint8_t resume = cursor_valid && cursor_db == db->id &&
+    cursor_id <= start_id;
+  if (resume) {
+    idx = cursor_idx;
+    id = cursor_id;
+  }
+  for (uint8_t c=0; resume && c < channels; ++c)
+    last[c] = cursor_last[c];
+
+  while (got < n && idx != log_head) {
+    cursor_idx = idx;
+    cursor_id = id;
+    for (uint8_t c=0; c < channels; ++c)
+      cursor_last[c] = last[c];
+
+    const uint8_t count = _delta_decode(_log_read(idx), last, id % channels,
+        channels, decoded);
+    for (uint8_t i=0; i < count && got < n; ++i, ++id)
+      if (id >= start_id) dest[got++] = decoded[i];
+    idx = _log_next(idx, NULL);
+  }
+
+  cursor_db = db->id;
+  cursor_valid = 1;
+  return got;
 }
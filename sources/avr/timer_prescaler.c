@@ -0,0 +1,50 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// 16-bit timers prescaler computation - Source file
+#include "timer_prescaler.h"
+#include "progmem.h"
+
+#define TIMER_TICKS_MAX 65536UL   // Ticks covered by one compare match
+#define CYCLES_PER_MSEC (F_CPU / 1000)
+
+// Prescalers, as powers of two, indexed by clock select bits
+static const uint8_t prescaler_shift[] PROGMEM = { 0, 0, 3, 6, 8, 10 };
+#define CS_MAX (sizeof(prescaler_shift) / sizeof(*prescaler_shift) - 1)
+
+
+// Get the prescaler value selected by some clock select bits (0 if stopped)
+uint16_t timer_prescaler_value(uint8_t cs) {
+  return (cs && cs <= CS_MAX) ? 1U << pgm_read_byte(prescaler_shift + cs) : 0;
+}
+
+
+// Compute the setup for a period of 'period_ms' milliseconds
+// Returns 0 on success, 1 if the period is 0
+uint8_t timer_prescaler_compute(uint32_t period_ms, timer_setup_t *setup) {
+  if (!period_ms || !setup) return 1;
+  const uint64_t cycles = (uint64_t) period_ms * CYCLES_PER_MSEC;
+
+  // Pick the finest tick covering the period with one compare match
+  uint8_t cs;
+  uint64_t ticks = 0;
+  for (cs=1; cs <= CS_MAX; ++cs) {
+    const uint8_t shift = pgm_read_byte(prescaler_shift + cs);
+    ticks = (cycles + ((1UL << shift) >> 1)) >> shift;  // Rounded
+    if (ticks <= TIMER_TICKS_MAX) break;
+  }
+
+  // Too long for a single compare match: chain the least of them with the
+  // largest prescaler, spreading the ticks evenly among them
+  uint32_t matches = 1;
+  if (cs > CS_MAX) {
+    cs = CS_MAX;
+    matches = (ticks + TIMER_TICKS_MAX - 1) / TIMER_TICKS_MAX;
+    ticks = (ticks + matches / 2) / matches;
+  }
+
+  *setup = (timer_setup_t) {
+    .cs = cs,
+    .ocr = ticks ? ticks - 1 : 0,
+    .matches = matches
+  };
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h> // memcpy
 #include <stddef.h> // offsetof
 #include "config.h"
+#include "progmem.h"
 
 
 // Stuff common to host and AVR
@@ -14,19 +15,25 @@ typedef struct _config_field_accessor_s {
 } config_field_accessor_t;
 
 // Store metadata to dynamically access configuration fields
-static const config_field_accessor_t cfg_accessors[CONFIG_FIELD_COUNT] = {
+// The table lives in the program memory, read it with the macros below
+static const config_field_accessor_t cfg_accessors[CONFIG_FIELD_COUNT]
+    PROGMEM = {
   { .size = sizeof(uint16_t), .offset = offsetof(config_t, temperature_timer_resolution) },
   { .size = sizeof(uint16_t), .offset = offsetof(config_t, temperature_timer_interval) },
+  { .size = sizeof(uint8_t), .offset = offsetof(config_t, temperature_compression) },
   { .size = sizeof(uint8_t), .offset = offsetof(config_t, lmsensor_pin) },
+  { .size = sizeof(uint8_t), .offset = offsetof(config_t, lmsensor_channels) },
   { .size = sizeof(uint8_t), .offset = offsetof(config_t, btn_debounce_time) },
   { .size = sizeof(uint8_t), .offset = offsetof(config_t, poweroff_pin) },
   { .size = sizeof(uint8_t), .offset = offsetof(config_t, start_pin) },
   { .size = sizeof(uint8_t), .offset = offsetof(config_t, stop_pin) }
 };
+#define cfg_size(field)   pgm_read_byte(&cfg_accessors[field].size)
+#define cfg_offset(field) pgm_read_byte(&cfg_accessors[field].offset)
 
 // Get the size of a single field
 uint8_t config_get_size(config_field_t field) {
-  return field >= CONFIG_FIELD_COUNT ? 0 : cfg_accessors[field].size;
+  return field >= CONFIG_FIELD_COUNT ? 0 : cfg_size(field);
 }
 
 
@@ -47,8 +54,7 @@ static void *config_raw = &config;
 uint8_t config_get(config_field_t field_id, void *dest) {
   if (!dest || field_id >= CONFIG_FIELD_COUNT)
     return 1;
-  memcpy(dest, config_raw + cfg_accessors[field_id].offset,
-      cfg_accessors[field_id].size);
+  memcpy(dest, config_raw + cfg_offset(field_id), cfg_size(field_id));
   return 0;
 }
 
@@ -57,8 +63,7 @@ uint8_t config_get(config_field_t field_id, void *dest) {
 uint8_t config_set(config_field_t field_id, const void *value) {
   if (!value || field_id >= CONFIG_FIELD_COUNT)
     return 1;
-  memcpy(config_raw + cfg_accessors[field_id].offset, value,
-      cfg_accessors[field_id].size);
+  memcpy(config_raw + cfg_offset(field_id), value, cfg_size(field_id));
   return 0;
 }
 
@@ -81,8 +86,8 @@ uint8_t config_save(void) {
 uint8_t config_save_field(config_field_t field) {
   if (field >= CONFIG_FIELD_COUNT)
     return 1;
-  nvm_update(NVM_ADDR_CONFIG + cfg_accessors[field].offset,
-      config_raw + cfg_accessors[field].offset, cfg_accessors[field].size);
+  const uint8_t offset = cfg_offset(field);
+  nvm_update(NVM_ADDR_CONFIG + offset, config_raw + offset, cfg_size(field));
   return 0;
 }
 
@@ -94,7 +99,9 @@ uint8_t config_save_field(config_field_t field) {
 static const char *_config_field_str[] = {
   "temperature_timer_resolution",
   "temperature_timer_interval",
+  "temperature_compression",
   "lmsensor_pin",
+  "lmsensor_channels",
   "btn_debounce_time",
   "poweroff_pin",
   "start_pin",
@@ -127,7 +134,7 @@ int config_field_id(const char *desc, config_field_t *dest) {
 
 // Get the offset of a single field
 uint8_t config_get_offset(config_field_t field) {
-  return field >= CONFIG_FIELD_COUNT ? 0 : cfg_accessors[field].offset;
+  return field >= CONFIG_FIELD_COUNT ? 0 : cfg_offset(field);
 }
 
 // Get the default config (i.e. the NVM image)
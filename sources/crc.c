@@ -1,39 +1,53 @@
 // AVR Temperature Monitor -- Paolo Lucchesi
 // Cyclic Redundancy Checksum - Source file
+// Every CRC is table-driven. The AVR keeps a single table for each algorithm
+// in the program memory, while the host processes the wide CRC 8 bytes at a
+// time with 8 tables (i.e. slicing-by-8), or with the SSE4.2 'crc32'
+// instruction for CRC-32C if the CPU supports it
 #include "crc.h"
+#include "progmem.h"
 
-// Lookup table for the default CRC-8 polynomial (bottom of this source file)
-#if CRC_POLY == 0x07 && CRC_INIT == 0x00
-static const uint8_t crc8_table_0x07[];
+#define CRC_TABLE_ATTR PROGMEM
+#define crc8_lookup(i) pgm_read_byte(crc8_table + (i))
+#if CRC_WIDE == 16
+#define crc_wide_lookup(s, i) pgm_read_word(crc16_table[s] + (i))
+#else
+#define crc_wide_lookup(s, i) pgm_read_dword(crc32c_table[s] + (i))
+#endif
+
+#if defined(AVR) && !defined(TEST)
+#define CRC_TABLE_SLICES 1
+#else
+#define CRC_TABLE_SLICES 8
 #endif
 
+#include "crc_tables.h"
+
+// [AUX] Run a wide CRC over a chunk of data, from a given register value
+static crc_wide_t _crc_wide_run(crc_wide_t reg, const uint8_t *data,
+    size_t size);
+
 
 // Execute one round of the division by the polynomial of the CRC algorithm
-// Use a lookup table for XOR divisions if the polynomial is the default one
 static inline crc_t crc_division_round(crc_t current_crc, uint8_t byte) {
-  crc_t _crc = current_crc ^ byte;    // Consider the given byte
-#if CRC_POLY == 0x07 && CRC_INIT == 0x00
-  _crc = crc8_table_0x07[_crc];       // Optimized computation for default poly
-#else
-  for (uint8_t k=0; k < 8; ++k) {     // For each bit
-    if (_crc & 0x80)                  // Test if MSB is set
-      _crc = (_crc << 1) ^ CRC_POLY;  // If yes, do the division
-    else _crc <<= 1;                  // Else, skip the iteration
-  }
-#endif
-  return _crc;
+  return crc8_lookup(current_crc ^ byte);
+}
+
+// Same as above, for the (reflected) wide CRC
+static inline crc_wide_t crc_wide_division_round(crc_wide_t current_crc,
+    uint8_t byte) {
+  return crc_wide_lookup(0, (current_crc ^ byte) & 0xFF) ^ (current_crc >> 8);
 }
 
 
 // Compute the CRC
-// 'size' is a byte, since the CRC will be used for packets (no need for size_t)
-crc_t crc(const void *data, uint8_t size) {
+crc_t crc(const void *data, size_t size) {
   if (!data) return (crc_t) 0;
 
   const uint8_t *_data = (const uint8_t*) data;
   register crc_t crc = CRC_INIT;
 
-  for (uint8_t i=0; i < size; ++i)
+  for (size_t i=0; i < size; ++i)
     crc = crc_division_round(crc, _data[i]);
 
   return crc;
@@ -46,40 +60,133 @@ crc_t crc(const void *data, uint8_t size) {
 // a detectable error).
 // Returns the remainder of the division, but it can be safely converted to a
 // smaller data type if only knowing if the message is corrupted is relevant
-crc_t crc_check(const void *data, uint8_t size) {
+crc_t crc_check(const void *data, size_t size) {
   if (!data) return ~((crc_t) 0);
 
   const uint8_t *_data = (const uint8_t*) data;
-  crc_t div_result = 0x00;
-  for (uint8_t i=0; i < size; ++i)
+  crc_t div_result = CRC_INIT;
+  for (size_t i=0; i < size; ++i)
     div_result = crc_division_round(div_result, _data[i]);
 
-  return div_result;
+  return div_result ^ CRC_RESIDUE;
+}
+
+
+// Update a running CRC with a single byte
+crc_t crc_update(crc_t current_crc, uint8_t byte) {
+  return crc_division_round(current_crc, byte);
+}
+
+
+// Compute the wide CRC
+crc_wide_t crc_wide(const void *data, size_t size) {
+  if (!data) return (crc_wide_t) 0;
+  return _crc_wide_run(CRC_WIDE_INIT, data, size) ^ CRC_WIDE_XOROUT;
+}
+
+// Check a chunk of data with a trailing wide CRC
+// Returns 0 if the data is not corrupted
+crc_wide_t crc_wide_check(const void *data, size_t size) {
+  if (!data) return ~((crc_wide_t) 0);
+  return _crc_wide_run(CRC_WIDE_INIT, data, size) ^ CRC_WIDE_RESIDUE;
+}
+
+// Update a running wide CRC with a single byte
+crc_wide_t crc_wide_update(crc_wide_t current_crc, uint8_t byte) {
+  return crc_wide_division_round(current_crc, byte);
+}
+
+// Locate a single flipped bit, given the syndrome of the message
+// The syndrome of a flipped bit is the remainder of the division of the error
+// alone, i.e. a single set bit followed by as many zero bits as there are
+// after it: the bits are walked backwards, shifting one more zero bit each time
+int32_t crc_wide_locate(crc_wide_t syndrome, size_t size) {
+  if (!syndrome) return -1;
+  const int32_t bits = 8 * (int32_t) size;
+  crc_wide_t reg = 1;
+  for (int32_t i = bits - 1; i >= 0; --i) {
+    reg = (reg & 1) ? (reg >> 1) ^ CRC_WIDE_POLY : reg >> 1;
+    if (reg == syndrome) return i;
+  }
+  return -1;
 }
 
 
-// Lookup table for the default CRC-8 polynomial
-#if CRC_POLY == 0x07 && CRC_INIT == 0x00
-static const crc_t crc8_table_0x07[] = {
-  0X00, 0X07, 0X0E, 0X09, 0X1C, 0X1B, 0X12, 0X15, 0X38, 0X3F, 0X36, 0X31, 0X24,
-  0X23, 0X2A, 0X2D, 0X70, 0X77, 0X7E, 0X79, 0X6C, 0X6B, 0X62, 0X65, 0X48, 0X4F,
-  0X46, 0X41, 0X54, 0X53, 0X5A, 0X5D, 0XE0, 0XE7, 0XEE, 0XE9, 0XFC, 0XFB, 0XF2,
-  0XF5, 0XD8, 0XDF, 0XD6, 0XD1, 0XC4, 0XC3, 0XCA, 0XCD, 0X90, 0X97, 0X9E, 0X99,
-  0X8C, 0X8B, 0X82, 0X85, 0XA8, 0XAF, 0XA6, 0XA1, 0XB4, 0XB3, 0XBA, 0XBD, 0XC7,
-  0XC0, 0XC9, 0XCE, 0XDB, 0XDC, 0XD5, 0XD2, 0XFF, 0XF8, 0XF1, 0XF6, 0XE3, 0XE4,
-  0XED, 0XEA, 0XB7, 0XB0, 0XB9, 0XBE, 0XAB, 0XAC, 0XA5, 0XA2, 0X8F, 0X88, 0X81,
-  0X86, 0X93, 0X94, 0X9D, 0X9A, 0X27, 0X20, 0X29, 0X2E, 0X3B, 0X3C, 0X35, 0X32,
-  0X1F, 0X18, 0X11, 0X16, 0X03, 0X04, 0X0D, 0X0A, 0X57, 0X50, 0X59, 0X5E, 0X4B,
-  0X4C, 0X45, 0X42, 0X6F, 0X68, 0X61, 0X66, 0X73, 0X74, 0X7D, 0X7A, 0X89, 0X8E,
-  0X87, 0X80, 0X95, 0X92, 0X9B, 0X9C, 0XB1, 0XB6, 0XBF, 0XB8, 0XAD, 0XAA, 0XA3,
-  0XA4, 0XF9, 0XFE, 0XF7, 0XF0, 0XE5, 0XE2, 0XEB, 0XEC, 0XC1, 0XC6, 0XCF, 0XC8,
-  0XDD, 0XDA, 0XD3, 0XD4, 0X69, 0X6E, 0X67, 0X60, 0X75, 0X72, 0X7B, 0X7C, 0X51,
-  0X56, 0X5F, 0X58, 0X4D, 0X4A, 0X43, 0X44, 0X19, 0X1E, 0X17, 0X10, 0X05, 0X02,
-  0X0B, 0X0C, 0X21, 0X26, 0X2F, 0X28, 0X3D, 0X3A, 0X33, 0X34, 0X4E, 0X49, 0X40,
-  0X47, 0X52, 0X55, 0X5C, 0X5B, 0X76, 0X71, 0X78, 0X7F, 0X6A, 0X6D, 0X64, 0X63,
-  0X3E, 0X39, 0X30, 0X37, 0X22, 0X25, 0X2C, 0X2B, 0X06, 0X01, 0X08, 0X0F, 0X1A,
-  0X1D, 0X14, 0X13, 0XAE, 0XA9, 0XA0, 0XA7, 0XB2, 0XB5, 0XBC, 0XBB, 0X96, 0X91,
-  0X98, 0X9F, 0X8A, 0X8D, 0X84, 0X83, 0XDE, 0XD9, 0XD0, 0XD7, 0XC2, 0XC5, 0XCC,
-  0XCB, 0XE6, 0XE1, 0XE8, 0XEF, 0XFA, 0XFD, 0XF4, 0XF3
-};
+
+#if defined(AVR) && !defined(TEST)
+
+// [AUX] Run a wide CRC over a chunk of data, one byte at a time
+static crc_wide_t _crc_wide_run(crc_wide_t reg, const uint8_t *data,
+    size_t size) {
+  for (size_t i=0; i < size; ++i)
+    reg = crc_wide_division_round(reg, data[i]);
+  return reg;
+}
+
+
+#else  // Host
+
+#if CRC_WIDE == 32 && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC_SSE42
+
+// [AUX] Run CRC-32C with the SSE4.2 'crc32' instruction
+__attribute__((target("sse4.2")))
+static crc_wide_t _crc_wide_run_sse42(crc_wide_t reg, const uint8_t *data,
+    size_t size) {
+  uint64_t reg64 = reg;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    __builtin_memcpy(&word, data, 8);  // Unaligned access
+    reg64 = _mm_crc32_u64(reg64, word);
+  }
+  reg = reg64;
+  for (; size; --size)
+    reg = _mm_crc32_u8(reg, *data++);
+  return reg;
+}
+#endif
+
+
+// [AUX] Run the wide CRC with slicing-by-8: the register is folded with the
+// next 8 bytes at once, each of them looked up in its own table slice
+static crc_wide_t _crc_wide_run_sliced(crc_wide_t reg, const uint8_t *data,
+    size_t size) {
+  uint32_t r = reg;
+  for (; size >= 8; size -= 8, data += 8) {
+    r ^= data[0] | (data[1] << 8) | ((uint32_t) data[2] << 16) |
+      ((uint32_t) data[3] << 24);
+    r = crc_wide_lookup(7, r & 0xFF) ^ crc_wide_lookup(6, (r >> 8) & 0xFF) ^
+      crc_wide_lookup(5, (r >> 16) & 0xFF) ^ crc_wide_lookup(4, r >> 24) ^
+      crc_wide_lookup(3, data[4]) ^ crc_wide_lookup(2, data[5]) ^
+      crc_wide_lookup(1, data[6]) ^ crc_wide_lookup(0, data[7]);
+  }
+  reg = r;
+  for (; size; --size)
+    reg = crc_wide_division_round(reg, *data++);
+  return reg;
+}
+
+
+// [AUX] Run the wide CRC with the fastest kernel available
+static crc_wide_t _crc_wide_run(crc_wide_t reg, const uint8_t *data,
+    size_t size) {
+#ifdef CRC_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    return _crc_wide_run_sse42(reg, data, size);
+#endif
+  return _crc_wide_run_sliced(reg, data, size);
+}
+
+#endif  // AVR/Host
+
+
+// Name of the kernel computing the wide CRC in bulk
+#if defined(TEST) || !defined(AVR)
+const char *crc_wide_kernel(void) {
+#ifdef CRC_SSE42
+  if (__builtin_cpu_supports("sse4.2")) return "SSE4.2 crc32";
+#endif
+  return "slicing-by-8";
+}
 #endif
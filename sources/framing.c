@@ -0,0 +1,56 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Packet framing (COBS) - Source file
+// COBS replaces each zero byte with the distance to the next one (or to the
+// end of the data), and puts the distance to the first one in front of it
+#include <stddef.h>
+#include "framing.h"
+
+
+// Encode a chunk of data into a frame, delimiter included
+// Working backwards, each byte is read before its slot is overwritten, so the
+// data can be encoded in place
+uint8_t framing_encode(uint8_t *dest, const uint8_t *src, uint8_t size) {
+  if (!dest || !src || size >= 0xFE) return 0;
+
+  uint8_t next_zero = size;  // Virtual zero at the end of the data
+  dest[size + 1] = FRAMING_DELIMITER;
+  for (uint8_t i = size; i > 0; --i) {
+    const uint8_t byte = src[i-1];
+    if (byte) dest[i] = byte;
+    else {
+      dest[i] = next_zero - (i-1);
+      next_zero = i-1;
+    }
+  }
+  dest[0] = next_zero + 1;
+
+  return size + 2;  // Code byte and delimiter
+}
+
+
+// Reset a decoder
+void framing_decoder_reset(framing_decoder_t *d) {
+  d->code = 0;
+  d->left = 0;
+}
+
+
+// Decode a single received byte
+int16_t framing_decode(framing_decoder_t *d, uint8_t byte) {
+  if (byte == FRAMING_DELIMITER) {
+    framing_decoder_reset(d);
+    return FRAMING_END;
+  }
+
+  if (d->left) {  // Data byte
+    --d->left;
+    return byte;
+  }
+
+  // Code byte: it stands for a zero, unless it is the first one of the frame
+  // or it follows a full block (i.e. 254 bytes, with no zero in between)
+  const uint8_t prev_code = d->code;
+  d->code = byte;
+  d->left = byte - 1;
+  return (prev_code && prev_code != 0xFF) ? 0 : FRAMING_NONE;
+}
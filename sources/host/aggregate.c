@@ -0,0 +1,200 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperature aggregation - Source file
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "aggregate.h"
+#include "debug.h"
+
+// Number of independent accumulators used by the kernel
+// Lanes have no dependencies on each other, so the compiler can vectorize them
+#define AGGREGATE_LANES 8
+
+
+// Aggregate 'count' temperatures in a single pass
+aggregate_t aggregate_kernel(const float *items, unsigned count) {
+  if (!items || !count) return (aggregate_t) { 0 };
+
+  float lmin[AGGREGATE_LANES], lmax[AGGREGATE_LANES], lsum[AGGREGATE_LANES];
+  for (unsigned l=0; l < AGGREGATE_LANES; ++l) {
+    lmin[l] = lmax[l] = items[0];
+    lsum[l] = 0;
+  }
+
+  // Main loop, on blocks of AGGREGATE_LANES temperatures
+  unsigned i;
+  for (i=0; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES)
+    for (unsigned l=0; l < AGGREGATE_LANES; ++l) {
+      const float t = items[i + l];
+      lmin[l] = t < lmin[l] ? t : lmin[l];
+      lmax[l] = t > lmax[l] ? t : lmax[l];
+      lsum[l] += t;
+    }
+
+  // Remaining temperatures
+  for (unsigned l=0; i < count; ++i, ++l) {
+    const float t = items[i];
+    lmin[l] = t < lmin[l] ? t : lmin[l];
+    lmax[l] = t > lmax[l] ? t : lmax[l];
+    lsum[l] += t;
+  }
+
+  // Reduce the lanes
+  aggregate_t agg = { .count = count, .min = lmin[0], .max = lmax[0] };
+  double sum = 0;
+  for (unsigned l=0; l < AGGREGATE_LANES; ++l) {
+    agg.min = lmin[l] < agg.min ? lmin[l] : agg.min;
+    agg.max = lmax[l] > agg.max ? lmax[l] : agg.max;
+    sum += lsum[l];
+  }
+  agg.mean = sum / count;
+  return agg;
+}
+
+
+// Aggregate a database in consecutive windows of 'window' seconds
+// Returns 0 on success, 1 otherwise
+int aggregate_db(const temperature_db_t *db, unsigned window,
+    aggregate_db_t *dest) {
+  if (!db || !dest || !window) return 1;
+  *dest = (aggregate_db_t) { .db = db };
+  if (db->used == 0) return 0;
+
+  const unsigned period = temperature_db_period(db);
+  unsigned long long per_bucket = (unsigned long long) window * 1000 / period;
+  if (per_bucket == 0) per_bucket = 1;
+  if (per_bucket > db->used) per_bucket = db->used;
+
+  const unsigned nbuckets = (db->used + per_bucket - 1) / per_bucket;
+  dest->buckets = malloc(nbuckets * sizeof(aggregate_t));
+  err_check(!dest->buckets, 1, "Unable to use the memory allocator");
+  dest->nbuckets = nbuckets;
+
+  for (unsigned b=0; b < nbuckets; ++b) {
+    const unsigned first = b * per_bucket;
+    const unsigned count = (db->used - first < per_bucket) ?
+      db->used - first : per_bucket;
+    dest->buckets[b] = aggregate_kernel(db->items + first, count);
+    dest->buckets[b].start = db->anchor +
+      (unsigned long long) first * period / 1000;
+  }
+  return 0;
+}
+
+
+// [AUX] Aggregation jobs shared by the workers, each one pulling the index of
+// the next database to aggregate
+typedef struct _aggregate_pool_s {
+  temperature_db_t **dbs;
+  unsigned ndbs;
+  unsigned window;
+  aggregate_db_t *dest;
+  unsigned next;  // Index of the next database, incremented atomically
+  int ret;        // Failures are OR-ed atomically
+} aggregate_pool_t;
+
+static void *_aggregate_worker(void *_pool) {
+  aggregate_pool_t *pool = _pool;
+  for (unsigned i; (i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED))
+      < pool->ndbs; )
+    if (aggregate_db(pool->dbs[i], pool->window, pool->dest + i) != 0)
+      __atomic_fetch_or(&pool->ret, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+
+// Aggregate many databases in parallel, on a pool of at most as many threads
+// as the online CPUs
+// Returns 0 on success, 1 if the aggregation of at least one database failed
+int aggregate_db_parallel(temperature_db_t **dbs, unsigned ndbs,
+    unsigned window, aggregate_db_t *dest) {
+  if (!dbs || !dest) return 1;
+  aggregate_pool_t pool = {
+    .dbs = dbs, .ndbs = ndbs, .window = window, .dest = dest
+  };
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned nworkers = (ncpus > 0) ? ncpus : 1;
+  if (nworkers > ndbs) nworkers = ndbs;
+
+  // The calling thread is a worker too, so the pool always makes progress
+  // even if no thread can be started
+  pthread_t *workers = NULL;
+  unsigned started = 0;
+  if (nworkers > 1) {
+    workers = malloc((nworkers - 1) * sizeof(pthread_t));
+    err_check(!workers, 1, "Unable to use the memory allocator");
+    for (; started < nworkers - 1; ++started)
+      if (pthread_create(workers + started, NULL, _aggregate_worker, &pool))
+        break;
+  }
+
+  _aggregate_worker(&pool);
+  for (unsigned i=0; i < started; ++i)
+    pthread_join(workers[i], NULL);
+
+  free(workers);
+  return pool.ret ? 1 : 0;
+}
+
+
+// Free the buckets of an aggregated database
+void aggregate_db_clear(aggregate_db_t *agg) {
+  if (!agg) return;
+  free(agg->buckets);
+  agg->buckets = NULL;
+  agg->nbuckets = 0;
+}
+
+
+// Export an aggregated database as a text file, one bucket per line
+// Returns 0 on success, 1 otherwise
+int aggregate_db_export(const aggregate_db_t *agg, const char *fpath) {
+  if (!agg || !agg->db || !fpath) return 1;
+
+  FILE *out = fopen(fpath, "w");
+  if (!out) {
+    perror("Couldn't open output file in 'aggregate_db_export'");
+    return 1;
+  }
+
+  if (!agg->db->desc)
+    fprintf(out, "Database %u\n", agg->db->id);
+  else fprintf(out, "%s\n", agg->db->desc);
+
+  for (unsigned b=0; b < agg->nbuckets; ++b) {
+    const aggregate_t *a = agg->buckets + b;
+    fprintf(out, "%lld %.1f %.2f %.1f %u\n",
+        (long long) (a->start - agg->db->anchor), a->min, a->mean, a->max,
+        a->count);
+  }
+
+  return fclose(out) == 0 ? 0 : 1;
+}
+
+
+// Parse a window size, in seconds or with a suffix among 's', 'm', 'h', 'd'
+// Returns 0 on success, 1 otherwise
+int aggregate_window_parse(const char *str, unsigned *window) {
+  if (!str || !window || *str == '\0') return 1;
+  char *endptr;
+  unsigned long val = strtoul(str, &endptr, 10);
+  if (endptr == str) return 1;
+
+  switch (*endptr) {
+    case '\0':
+    case 's': break;
+    case 'm': val *= 60; break;
+    case 'h': val *= 60 * 60; break;
+    case 'd': val *= 60 * 60 * 24; break;
+    default: return 1;
+  }
+  if (*endptr != '\0' && endptr[1] != '\0') return 1;
+  if (val == 0 || val > (unsigned) -1) return 1;
+
+  *window = val;
+  return 0;
+}
@@ -3,92 +3,213 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
-#include <signal.h>
+#include <errno.h>
 
 #include "communication.h"
 #include "serial.h"
 #include "debug.h"
 #include "packet.h"
+#include "framing.h"
 
 
 #define ONE_MSEC 1000000 // One millisecond in nanoseconds
+#define ONE_SEC 1000000000 // One second in nanoseconds
 
-// Timer entity, i.e. a data structure containing everything related to a timer
-typedef struct _timer_entity_s {
-  struct sigevent   sig_ev;
-  struct sigaction  sig_act, sig_act_old;
-  struct itimerspec timeval;
-  timer_t id;
-  volatile unsigned char elapsed;
-  volatile unsigned char ongoing;
-} timer_entity_t;
+// RTO functions -- Source at the bottom of this source file
+static void rto_timer_start(serial_context_t *ctx);
+static int  rto_timer_elapsed(const serial_context_t *ctx);
+#if !COBS_FRAMING
+static void rto_timer_wait(const serial_context_t *ctx);
+#endif
 
 
-// The RTO timer itself
-static timer_entity_t rto_timer;
-
-// Timer functions -- Source at the bottom of this source file
-static inline int  rto_timer_init(void);
-static inline void rto_timer_destroy(void);
-static void rto_timer_start(void);
-static void rto_timer_stop(void);
+// Estabilish a connection, sending a handshake (HND) packet
+// The wide CRC is offered first: a tmon which cannot check it never ACKs the
+// handshake, which is then sent again with CRC-8
+// Return 0 on success, 1 on failure
+int communication_connect(serial_context_t *ctx) {
+  if (!ctx) return 1;
+  ctx->com.packet_id = 0;
+  ctx->com.crc_flag = PACKET_CRC_WIDE;
+  ctx->com.ack_deferred = 0;
+  ctx->com.rx_stashed = 0;
+  if (communication_craft_and_send(ctx, PACKET_TYPE_HND, NULL, 0) == 0)
+    return 0;
+
+  debug err_log("Wide CRC refused, falling back to %s", CRC_NAME);
+  ctx->com.packet_id = 0;
+  ctx->com.crc_flag = 0;
+  return (communication_craft_and_send(ctx, PACKET_TYPE_HND, NULL, 0) != 0) ? 1 : 0;
+}
 
 
-// Keep track of the current expected packet ID
-static unsigned char packet_global_id;
+// [AUX] Send a packet on the serial port, framing it if needed
+static void _tx_packet(serial_context_t *ctx, const packet_t *p) {
+  const unsigned char size = packet_get_size(p);
+#if COBS_FRAMING
+  unsigned char frame[sizeof(packet_t) + FRAMING_OVERHEAD];
+  serial_tx(ctx, frame, framing_encode(frame, (const uint8_t*) p, size));
+#else
+  serial_tx(ctx, p, size);
+#endif
+}
 
 
-// Initialize the communication module -- In practice, init the RTO timer
-int communication_init(void) {
-  return rto_timer_init();
+// [AUX] Tell if a packet has not the expected ID. With cumulative ACKs, the ID
+// is checked by the callers, as the packet could be sent again or be the reply
+// carrying the ACK of the packet sent
+static inline int _id_mismatch(const serial_context_t *ctx, const packet_t *p) {
+  return PACKET_ACK_WINDOW == 1 && packet_get_id(p) != ctx->com.packet_id;
 }
 
-// Cleanup for an initialized communication module
-void communication_cleanup(void) {
-  rto_timer_destroy();
-}
 
-// Estabilish a connection, sending a handshake (HND) packet
-// Return 0 on success, 1 on failure
-int communication_connect(serial_context_t *ctx) {
-  packet_global_id = 0;
-  return (communication_craft_and_send(ctx, PACKET_TYPE_HND, NULL, 0) != 0) ? 1 : 0;
+// [AUX] Check a packet which is over, given the bytes received and the outcome
+// so far (i.e. E_CORRUPTED_HEADER if the header is corrupted). With FEC, a
+// corrupted packet is corrected if possible
+// Return an appropriate error code (E_SUCCESS on success)
+static unsigned char _recv_check(serial_context_t *ctx, packet_t *p,
+    unsigned char received, unsigned char ret) {
+  if (ret == E_SUCCESS && packet_check_crc(p) != 0)
+    ret = E_CORRUPTED_CHECKSUM;
+  if (PACKET_FEC && ret != E_SUCCESS && packet_correct(p, received) == 0)
+    ret = E_SUCCESS;
+  if (ret == E_SUCCESS && _id_mismatch(ctx, p))
+    ret = E_ID_MISMATCH;
+  return ret;
 }
 
 
+#if COBS_FRAMING
+// Attempt to receive a packet, i.e. a whole frame up to its delimiter
+// After an error, the rest of the frame is skipped, so that the next attempt
+// begins with the next frame
+// Return an appropriate error code (E_SUCCESS on success)
+static unsigned char _recv_attempt(serial_context_t *ctx, packet_t *p) {
+  static const struct timespec poll_tm = { 0, ONE_MSEC * 2 };
+  unsigned char *p_raw = (unsigned char*) p;
+  unsigned char c, received=0, started=0, header_bad=0, ret=E_SUCCESS;
+  framing_decoder_t decoder[1];
+  framing_decoder_reset(decoder);
+
+  while (1) {
+    if (rto_timer_elapsed(ctx)) return E_TIMEOUT_ELAPSED;
+    if (!serial_rx_getchar(ctx, &c)) {
+      nanosleep(&poll_tm, NULL); // Wait a while for characters
+      continue;
+    }
+
+    const int decoded = framing_decode(decoder, c);
+    if (decoded == FRAMING_END) {
+      if (!started) continue;  // No frame yet, e.g. line noise
+      if (ret != E_SUCCESS) return ret;  // Already discarded
+      if (received < PACKET_HEADER_SIZE || header_bad)
+        ret = E_CORRUPTED_HEADER;
+      else if (received != packet_get_size(p))
+        ret = E_CORRUPTED_CHECKSUM;
+      return _recv_check(ctx, p, received, ret);
+    }
+
+    started = 1;
+    if (decoded == FRAMING_NONE || ret != E_SUCCESS) continue;
+    if (received == sizeof(packet_t)) {  // Too long, i.e. delimiter lost
+      ret = E_CORRUPTED_CHECKSUM;
+      continue;
+    }
+
+    // Early fail on mismatching ID or corrupted header, unless they could be
+    // corrected at the end of the frame
+    p_raw[received++] = decoded;
+    if (received == 1 && !PACKET_FEC && _id_mismatch(ctx, p))
+      ret = E_ID_MISMATCH;
+    else if (received == PACKET_HEADER_SIZE && packet_check_header(p) != 0) {
+      if (PACKET_FEC) header_bad = 1;
+      else ret = E_CORRUPTED_HEADER;
+    }
+  }
+}
+
+#else
 // Attempt to receive a packet
 // Return an appropriate error code (E_SUCCESS on success)
 static unsigned char _recv_attempt(serial_context_t *ctx, packet_t *p) {
   static const struct timespec poll_tm = { 0, ONE_MSEC * 2 };
   unsigned char *p_raw = (unsigned char*) p;
-  unsigned char id, size=0, received=0;
+  unsigned char size=0, received=0, header_bad=0;
 
   while (1) {
-    if (rto_timer.elapsed) return E_TIMEOUT_ELAPSED;
+    if (rto_timer_elapsed(ctx)) return E_TIMEOUT_ELAPSED;
 
     if (!serial_rx_getchar(ctx, p_raw + received))
       nanosleep(&poll_tm, NULL); // Wait a while for characters
     else switch (++received) { // Received i-th byte
 
       case 1:
-        // Early fail on mismatching ID
-        id = packet_get_id(p);
-        if (id != packet_global_id) return E_ID_MISMATCH;
+        // Early fail on mismatching ID, unless it could be corrected later on
+        if (!PACKET_FEC && _id_mismatch(ctx, p))
+          return E_ID_MISMATCH;
         break;
 
       case 2:
-        // Check packet header integrity
-        if (packet_check_header(p) != 0) return E_CORRUPTED_HEADER;
+        // Check packet header integrity. With FEC, a corrupted header is
+        // corrected along with the rest of the packet if its size is plausible
         size = packet_get_size(p);
+        header_bad = packet_check_header(p) != 0;
+        if (header_bad && (!PACKET_FEC || size < PACKET_MIN_SIZE))
+          return E_CORRUPTED_HEADER;
         break;
 
       default:
         if (received >= size) // Last byte
-          return (packet_check_crc(p) != 0) ? E_CORRUPTED_CHECKSUM : E_SUCCESS;
+          return _recv_check(ctx, p, received,
+              header_bad ? E_CORRUPTED_HEADER : E_SUCCESS);
         break;
     }
   }
 }
+#endif  // COBS_FRAMING
+
+
+// [AUX] Accept a received packet, acknowledging it at once or, if it is a BLK
+// one, along with the following ones up to a whole window
+static void _recv_accept(serial_context_t *ctx, const packet_t *p) {
+  ctx->com.packet_id = packet_next_id(ctx->com.packet_id);
+  if (packet_get_type(p) == PACKET_TYPE_BLK &&
+      ++ctx->com.ack_deferred < PACKET_ACK_WINDOW)
+    return;
+
+  packet_t ack[1];
+  packet_ack(p, ack);  // Cumulative, i.e. for the previous ones too
+  _tx_packet(ctx, ack);
+  ctx->com.ack_deferred = 0;
+}
+
+// [AUX] Handle a sane packet which is not the expected one: a packet sent
+// again, as its cumulative ACK was lost, is acknowledged again, while a packet
+// following a lost one (which the tmon sends again) and late ACK and ERR
+// packets are just dropped
+static void _recv_unexpected(serial_context_t *ctx, const packet_t *p) {
+  const unsigned char behind = packet_id_distance(packet_get_id(p),
+      ctx->com.packet_id);
+  if (!packet_brings_data(p) || behind == 0 || behind > PACKET_ACK_WINDOW)
+    return;
+
+  packet_t ack[1];
+  packet_craft(packet_prev_id(ctx->com.packet_id), PACKET_TYPE_ACK |
+      packet_crc_wide(p), NULL, 0, ack);
+  _tx_packet(ctx, ack);
+  ctx->com.ack_deferred = 0;
+}
+
+
+// [AUX] Tell if a response acknowledges the packet sent, i.e. it is its ACK or,
+// with cumulative ACKs, the reply to it, whose ID follows its own
+static int _send_acked(const serial_context_t *ctx, const packet_t *r) {
+  const unsigned char id = packet_get_id(r);
+  if (packet_get_type(r) == PACKET_TYPE_ACK)
+    return id == ctx->com.packet_id;
+  return PACKET_ACK_WINDOW > 1 && packet_brings_data(r) &&
+    id == packet_next_id(ctx->com.packet_id);
+}
 
 
 // Send a packet
@@ -108,14 +229,14 @@ int communication_send(serial_context_t *ctx, const packet_t *p) {
   serial_rx_flush(ctx);
 
   for (uint8_t attempt=0; attempt < MAXIMUM_SEND_ATTEMPTS; ++attempt) {
-    rto_timer_start();
+    rto_timer_start(ctx);
 
     // Blindly send the packet on the serial port
-    serial_tx(ctx, p, size);
+    _tx_packet(ctx, p);
 
     // Attempt to receive ACK/ERR
-    // Assertion on ACK/ERR id is made inside the receive attempt function
-    // If any packet different from an ACK one is received, take it as a failure
+    // If any packet different from its ACK (or the reply carrying it, with
+    // cumulative ACKs) is received, take it as a failure
     packet_t response[1];
     uint8_t ret = _recv_attempt(ctx, response);
     debug err_log("_recv_attempt() returned %hhd", ret);
@@ -129,21 +250,27 @@ int communication_send(serial_context_t *ctx, const packet_t *p) {
       }
     }
 
-    if (ret == E_SUCCESS && packet_get_type(response) == PACKET_TYPE_ACK) {
-      rto_timer_stop();
-      packet_global_id = packet_next_id(packet_global_id);
+    if (ret == E_SUCCESS && _send_acked(ctx, response)) {
+      ctx->com.packet_id = packet_next_id(ctx->com.packet_id);
       debug err_log("Packet succesfully sent");
+      if (packet_get_type(response) != PACKET_TYPE_ACK) {  // Reply
+        _recv_accept(ctx, response);
+        ctx->com.rx_stash = *response;
+        ctx->com.rx_stashed = 1;
+      }
       return 0;
     }
 
     // Could not receive a consistent response
+    // Wait for the tmon to give up the frame, unless frames are delimited
+#if !COBS_FRAMING
     else if (ret != E_TIMEOUT_ELAPSED)
-      while (!rto_timer.elapsed)
-        pause();
+      rto_timer_wait(ctx);
+#endif
   }
 
   debug err_log("Too many consecutive failures");
-  packet_global_id = 0;
+  ctx->com.packet_id = 0;
   return 1;
 }
 
@@ -155,18 +282,29 @@ int communication_recv(serial_context_t *ctx, packet_t *p) {
   if (!ctx || !p) return 1;
   packet_t response[1];
 
-  for (unsigned char attempt=0; attempt < MAXIMUM_RECV_ATTEMPTS; ++attempt) {
-    rto_timer_start();
+  if (ctx->com.rx_stashed) {  // Received already, carrying an ACK
+    *p = ctx->com.rx_stash;
+    ctx->com.rx_stashed = 0;
+    return 0;
+  }
+
+  for (unsigned char attempt=0; attempt < MAXIMUM_RECV_ATTEMPTS; ) {
+    rto_timer_start(ctx);
     unsigned char ret = _recv_attempt(ctx, p);
     debug err_log("_recv_attempt() returned %hhd", ret);
 
+    // No attempt is spent on unexpected packets, as a whole window of them
+    // could come after a lost one
+    if (ret == E_SUCCESS && (packet_get_id(p) != ctx->com.packet_id ||
+          !packet_brings_data(p))) {
+      _recv_unexpected(ctx, p);
+      continue;
+    }
+
     switch (ret) {
 
       case E_SUCCESS:
-        packet_ack(p, response);
-        serial_tx(ctx, response, PACKET_MIN_SIZE);
-        rto_timer_stop();
-        packet_global_id = packet_next_id(packet_global_id);
+        _recv_accept(ctx, p);
         debug {
           err_log("Packet received successfully");
           packet_print(p);
@@ -179,20 +317,24 @@ int communication_recv(serial_context_t *ctx, packet_t *p) {
 
       case E_ID_MISMATCH:
       case E_CORRUPTED_HEADER:
-      case E_CORRUPTED_CHECKSUM:
-        packet_err(p, response);
-        serial_tx(ctx, response, PACKET_MIN_SIZE);
-        while (!rto_timer.elapsed)
-          pause();
+      case E_CORRUPTED_CHECKSUM:  // Ask for the packets from the expected one on
+        packet_craft(ctx->com.packet_id, PACKET_TYPE_ERR | ctx->com.crc_flag,
+            NULL, 0, response);
+        _tx_packet(ctx, response);
+#if !COBS_FRAMING
+        rto_timer_wait(ctx);  // Discarding the packets following the bad one
+        serial_rx_flush(ctx);
+#endif
         debug err_log("Attempt %d failed: corrupted packet", attempt + 1);
         break;
 
       default: break;
     }
+    ++attempt;
   }
 
   debug err_log("Too many consecutive failures");
-  packet_global_id = 0;
+  ctx->com.packet_id = 0;
   return 1;
 }
 
@@ -203,7 +345,8 @@ int communication_recv(serial_context_t *ctx, packet_t *p) {
 int communication_craft_and_send(serial_context_t *ctx, unsigned char type,
     const unsigned char *data, unsigned char data_size) {
   packet_t p[1];
-  if (packet_craft(packet_global_id, type, data, data_size, p) != 0)
+  if (!ctx || packet_craft(ctx->com.packet_id, type | ctx->com.crc_flag, data,
+        data_size, p) != 0)
     return 1;
   return communication_send(ctx, p);
 }
@@ -214,10 +357,11 @@ int communication_craft_and_send(serial_context_t *ctx, unsigned char type,
 int communication_cmd(serial_context_t *ctx, command_id_t cmd,
     const void *arg, unsigned arg_size) {
   if (!ctx || cmd >= COMMAND_COUNT || (arg && !arg_size) || (!arg && arg_size)
-      || arg_size > PACKET_DATA_MAX_SIZE - sizeof(command_id_t))
+      || arg_size > packet_data_max_size(ctx->com.crc_flag) -
+      sizeof(command_id_t))
     return 1;
 
-  unsigned char _payload[PACKET_DATA_MAX_SIZE];
+  unsigned char _payload[PACKET_JUMBO_DATA_MAX_SIZE];
   command_payload_t *payload = (command_payload_t*) _payload;
 
   payload->id = cmd;
@@ -229,69 +373,34 @@ int communication_cmd(serial_context_t *ctx, command_id_t cmd,
 
 
 
-// Timer interface implementation
-// This part of the communication module uses a POSIX per-process timer, thus
-// it is not reentrant
+// RTO interface implementation
+// The RTO is an absolute deadline on the monotonic clock, stored in the serial
+// context of each connection. Differently from a per-process POSIX timer and
+// its signal, this lets different threads drive different connections
 
-// RTO Signal handler
-static void rto_sig_handler(int sig) {
-  rto_timer.elapsed = 1;
-  rto_timer.ongoing = 0;
-  //debug err_log("RTO Timer elapsed");
+// Start (i.e. arm) the RTO for a connection
+static void rto_timer_start(serial_context_t *ctx) {
+  struct timespec *deadline = &ctx->com.rto_deadline;
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_nsec += RTO_VALUE_MSEC * ONE_MSEC;
+  deadline->tv_sec  += deadline->tv_nsec / ONE_SEC;
+  deadline->tv_nsec %= ONE_SEC;
 }
 
-
-// Initialize the RTO timer and set a sigaction handler for SIGUSR1
-// Returns 0 on success, 1 on failure
-static inline int rto_timer_init(void) {
-  // Initialize data structure
-  rto_timer = (timer_entity_t) {
-    .timeval = {
-      { 0, 0 }, // One-shot timer
-      { 0, RTO_VALUE_MSEC * ONE_MSEC }
-    },
-  .sig_ev  = { SIGEV_SIGNAL, SIGUSR1 },
-  .sig_act = (struct sigaction) { .sa_handler = rto_sig_handler }
-  };
-
-  // Create timer
-  err_check(timer_create(CLOCK_REALTIME, &rto_timer.sig_ev, &rto_timer.id) != 0,
-      1, "Unable to create timer");
-
-  // Handle SIGUSR1
-  if (sigaction(SIGUSR1, &rto_timer.sig_act, &rto_timer.sig_act_old) != 0) {
-    timer_delete(rto_timer.id);
-    error(1, "Unable to set signal handler (sigaction) for SIGUSR1");
-  }
-
-  return 0;
-}
-
-
-static inline void rto_timer_destroy(void) {
-  if (rto_timer.ongoing)
-    rto_timer_stop();
-
-  // Reset signal handler for SIGUSR1
-  if (sigaction(SIGUSR1, &rto_timer.sig_act_old, NULL) != 0)
-    err_log("Could not reset signal handler for SIGUSR1");
-  timer_delete(rto_timer.id);
-}
-
-
-// Start (i.e. arm) the timer
-static void rto_timer_start(void) {
-  if (rto_timer.ongoing) rto_timer_stop();
-  rto_timer.elapsed = 0;
-  timer_settime(rto_timer.id, 0, &rto_timer.timeval, NULL);
-  //debug err_log("RTO Timer started");
+// Returns 1 if the RTO of a connection is elapsed, 0 otherwise
+static int rto_timer_elapsed(const serial_context_t *ctx) {
+  const struct timespec *deadline = &ctx->com.rto_deadline;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec &&
+        now.tv_nsec >= deadline->tv_nsec)) ? 1 : 0;
 }
 
-// Stop (i.e. disarm) the timer
-static void rto_timer_stop(void) {
-  static const struct itimerspec disarmer = { 0 };
-  if (!rto_timer.ongoing) return;
-  timer_settime(rto_timer.id, 0, &disarmer, NULL);
-  rto_timer.ongoing = 0;
-  //debug err_log("RTO Timer stopped");
+// Sleep until the RTO of a connection elapses
+#if !COBS_FRAMING
+static void rto_timer_wait(const serial_context_t *ctx) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+        &ctx->com.rto_deadline, NULL) == EINTR)
+    ;
 }
+#endif
@@ -0,0 +1,104 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperatures downloader - Source file
+// The communication happens as follows:
+// 1] [HOST] <CMD> Request to download
+// 2] [AVR]  If next (or first) DB is not empty:
+//             <CTR> send DB info (including its number of channels)
+// 3] [AVR]  While there are temperatures in the current DB:
+//             <BLK> Send temperatures in data bursts (i.e. in bulk), with a
+//             cumulative ACK for each window of them
+// 4] [AVR]  If there is another DB, goto [2]
+// 5] [AVR]  <CTR> Piggyback CTR packet with no carried data means end of comm.
+#include <string.h>
+
+#include "download.h"
+#include "communication.h"
+#include "debug.h"
+
+#define TEMP_BURST_MAX (PACKET_JUMBO_DATA_MAX_SIZE / sizeof(temperature_t))
+
+
+// Download all the temperatures from a connected tmon
+// Returns a 'download_ret_t' code
+int download_run(serial_context_t *ctx, const download_handler_t *handler,
+    void *env) {
+  if (!ctx || !handler) return DOWNLOAD_E_SEND;
+
+  // State of the DB currently in reception
+  uint8_t db_id = 0;
+  uint16_t db_reg_resolution, db_reg_interval;
+  uint8_t db_channels;
+  temperature_id_t db_count = 0, db_received = 0;
+  unsigned char db_ongoing = 0;
+
+  // Buffers for received packets and (aligned) temperatures
+  packet_t pack_rx[1];
+  temperature_t burst[TEMP_BURST_MAX];
+
+  if (communication_cmd(ctx, CMD_TEMPERATURES_DOWNLOAD, NULL, 0) != 0)
+    return DOWNLOAD_E_SEND;
+
+  while (1) {
+    if (communication_recv(ctx, pack_rx) != 0)
+      return DOWNLOAD_E_RECV;
+    const unsigned char type = packet_get_type(pack_rx);
+    const unsigned char data_size = packet_data_size(pack_rx);
+
+    // New database incoming, or end of communication
+    if (type == PACKET_TYPE_CTR) {
+      if (db_ongoing) { // Close the previous DB
+        if (db_received != db_count) {
+          debug err_log("DB %hhu: %hu temperatures expected, %hu received",
+              db_id, db_count, db_received);
+          return DOWNLOAD_E_PROTOCOL;
+        }
+        if (handler->db_end && handler->db_end(env) != 0)
+          return DOWNLOAD_E_HANDLER;
+        db_ongoing = 0;
+      }
+
+      if (data_size == 0) // No more data to receive
+        return DOWNLOAD_OK;
+      if (data_size != sizeof(temperature_db_info_t))
+        return DOWNLOAD_E_PROTOCOL;
+
+      temperature_db_info_extract(pack_rx->data, &db_id, &db_count,
+          &db_reg_resolution, &db_reg_interval, &db_channels);
+      if (!db_channels || db_channels > TEMPERATURE_CHANNELS_MAX ||
+          !db_reg_resolution || !db_reg_interval)  // i.e. a null period
+        return DOWNLOAD_E_PROTOCOL;
+      db_received = 0;
+      db_ongoing = 1;
+      if (handler->db_begin && handler->db_begin(env, db_id, db_count,
+            db_reg_resolution, db_reg_interval, db_channels) != 0)
+        return DOWNLOAD_E_HANDLER;
+    }
+
+    // New temperatures incoming
+    else if (type == PACKET_TYPE_BLK || type == PACKET_TYPE_DAT) {
+      const unsigned count = data_size / sizeof(temperature_t);
+      if (!db_ongoing || count == 0 || db_received + count > db_count)
+        return DOWNLOAD_E_PROTOCOL;
+
+      memcpy(burst, pack_rx->data, count * sizeof(temperature_t));
+      db_received += count;
+      if (handler->db_data && handler->db_data(env, burst, count) != 0)
+        return DOWNLOAD_E_HANDLER;
+    }
+
+    else return DOWNLOAD_E_PROTOCOL; // Unexpected packet type
+  }
+}
+
+
+// Get a string describing a 'download_ret_t' code
+const char *download_strerror(int ret) {
+  static const char *str[] = {
+    [DOWNLOAD_OK]          = "Success",
+    [DOWNLOAD_E_SEND]      = "Could not send the download command",
+    [DOWNLOAD_E_RECV]      = "Unexpected communication failure",
+    [DOWNLOAD_E_PROTOCOL]  = "Unexpected packet received",
+    [DOWNLOAD_E_HANDLER]   = "Download aborted"
+  };
+  return (ret >= 0 && ret <= DOWNLOAD_E_HANDLER) ? str[ret] : "Unknown error";
+}
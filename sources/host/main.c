@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h> // exit()
 #include <unistd.h> // getopt
+#include <string.h>
 
 #include "communication.h"
 #include "shell.h"
+#include "pull.h"
 #include "debug.h"
 
 
@@ -21,17 +23,25 @@ extern void shell_cleanup(shell_t *s);
 static inline void print_usage(void) {
   printf("avrtmon -- AVR-based temperature monitor\n"
       "Usage: avrtmon [OPTION...]\n"
+      "       avrtmon pull --dev <device> [--out <dir>] [--format bin|csv]\n"
       "\n -c <avr-file-path>\n"
       "   Automatically connect at <avr-file-path>. Exit if the connention\n"
       "   could not be estabilished\n"
       "\n -s [script]\n"
       "   Script (i.e. non interactive) mode\n"
       "\n -h    Print a help message and exit\n"
+      "\n pull\n"
+      "   Download all the DBs of a tmon to files and exit, without launching\n"
+      "   the shell. Exit codes are the ones defined in sysexits.h\n"
       "\n"
   );
 }
 
 int main(int argc, char *argv[]) {
+  // One-shot subcommands do not need the shell at all
+  if (argc > 1 && strcmp(argv[1], "pull") == 0)
+    return pull_main(argc - 1, argv + 1);
+
   // Command line arguments
   char *avr_dev_path = NULL; // Path to AVR device file
 
@@ -73,10 +83,6 @@ int main(int argc, char *argv[]) {
   }
 
 
-  // Initialize communication and serial module
-  err_check_exit(communication_init() != 0,
-      "Could not initialize communication module");
-
   // Initialize a list which will contain all the temperature DBs
   void *shell_storage = shell_storage_new();
   err_check_exit(!shell_storage, "Could not initialize shell storage");
@@ -107,7 +113,6 @@ int main(int argc, char *argv[]) {
   shell_loop(shell, script_file ? script_file : stdin);
 
   // Perform a clean exit from the program
-  communication_cleanup();
   shell_cleanup(shell);
   if (script_file)
     fclose(script_file);
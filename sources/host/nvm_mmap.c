@@ -0,0 +1,121 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// File-backed NVM backend - Source file
+// Every operation is a plain memory access to the shared mapping, which is
+// written back by the kernel; 'wait' forces the write back
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nvm_mmap.h"
+
+// Value of an erased byte, as in an EEPROM or a flash memory
+#define NVM_ERASED_BYTE 0xFF
+
+static int image_fd = -1;
+
+// [AUX] Backend operations, see at the bottom of this source file
+static void _mmap_read(void *dst, const void *src, size_t size);
+static void _mmap_update(void *dst, const void *src, size_t size);
+static uint8_t _mmap_pending(void);
+static void _mmap_wait(void);
+
+// The backend itself. Asynchronous writes are completed as soon as they are
+// issued, from the point of view of the NVM users
+static nvm_backend_t mmap_backend = {
+  .erase_block = 1,
+  .read = _mmap_read,
+  .write = _mmap_read,  // Same as a read, but towards the NVM
+  .update = _mmap_update,
+  .update_async = _mmap_update,
+  .pending = _mmap_pending,
+  .wait = _mmap_wait
+};
+
+
+// Open (or create) an NVM image file of 'size' bytes, mapping it in memory
+// Returns the backend, or NULL on failure
+const nvm_backend_t *nvm_mmap_open(const char *path, size_t size) {
+  if (!path || image_fd >= 0) return NULL;
+
+  const int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror(__func__);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(__func__);
+    close(fd);
+    return NULL;
+  }
+  const size_t old_size = st.st_size;
+  if (!size) size = old_size;
+  if (!size || (size > old_size && ftruncate(fd, size) != 0)) {
+    fprintf(stderr, "%s: Unable to size the NVM image '%s'\n", __func__, path);
+    close(fd);
+    return NULL;
+  }
+
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    perror(__func__);
+    close(fd);
+    return NULL;
+  }
+  if (size > old_size)  // Erase the new part of the image
+    memset(base + old_size, NVM_ERASED_BYTE, size - old_size);
+
+  image_fd = fd;
+  mmap_backend.base = base;
+  mmap_backend.size = size;
+  return &mmap_backend;
+}
+
+
+// Write back and close the NVM image currently open
+// Returns 0 on success, 1 on failure or if there is no open image
+int nvm_mmap_close(void) {
+  if (image_fd < 0) return 1;
+  int ret = 0;
+  if (msync(mmap_backend.base, mmap_backend.size, MS_SYNC) != 0 ||
+      munmap(mmap_backend.base, mmap_backend.size) != 0) {
+    perror(__func__);
+    ret = 1;
+  }
+  if (close(image_fd) != 0) ret = 1;
+
+  image_fd = -1;
+  mmap_backend.base = NULL;
+  mmap_backend.size = 0;
+  return ret;
+}
+
+
+
+// [AUX] Copy a block of data, from or to the NVM
+static void _mmap_read(void *dst, const void *src, size_t size) {
+  memcpy(dst, src, size);
+}
+
+// [AUX] Write only the bytes which differ, so untouched pages stay clean
+static void _mmap_update(void *dst, const void *src, size_t size) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  for (size_t i=0; i < size; ++i)
+    if (d[i] != s[i]) d[i] = s[i];
+}
+
+// [AUX] No write is ever pending
+static uint8_t _mmap_pending(void) {
+  return 0;
+}
+
+// [AUX] Write back the whole image to its file
+static void _mmap_wait(void) {
+  if (image_fd >= 0 && msync(mmap_backend.base, mmap_backend.size, MS_SYNC))
+    perror(__func__);
+}
@@ -0,0 +1,115 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// One-shot download ('avrtmon pull') - Source file
+// Every DB is written to '<out>/<YYYYmmdd-HHMMSS>-<device>-<db_id>.<format>'
+// as soon as its temperatures arrive; nothing is kept in memory
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sysexits.h>
+
+#include "pull.h"
+#include "serial.h"
+#include "communication.h"
+#include "sink.h"
+#include "debug.h"
+
+
+// Print a help message for the 'pull' subcommand
+static inline void pull_usage(FILE *out) {
+  fprintf(out, "Usage: avrtmon pull --dev <device> [--out <dir>] "
+      "[--format bin|csv] [--checkpoint <n>]\n"
+      "Download all the DBs of a tmon to files and exit (exit codes as in "
+      "sysexits.h)\n");
+}
+
+
+int pull_main(int argc, char *argv[]) {
+  static const struct option longopts[] = {
+    { "dev",        required_argument, NULL, 'd' },
+    { "out",        required_argument, NULL, 'o' },
+    { "format",     required_argument, NULL, 'f' },
+    { "checkpoint", required_argument, NULL, 'k' },
+    { "help",       no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  const char *dev_path = NULL;
+  const char *out_dir = ".";
+  sink_format_t format = SINK_FORMAT_BIN;
+  unsigned checkpoint = SINK_CHECKPOINT_DEFAULT;
+  char *endptr;
+
+  int opt;
+  optind = 1;
+  while ((opt = getopt_long(argc, argv, "d:o:f:k:h", longopts, NULL)) >= 0) {
+    switch (opt) {
+      case 'd': dev_path = optarg; break;
+      case 'o': out_dir = optarg; break;
+      case 'f':
+        if (sink_format_parse(optarg, &format) != 0) {
+          eprintf("pull: Unknown format '%s'\n", optarg);
+          return EX_USAGE;
+        }
+        break;
+      case 'k':
+        checkpoint = strtoul(optarg, &endptr, 10);
+        if (*optarg == '\0' || *endptr != '\0') {
+          eprintf("pull: Invalid checkpoint '%s'\n", optarg);
+          return EX_USAGE;
+        }
+        break;
+      case 'h':
+        pull_usage(stdout);
+        return EX_OK;
+      default:
+        pull_usage(stderr);
+        return EX_USAGE;
+    }
+  }
+  if (!dev_path || optind != argc) {
+    pull_usage(stderr);
+    return EX_USAGE;
+  }
+
+  // Files are prefixed with the pull time and the device name
+  const char *dev_name = strrchr(dev_path, '/');
+  dev_name = dev_name ? dev_name + 1 : dev_path;
+  char prefix[256], stamp[16];
+  time_t now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+  snprintf(prefix, sizeof(prefix), "%s-%s", stamp, dev_name);
+
+  sink_t *sink = sink_file_new(out_dir, prefix, format, checkpoint);
+  if (!sink) return EX_OSERR;
+
+  // Open the device and estabilish the connection
+  serial_context_t *ctx = serial_open(dev_path);
+  if (!ctx) {
+    eprintf("pull: Unable to open %s\n", dev_path);
+    sink_delete(sink);
+    return EX_UNAVAILABLE;
+  }
+  if (communication_connect(ctx) != 0) {
+    eprintf("pull: No handshake from the tmon at %s\n", dev_path);
+    serial_close(ctx);
+    sink_delete(sink);
+    return EX_TEMPFAIL;
+  }
+
+  int ret = sink_download(ctx, sink);
+  serial_close(ctx);
+  if (ret != DOWNLOAD_OK)
+    eprintf("pull: %s (%u DBs written)\n", download_strerror(ret),
+        sink_db_count(sink));
+  sink_delete(sink);
+
+  switch (ret) {
+    case DOWNLOAD_OK:         return EX_OK; // Silent on success
+    case DOWNLOAD_E_SEND:     return EX_IOERR;
+    case DOWNLOAD_E_RECV:     return EX_TEMPFAIL;
+    case DOWNLOAD_E_PROTOCOL: return EX_PROTOCOL;
+    default:                  return EX_CANTCREAT;
+  }
+}
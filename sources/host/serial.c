@@ -27,6 +27,7 @@ serial_context_t *serial_open(const char *dev) {
   if (!dev || *dev == '\0') return NULL;
   serial_context_t *ctx = malloc(sizeof(serial_context_t));
   err_check(!ctx, NULL, "Unable to use the memory allocator");
+  *ctx = (serial_context_t) { 0 };
 
   ctx->rx.buffer = ringbuffer_new(RX_BUF_SIZE);
   if (!ctx->rx.buffer) {
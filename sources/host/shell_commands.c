@@ -1,16 +1,21 @@
 // AVR Temperature Monitor -- Paolo Lucchesi
 // Program shell - Commands
+#define _GNU_SOURCE  // strptime()
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "shell.h"
 #include "list.h"
 #include "serial.h"
 #include "temperature.h"
 #include "communication.h"
+#include "download.h"
+#include "sink.h"
+#include "aggregate.h"
 #include "debug.h"
 
 
@@ -18,17 +23,35 @@
 #define _storage_cast(st,opaque) shell_storage_t *st=(shell_storage_t*)(opaque)
 
 // Handier function to send and receive packets
-#define SERIAL_CTX (st->serial_ctx) // Must be the context in EVERY function below
+// Commands talk to the current connection of the storage they are given
+// 'st' must be the storage in EVERY function below
+#define SERIAL_CTX (st->current ? st->current->ctx : NULL)
 #define psend(type,data,data_size)\
   communication_craft_and_send(SERIAL_CTX,type,data,data_size)
 #define precv(p) communication_recv(SERIAL_CTX,p)
 #define pcmd(cmd,arg,arg_size) communication_cmd(SERIAL_CTX,cmd,arg,arg_size)
 
+// Type definition for a named connection to a tmon
+typedef struct _connection_s {
+  char *name;
+  char *dev_path;
+  serial_context_t *ctx;
+} connection_t;
+
+// Type definition for the downloaded DBs, shared by all the connections
+typedef struct _db_store_s {
+  list_t *list;
+  unsigned incr_counter;  // Incremental counter for DB IDs
+  pthread_mutex_t lock;   // Protects the whole store
+} db_store_t;
+
 // Type definition for the internal shell storage
+// A command executed on many connections at once (see the 'on' command) gets
+// a shallow copy of the storage, differing only for the 'current' connection
 typedef struct _shell_storage_s {
-  serial_context_t *serial_ctx;
-  list_t *dbs;
-  unsigned db_incr_counter; // Incremental counter for DB IDs
+  list_t *conns;          // Open connections
+  connection_t *current;  // Connection used by single-device commands
+  db_store_t *dbs;
 } shell_storage_t;
 
 // Wrapper to destroy DBs when destroying 'dbs'
@@ -37,21 +60,84 @@ static void _temperature_db_item_destroyer(void *db) {
 }
 
 
+// [AUX] Open a new named connection (no handshake is performed)
+// Returns a pointer to the new connection on success, NULL otherwise
+static connection_t *_connection_new(const char *name, const char *dev_path) {
+  connection_t *conn = malloc(sizeof(connection_t));
+  if (!conn) return NULL;
+
+  conn->name = strdup(name);
+  conn->dev_path = strdup(dev_path);
+  conn->ctx = (conn->name && conn->dev_path) ? serial_open(dev_path) : NULL;
+  if (conn->ctx) return conn;
+
+  free(conn->name);
+  free(conn->dev_path);
+  free(conn);
+  return NULL;
+}
+
+// [AUX] Close and destroy a connection -- Suitable as a list item destroyer
+static void _connection_delete(void *_conn) {
+  connection_t *conn = _conn;
+  if (!conn) return;
+  if (serial_close(conn->ctx) != 0)
+    err_log("Could not close the tmon file descriptor of %s", conn->name);
+  free(conn->name);
+  free(conn->dev_path);
+  free(conn);
+}
+
+// [AUX] Get an open connection by name, optionally retrieving its list index
+// Returns NULL if no connection has the given name
+static connection_t *_connection_get(shell_storage_t *st, const char *name,
+    size_t *index) {
+  size_t i = 0;
+  for (list_iterator_t it = list_iterator_new(st->conns); it;
+      it = list_iterator_next(it), ++i) {
+    connection_t *conn = list_iterator_getvalue(it);
+    if (strcmp(conn->name, name) == 0) {
+      if (index) *index = i;
+      return conn;
+    }
+  }
+  return NULL;
+}
+
+// [AUX] Give the DBs of a completed download an ID and add them to the storage
+// 'db_list' will be destroyed and must NOT be used after a call to this function
+static void _dbs_merge(shell_storage_t *st, list_t *db_list) {
+  pthread_mutex_lock(&st->dbs->lock);
+  for (list_iterator_t it = list_iterator_new(db_list); it;
+      it = list_iterator_next(it))
+    ((temperature_db_t*) list_iterator_getvalue(it))->id =
+      st->dbs->incr_counter++;
+  list_concat(st->dbs->list, db_list);
+  pthread_mutex_unlock(&st->dbs->lock);
+}
+
+
 // Allocate and initialize a shell storage
 // Returns an opaque pointer to the allocated storage, or NULL on failure
 void *shell_storage_new(void) {
   shell_storage_t *st = malloc(sizeof(shell_storage_t));
   if (!st) return NULL;
-
-  st->dbs = list_new();
-  if (!st->dbs) {
-    free(st);
-    return NULL;
+  *st = (shell_storage_t) { 0 };  // i.e. not connected
+
+  st->conns = list_new();
+  st->dbs = malloc(sizeof(db_store_t));
+  if (st->dbs) {
+    *st->dbs = (db_store_t) { .list = list_new(), .incr_counter = 0 };
+    if (st->conns && st->dbs->list &&
+        pthread_mutex_init(&st->dbs->lock, NULL) == 0)
+      return (void*) st;
+    list_delete(st->dbs->list, NULL);
+    free(st->dbs);
   }
 
-  SERIAL_CTX = NULL;  // i.e. not connected
-  st->db_incr_counter = 0;
-  return (void*) st;
+  list_delete(st->conns, NULL);
+  free(st);
+  return NULL;
 }
 
 // Cleanup this shell environment (i.e. free memory, close descriptors...)
@@ -60,31 +146,44 @@ void shell_cleanup(shell_t *s) {
   if (!s) return;
   _storage_cast(st, s->storage);
 
-  // Close the connection with the tmon, if any
-  if (SERIAL_CTX && serial_close(SERIAL_CTX) != 0)
-    err_log("Could not close the tmon file descriptor");
+  // Close the connections with the tmons, if any
+  list_delete(st->conns, _connection_delete);
 
   // Free the storage
-  list_delete(st->dbs, _temperature_db_item_destroyer);
+  list_delete(st->dbs->list, _temperature_db_item_destroyer);
+  pthread_mutex_destroy(&st->dbs->lock);
+  free(st->dbs);
   free(st);
 }
 
 
 
 // CMD: connect
-// Usage: connect <device_path>
+// Usage: connect [name] <device_path>
 // Connect to an avrtmon, given its device file (usually under /dev)
-// If it is already connected, reconnect
+// If no name is given, the base name of the device file is used (e.g. ttyACM0)
+// The connection becomes the current one. If it is already open, reconnect
 int connect(int argc, char *argv[], void *storage) {
   _storage_cast(st, storage);
-  if (argc < 2) return 1;
+  if (argc < 2 || argc > 3) return 1;
+
+  const char *dev_path = argv[argc - 1];
+  const char *name = (argc == 3) ? argv[1] : strrchr(dev_path, '/');
+  name = !name ? dev_path : (argc == 3 ? name : name + 1);
+  sh_error_on(*name == '\0', 1, "Invalid connection name");
 
-  if (SERIAL_CTX)
-    fputs("Open serial context found; reconnecting\n", stderr);
+  connection_t *conn = _connection_get(st, name, NULL);
+  if (conn)
+    fprintf(stderr, "Open serial context found for %s; reconnecting\n", name);
   else { // Open a descriptor for the tmon
-    SERIAL_CTX = serial_open(argv[1]);
-    sh_error_on(!SERIAL_CTX, 2, "Unable to connect to the tmon");
+    conn = _connection_new(name, dev_path);
+    sh_error_on(!conn, 2, "Unable to connect to the tmon");
+    if (list_add(st->conns, conn) != 0) {
+      _connection_delete(conn);
+      sh_error(2, "Unable to store the new connection");
+    }
   }
+  st->current = conn;
 
   // Estabilish the connection
   sh_error_on(communication_connect(SERIAL_CTX) != 0, 3,
@@ -95,124 +194,171 @@ int connect(int argc, char *argv[], void *storage) {
 
 
 // CMD: disconnect
-// Usage: disconnect
-// Close an existing connection - Has no effect on the tmon
+// Usage: disconnect [name]
+// Close an existing connection (default: the current one) - Has no effect on
+// the tmon. If the current connection is closed, the last opened one is used
 int disconnect(int argc, char *argv[], void *storage) {
   _storage_cast(st, storage);
-  if (argc != 1) return 1;
-  sh_error_on(!SERIAL_CTX, 2, "tmon is not connected");
+  if (argc > 2) return 1;
 
-  int ret = serial_close(SERIAL_CTX);
-  SERIAL_CTX = NULL; // i.e. set to disconnected
-  sh_error_on(ret != 0, 3, "Could not close the tmon file descriptor");
+  size_t index;
+  connection_t *conn = (argc == 2) ?
+    _connection_get(st, argv[1], &index) :
+    (st->current ? _connection_get(st, st->current->name, &index) : NULL);
+  sh_error_on(!conn, 2, "tmon is not connected");
+
+  list_remove(st->conns, index, (void**) &conn);
+  if (conn == st->current &&
+      list_get(st->conns, list_size(st->conns) - 1, (void**) &st->current) != 0)
+    st->current = NULL;
+  _connection_delete(conn);
 
   return 0;
 }
 
 
-// CMD: download
-// Usage: download
-// Download all the temperatures from the tmon, creating a new database
-// The communication happens as follows:
-// 1] [HOST] <CMD> Request to download
-// 2] [AVR]  If next (or first) DB is not empty:
-//             <CTR> send DB info
-// 3] [AVR]  While there are temperatures in the current DB:
-//             <DAT> Send temperatures in data bursts (i.e. in bulk)
-// 4] [AVR]  If there is another DB, goto [2]
-// 5] [AVR]  <CTR> Piggyback CTR packet with no carried data means end of comm.
-int download(int argc, char *argv[], void *storage) {
+// CMD: use
+// Usage: use <name>
+// Select the connection used by the commands which talk to a tmon
+int use(int argc, char *argv[], void *storage) {
   _storage_cast(st, storage);
-  if (argc > 1) return 1;
-  sh_error_on(!SERIAL_CTX, 2, "tmon is not connected");
-
-  // Store DBs in a list
-  list_t *db_list = list_new();
-  sh_error_on(!db_list, 2, "Could not create new linked list");
-
-  // DB which is currently in reception, with variables to store metadata
-  uint8_t db_id;
-  uint16_t db_reg_resolution, db_reg_interval;
-  temperature_id_t db_size;
-  temperature_db_t *db_current = NULL;
+  if (argc != 2) return 1;
+  connection_t *conn = _connection_get(st, argv[1], NULL);
+  sh_error_on(!conn, 2, "No connection named %s", argv[1]);
+  st->current = conn;
+  return 0;
+}
 
-  // Buffer and variables for received packets
-  packet_t pack_rx[1];
-  unsigned char type, data_size;
 
+// CMD: devices
+// Usage: devices
+// List the open connections, marking the current one with '*'
+int devices(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc != 1) return 1;
 
-  // Send a download command to the tmon
-  if (pcmd(CMD_TEMPERATURES_DOWNLOAD, NULL, 0) != 0) {
-    list_delete(db_list, _temperature_db_item_destroyer);
-    sh_error(3, "Could not send CMD packet");
+  printf("Connections open: %zu\n", list_size(st->conns));
+  for (list_iterator_t it = list_iterator_new(st->conns); it;
+      it = list_iterator_next(it)) {
+    connection_t *conn = list_iterator_getvalue(it);
+    printf("%c %s (%s)\n", conn == st->current ? '*' : ' ',
+        conn->name, conn->dev_path);
   }
 
-  // Main downloader loop
-  while (1) {
-    // Receive new packet
-    if (precv(pack_rx) != 0) {
-      err_log("Unable to receive packet");
-      break;
-    }
-    type = packet_get_type(pack_rx);
-    data_size = packet_data_size(pack_rx);
-
-    // New database incoming
-    if (type == PACKET_TYPE_CTR) {
-      if (data_size == 0) { // No more data to receive
-        if (list_size(db_list) == 0) // No temperatures were received
-          list_delete(db_list, NULL);
-        else {
-          list_concat(st->dbs, db_list);
-          st->db_incr_counter = db_id + 1; // i.e. += Last ID received
-        }
-        return 0;
-      }
+  return 0;
+}
 
-      else if (data_size == sizeof(temperature_db_info_t)) { // New DB incoming
-        temperature_db_info_extract(pack_rx->data, &db_id, &db_size,
-            &db_reg_resolution, &db_reg_interval);
-        db_id += st->db_incr_counter;
-        db_current = temperature_db_new(db_id, db_size,
-            db_reg_resolution, db_reg_interval, NULL);
-        assert(db_current);
-        list_add(db_list, db_current);
-      }
 
-      else break; // Error: unexpected packet data size
+// CMD: download
+// Usage: download [<dir> [bin|csv]]
+// Download all the temperatures from the tmon, creating a new database
+// The DBs are stored in the shell storage once the download is completed or,
+// if a directory is given, streamed to files without being kept in memory
+// A tmon DB with more channels is split into a DB for each channel
+typedef struct _download_env_s { // Environment for the download callbacks
+  shell_storage_t *st;
+  list_t *db_list;
+  temperature_db_t *db_current[TEMPERATURE_CHANNELS_MAX];
+  unsigned channels, channel_next;
+  time_t started;  // Time at which the download started
+} download_env_t;
+
+static int _download_db_begin(void *_env, uint8_t id, temperature_id_t count,
+    uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels) {
+  download_env_t *env = _env;
+  env->channels = channels;
+  env->channel_next = 0;
+
+  for (unsigned c=0; c < channels; ++c) {
+    char db_desc[64];
+    if (channels == 1)
+      snprintf(db_desc, sizeof(db_desc), "Device %s, tmon database %hhu",
+          env->st->current->name, id);
+    else snprintf(db_desc, sizeof(db_desc),
+        "Device %s, tmon database %hhu, channel %u",
+        env->st->current->name, id, c);
+
+    // A channel could have no temperatures at all
+    const unsigned size = temperature_channel_count(count, channels, c);
+    env->db_current[c] = NULL;
+    if (!size) continue;
+
+    temperature_db_t *db = temperature_db_new(id, size, reg_resolution,
+        reg_interval, db_desc);
+    if (!db) return 1;
+
+    // The tmon has no clock: assume that the last temperature was registered
+    // right before the download (true for the DB currently in use)
+    const time_t span = (time_t) (size - 1) * temperature_db_period(db) / 1000;
+    temperature_db_set_anchor(db, env->started - span);
+
+    if (list_add(env->db_list, db) != 0) {
+      temperature_db_delete(db);
+      return 1;
     }
+    env->db_current[c] = db;
+  }
+  return 0;
+}
 
-    // New temperatures incoming
-    else if (type == PACKET_TYPE_DAT) {
-      const char *err_msg = NULL;
-      const unsigned burst = data_size / sizeof(temperature_t);
-      float converted[burst];
-
-      // Handle errors
-      if (!db_current)
-        err_msg = "NULL reference to current database";
-      else if (db_current->size < db_current->used + burst)
-        err_msg = "Too many temperatures received for this database";
-      else if (burst == 0)
-        err_msg = "Received DAT packet with no temperatures";
-      if (err_msg) {
-        err_log(err_msg);
-        break;
-      }
+static int _download_db_data(void *_env, const temperature_t *raw,
+    unsigned count) {
+  download_env_t *env = _env;
+  float converted[count];
+  for (unsigned i=0; i < count; ++i)
+    converted[i] = temperature_raw2float(raw[i]);
+  return temperature_register_interleaved(env->db_current, env->channels,
+      &env->channel_next, count, converted) == count ? 0 : 1;
+}
 
-      // No errors occurred
-      for (size_t i=0; i < burst; ++i)
-        converted[i] = temperature_raw2float(((uint16_t*) pack_rx->data)[i]);
-      temperature_register_bulk(db_current, burst, converted);
-    }
+int download(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc > 3) return 1;
+  sh_error_on(!SERIAL_CTX, 2, "tmon is not connected");
 
-    else break; // Error: unexpected packet type
+  // Stream the DBs to files, '<dir>/<YYYYmmdd-HHMMSS>-<name>-<db_id>.<fmt>'
+  if (argc > 1) {
+    sink_format_t format = SINK_FORMAT_BIN;
+    if (argc == 3 && sink_format_parse(argv[2], &format) != 0) return 1;
+
+    char prefix[256], stamp[16];
+    time_t now = time(NULL);
+    struct tm tm;  // Not shared, as 'on' downloads from many threads
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+    snprintf(prefix, sizeof(prefix), "%s-%s", stamp, st->current->name);
+
+    sink_t *sink = sink_file_new(argv[1], prefix, format,
+        SINK_CHECKPOINT_DEFAULT);
+    sh_error_on(!sink, 2, "Could not create the download sink");
+    int ret = sink_download(SERIAL_CTX, sink);
+    unsigned written = sink_db_count(sink);
+    sink_delete(sink);
+    sh_error_on(ret != DOWNLOAD_OK, 3, "%s (%u DBs written)",
+        download_strerror(ret), written);
+    return 0;
   }
 
+  // Store DBs in a list
+  download_env_t env = {
+    .st = st, .db_list = list_new(), .started = time(NULL)
+  };
+  sh_error_on(!env.db_list, 2, "Could not create new linked list");
+
+  static const download_handler_t handler = {
+    .db_begin = _download_db_begin,
+    .db_data  = _download_db_data
+  };
+  sink_t *sink = sink_callback_new(&handler, &env);
+  int ret = sink ? sink_download(SERIAL_CTX, sink) : DOWNLOAD_E_HANDLER;
+  sink_delete(sink);
+
+  if (ret != DOWNLOAD_OK) {
+    list_delete(env.db_list, _temperature_db_item_destroyer);
+    sh_error(3, "%s", download_strerror(ret));
+  }
 
-  // Error handler
-  list_delete(db_list, _temperature_db_item_destroyer);
-  sh_error(3, "Unexpected communication failure");
+  _dbs_merge(st, env.db_list); // Final IDs are given here
+  return 0;
 }
 
 
@@ -433,7 +579,7 @@ int tmon_echo(int argc, char *argv[], void *storage) {
 
   // Check the packet data size and prepare the received string to be printed
   const unsigned char pack_rx_size_expected = PACKET_HEADER_SIZE +
-    str_len + sizeof(crc_t);
+    str_len + packet_crc_size(&pack_rx);
   const unsigned char pack_rx_size = packet_get_size(&pack_rx);
   sh_error_on(pack_rx_size != pack_rx_size_expected, 2,
       "Error: The received packet is %hhu bytes long, expected %hhu\n",
@@ -453,16 +599,17 @@ int list(int argc, char *argv[], void *storage) {
   _storage_cast(st, storage);
   if (argc > 1) return 1;
 
-  printf("DBs present: %zu\n\n", list_size(st->dbs));
+  printf("DBs present: %zu\n\n", list_size(st->dbs->list));
 
   // Print databases metadata
-  list_iterator_t it = list_iterator_new(st->dbs);
+  list_iterator_t it = list_iterator_new(st->dbs->list);
   while (it) {
     temperature_db_t *db = list_iterator_getvalue(it);
     if (!db) fprintf(stderr, "Error: NULL reference to database\n");
     else {
       printf("Database ID: %u\n", db->id);
       if (db->desc) printf("%s\n", db->desc);
+      if (db->anchor) printf("Start: %s", ctime(&db->anchor));
       printf("Number of temperatures: %u\n\n", db->size);
     }
     it = list_iterator_next(it);
@@ -472,52 +619,319 @@ int list(int argc, char *argv[], void *storage) {
 }
 
 
+// [AUX] Get a DB of the storage given its ID
+// Returns a pointer to the DB, or NULL if it does not exist
+static temperature_db_t *_db_get(shell_storage_t *st, const char *id_str) {
+  char *endptr;
+  unsigned long id = strtoul(id_str, &endptr, 10);
+  if (*id_str == '\0' || *endptr != '\0') return NULL;
+
+  for (list_iterator_t it = list_iterator_new(st->dbs->list); it;
+      it = list_iterator_next(it)) {
+    temperature_db_t *db = list_iterator_getvalue(it);
+    if (db && db->id == id) return db;
+  }
+  return NULL;
+}
+
+
+// [AUX] Parse a point in time (local time), given as one of:
+// YYYY-mm-ddTHH:MM[:SS], HH:MM[:SS] (today) or @<seconds since the epoch>
+// Returns 0 on success, 1 otherwise
+static int _time_parse(const char *str, time_t *dest) {
+  static const char *formats[] = {
+    "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%H:%M:%S", "%H:%M"
+  };
+
+  if (*str == '@') {
+    char *endptr;
+    *dest = strtoll(str + 1, &endptr, 10);
+    return (str[1] == '\0' || *endptr != '\0') ? 1 : 0;
+  }
+
+  for (size_t i=0; i < sizeof(formats) / sizeof(*formats); ++i) {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);  // Date defaults to today
+    tm.tm_sec = 0;
+    const char *end = strptime(str, formats[i], &tm);
+    if (end && *end == '\0') {
+      tm.tm_isdst = -1;
+      *dest = mktime(&tm);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
 // CMD: export
-// Usage: export <db_id> <output_filepath>
+// Usage: export <db_id> <output_filepath> [window]
 // Export a database (as text, newline-separated float temperatures)
-// TODO: Make this reentrant/thread-safe (static variable emulates a closure)
-static unsigned _db_id_to_find;
-static int _db_has_id(void *_db) {
-  temperature_db_t *db = _db;
-  return (db && db->id == _db_id_to_find);
+// If a window is given, export min, mean and max of each window instead
+int export(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc != 3 && argc != 4) return 1;
+
+  temperature_db_t *db = _db_get(st, argv[1]);
+  sh_error_on(!db, 2, "Error: could not fetch database");
+
+  if (argc == 3) {
+    sh_error_on(temperature_db_export(db, argv[2]) != 0, 3,
+        "Error while exporting database of ID %u", db->id);
+    return 0;
+  }
+
+  unsigned window;
+  aggregate_db_t agg;
+  sh_error_on(aggregate_window_parse(argv[3], &window) != 0, 1,
+      "Invalid window: %s", argv[3]);
+  sh_error_on(aggregate_db(db, window, &agg) != 0, 3,
+      "Error while aggregating database of ID %u", db->id);
+  int ret = aggregate_db_export(&agg, argv[2]);
+  aggregate_db_clear(&agg);
+  sh_error_on(ret != 0, 3, "Error while exporting database of ID %u", db->id);
+
+  return 0;
 }
 
-int export(int argc, char *argv[], void *storage) {
+
+// CMD: aggregate
+// Usage: aggregate <window> [db_id ...]
+// Print min, mean and max temperatures of some databases (default: all of
+// them) for each window of time. Databases are aggregated in parallel
+int aggregate(int argc, char *argv[], void *storage) {
   _storage_cast(st, storage);
-  if (argc != 3) return 1;
+  if (argc < 2) return 1;
+
+  unsigned window;
+  sh_error_on(aggregate_window_parse(argv[1], &window) != 0, 1,
+      "Invalid window: %s", argv[1]);
+
+  // Gather the databases to aggregate
+  const unsigned ndbs = (argc > 2) ? argc - 2 : list_size(st->dbs->list);
+  sh_error_on(ndbs == 0, 2, "No databases to aggregate");
+  temperature_db_t *dbs[ndbs];
+  aggregate_db_t aggs[ndbs];
+  memset(aggs, 0, sizeof(aggs));
+
+  if (argc > 2) {
+    for (unsigned i=0; i < ndbs; ++i)
+      sh_error_on(!(dbs[i] = _db_get(st, argv[i+2])), 2,
+          "Error: could not fetch database %s", argv[i+2]);
+  } else {
+    unsigned i = 0;
+    for (list_iterator_t it = list_iterator_new(st->dbs->list); it;
+        it = list_iterator_next(it))
+      dbs[i++] = list_iterator_getvalue(it);
+  }
+
+  int ret = aggregate_db_parallel(dbs, ndbs, window, aggs);
+  for (unsigned i=0; i < ndbs; ++i) {
+    if (ret == 0) {
+      printf("Database %u\n", dbs[i]->id);
+      for (unsigned b=0; b < aggs[i].nbuckets; ++b) {
+        const aggregate_t *a = aggs[i].buckets + b;
+        char stamp[32];
+        struct tm tm;
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S",
+            localtime_r(&a->start, &tm));
+        printf("%s min %.1f mean %.2f max %.1f (%u)\n", stamp, a->min,
+            a->mean, a->max, a->count);
+      }
+      putchar('\n');
+    }
+    aggregate_db_clear(aggs + i);
+  }
+  sh_error_on(ret != 0, 3, "Error while aggregating databases");
+
+  return 0;
+}
 
-  _db_id_to_find = atoi(argv[1]);
-  temperature_db_t *db = list_find(st->dbs, _db_has_id);
 
+// CMD: anchor
+// Usage: anchor <db_id> <time>
+// Set the acquisition time of the first temperature of a database
+// The time set at download is an estimate, as the tmon has no clock
+int anchor(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc != 3) return 1;
+
+  time_t t;
+  temperature_db_t *db = _db_get(st, argv[1]);
   sh_error_on(!db, 2, "Error: could not fetch database");
-  sh_error_on(temperature_db_export(db, argv[2]) != 0, 3,
-      "Error while exporting database of ID %u", _db_id_to_find);
+  sh_error_on(_time_parse(argv[2], &t) != 0, 1, "Invalid time: %s", argv[2]);
+  temperature_db_set_anchor(db, t);
+
+  return 0;
+}
+
+
+// CMD: query
+// Usage: query <db_id> <from> <to>
+// Print the temperatures of a database registered in the range [from, to)
+// Nothing is copied: the temperatures are printed from the database itself
+int query(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc != 4) return 1;
 
+  time_t from, to;
+  temperature_db_t *db = _db_get(st, argv[1]);
+  sh_error_on(!db, 2, "Error: could not fetch database");
+  sh_error_on(!db->anchor, 2, "The start time of the database is unknown");
+  sh_error_on(_time_parse(argv[2], &from) != 0, 1, "Invalid time: %s",
+      argv[2]);
+  sh_error_on(_time_parse(argv[3], &to) != 0, 1, "Invalid time: %s", argv[3]);
+
+  const float *slice;
+  const unsigned count = temperature_db_slice(db, from, to, &slice);
+  const unsigned first = slice ? slice - db->items : 0;
+  const unsigned long long period = temperature_db_period(db);
+
+  for (unsigned i=0; i < count; ++i) {
+    const unsigned long long ms = (first + i) * period;
+    const time_t t = db->anchor + ms / 1000;
+    char stamp[32];
+    struct tm tm;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S",
+        localtime_r(&t, &tm));
+    printf("%s.%03llu %.1f\n", stamp, ms % 1000, slice[i]);
+  }
   return 0;
 }
 
 
 
+// CMD: on
+// Usage: on <name|all> <command> [args ...]
+// Execute a command on a given connection, or on all of them in parallel
+// Each connection is driven by its own thread, as the commands are I/O bound
+static shell_command_t *_shell_command_get(const char *name);
+
+typedef struct _fanout_job_s { // Execution of a command on a single connection
+  pthread_t thread;
+  shell_storage_t storage;
+  shell_command_t *cmd;
+  int argc;
+  char **argv;
+  int ret;
+} fanout_job_t;
+
+static void *_fanout_task(void *_job) {
+  fanout_job_t *job = _job;
+  job->ret = job->cmd->exec(job->argc, job->argv, &job->storage);
+  return NULL;
+}
+
+int on(int argc, char *argv[], void *storage) {
+  _storage_cast(st, storage);
+  if (argc < 3) return 1;
+
+  shell_command_t *cmd = _shell_command_get(argv[2]);
+  sh_error_on(!cmd, 2, "Command not found: %s", argv[2]);
+
+  // Only the commands which drive a tmon can be fanned out: the other ones
+  // work on the local storage, which is shared by all the connections
+  static const char *allowed[] = { "download", "tmon-reset", "tmon-config",
+    "tmon-start", "tmon-stop", "tmon-set-resolution", "tmon-set-interval",
+    "tmon-echo" };
+  int device_cmd = 0;
+  for (size_t i=0; i < sizeof(allowed) / sizeof(*allowed); ++i)
+    if (strcmp(argv[2], allowed[i]) == 0) device_cmd = 1;
+  sh_error_on(!device_cmd, 2, "%s cannot be executed on a specific connection",
+      argv[2]);
+
+  // Prepare a job for each target connection
+  const int all = strcmp(argv[1], "all") == 0;
+  const size_t njobs = all ? list_size(st->conns) : 1;
+  sh_error_on(njobs == 0, 2, "tmon is not connected");
+  fanout_job_t jobs[njobs];
+
+  list_iterator_t it = list_iterator_new(st->conns);
+  for (size_t i=0; i < njobs; ++i, it = list_iterator_next(it)) {
+    jobs[i] = (fanout_job_t) {
+      .storage = *st, .cmd = cmd, .argc = argc - 2, .argv = argv + 2
+    };
+    jobs[i].storage.current = all ? list_iterator_getvalue(it) :
+      _connection_get(st, argv[1], NULL);
+    sh_error_on(!jobs[i].storage.current, 2, "No connection named %s", argv[1]);
+  }
+
+  // A single job is executed in the calling thread
+  if (njobs == 1) _fanout_task(jobs);
+  else {
+    for (size_t i=0; i < njobs; ++i)
+      if (pthread_create(&jobs[i].thread, NULL, _fanout_task, jobs + i) != 0) {
+        err_log("Could not start a thread for %s, executing it serially",
+            jobs[i].storage.current->name);
+        jobs[i].thread = pthread_self();
+        _fanout_task(jobs + i);
+      }
+    for (size_t i=0; i < njobs; ++i)
+      if (!pthread_equal(jobs[i].thread, pthread_self()))
+        pthread_join(jobs[i].thread, NULL);
+  }
+
+  // Report failures; the first non-zero return value is returned
+  int ret = 0;
+  for (size_t i=0; i < njobs; ++i) {
+    if (jobs[i].ret == 0) continue;
+    if (jobs[i].ret == 1 && cmd->help) puts(cmd->help);
+    fprintf(stderr, "%s: %s failed on %s (returned %d)\n", argv[0], cmd->name,
+        jobs[i].storage.current->name, jobs[i].ret);
+    if (!ret) ret = (jobs[i].ret == 1) ? 2 : jobs[i].ret;
+  }
+
+  return ret;
+}
+
+
+
 // Set of all the shell commands
 static shell_command_t _shell_commands[] = {
   (shell_command_t) { // CMD: connect
     .name = "connect",
-    .help = "Usage: connect <device_path>\n"
-      "Connect to an avrtmon, given its device file (usually under /dev)",
+    .help = "Usage: connect [name] <device_path>\n"
+      "Connect to an avrtmon, given its device file (usually under /dev)\n"
+      "The connection is named after the device file if no name is given",
     .exec = connect
   },
 
   (shell_command_t) { // CMD: disconnect
     .name = "disconnect",
-    .help = "Usage: disconnect\n"
-      "Close an existing connection - Has no effect on the tmon",
+    .help = "Usage: disconnect [name]\n"
+      "Close an existing connection (default: the current one) - "
+      "Has no effect on the tmon",
     .exec = disconnect
   },
 
+  (shell_command_t) { // CMD: use
+    .name = "use",
+    .help = "Usage: use <name>\n"
+      "Select the connection used by the commands which talk to a tmon",
+    .exec = use
+  },
+
+  (shell_command_t) { // CMD: devices
+    .name = "devices",
+    .help = "Usage: devices\n"
+      "List the open connections, marking the current one with '*'",
+    .exec = devices
+  },
+
+  (shell_command_t) { // CMD: on
+    .name = "on",
+    .help = "Usage: on <name|all> <command> [args ...]\n"
+      "Execute a command on a given connection, or on all of them in parallel\n"
+      "Only download and the tmon-* commands can be executed this way",
+    .exec = on
+  },
+
   (shell_command_t) { // CMD: download
     .name = "download",
-    .help = "Usage: download\n"
-      "Download all the temperatures from the tmon. creating a new database",
+    .help = "Usage: download [<dir> [bin|csv]]\n"
+      "Download all the temperatures from the tmon. creating a new database\n"
+      "If a directory is given, stream the DBs to files in it instead",
     .exec = download
   },
 
@@ -581,12 +995,47 @@ static shell_command_t _shell_commands[] = {
 
   (shell_command_t) { // CMD: export
     .name = "export",
-    .help = "Usage: export <db_id> <output_filepath>\n"
-      "Export a database (as text, newline-separated float temperatures)",
+    .help = "Usage: export <db_id> <output_filepath> [window]\n"
+      "Export a database (as text, newline-separated float temperatures)\n"
+      "If a window (e.g. 3600, 30m, 1h, 1d) is given, export min, mean and\n"
+      "max temperatures for each window of time instead",
     .exec = export
+  },
+
+  (shell_command_t) { // CMD: aggregate
+    .name = "aggregate",
+    .help = "Usage: aggregate <window> [db_id ...]\n"
+      "Print min, mean and max temperatures for each window of time (e.g.\n"
+      "3600, 30m, 1h, 1d) of some databases (default: all of them)",
+    .exec = aggregate
+  },
+
+  (shell_command_t) { // CMD: anchor
+    .name = "anchor",
+    .help = "Usage: anchor <db_id> <time>\n"
+      "Set the acquisition time of the first temperature of a database\n"
+      "Time format: YYYY-mm-ddTHH:MM[:SS], HH:MM[:SS] (today) or @<epoch>",
+    .exec = anchor
+  },
+
+  (shell_command_t) { // CMD: query
+    .name = "query",
+    .help = "Usage: query <db_id> <from> <to>\n"
+      "Print the temperatures of a database registered in [from, to)\n"
+      "Time format: YYYY-mm-ddTHH:MM[:SS], HH:MM[:SS] (today) or @<epoch>",
+    .exec = query
   }
 };
 
 // This is the exposed shell commands set
 shell_command_t *shell_commands = _shell_commands;
 size_t shell_commands_count = sizeof(_shell_commands) / sizeof(shell_command_t);
+
+
+// [AUX] Retrieve a shell command given its name, or NULL if it does not exist
+static shell_command_t *_shell_command_get(const char *name) {
+  for (size_t i=0; i < shell_commands_count; ++i)
+    if (strcmp(_shell_commands[i].name, name) == 0)
+      return _shell_commands + i;
+  return NULL;
+}
@@ -0,0 +1,253 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Download sinks - Source file
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "debug.h"
+
+// Binary format: magic, version, then a little-endian header and samples
+#define SINK_BIN_MAGIC "ATMN"
+#define SINK_BIN_VERSION 2
+
+// Writer for a file format
+// Samples are given in interleaved records of 'channels' temperatures
+typedef struct _sink_writer_s {
+  const char *ext;
+  int (*header)(FILE*, uint8_t id, temperature_id_t count,
+      uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels);
+  int (*sample)(FILE*, temperature_id_t index, unsigned period,
+      temperature_t raw, uint8_t channels);
+  int (*footer)(FILE*, temperature_id_t written, uint8_t channels);
+} sink_writer_t;
+
+struct _sink_s {
+  // Callback sink
+  const download_handler_t *handler;
+  void *env;
+
+  // File sink
+  const sink_writer_t *writer;
+  char *dir, *prefix;
+  FILE *fp;                 // File of the DB currently in reception
+  char path[PATH_MAX];      // Final path of the current file
+  char buf[SINK_BUF_SIZE];  // Write buffer, so memory usage is bounded
+  unsigned period;          // Sampling period of the current DB, in ms
+  uint8_t channels;         // Channels of the current DB
+  temperature_id_t written;
+  unsigned checkpoint, since_checkpoint;
+
+  unsigned db_count;        // Number of DBs completely received
+};
+
+
+// Write a 16-bit value as little-endian
+static int _fput_u16(uint16_t val, FILE *fp) {
+  const unsigned char b[2] = { val & 0xFF, val >> 8 };
+  return fwrite(b, 1, 2, fp) == 2 ? 0 : 1;
+}
+
+static int _bin_header(FILE *fp, uint8_t id, temperature_id_t count,
+    uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels) {
+  int err = fwrite(SINK_BIN_MAGIC, 1, 4, fp) != 4;
+  err |= fputc(SINK_BIN_VERSION, fp) == EOF;
+  err |= fputc(id, fp) == EOF;
+  err |= fputc(channels, fp) == EOF;
+  err |= _fput_u16(count, fp);
+  err |= _fput_u16(reg_resolution, fp);
+  err |= _fput_u16(reg_interval, fp);
+  return err;
+}
+
+static int _bin_sample(FILE *fp, temperature_id_t index, unsigned period,
+    temperature_t raw, uint8_t channels) {
+  return _fput_u16(raw, fp);
+}
+
+// A row for each record, with a column for each channel
+static int _csv_header(FILE *fp, uint8_t id, temperature_id_t count,
+    uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels) {
+  if (fprintf(fp, "# tmon database %hhu, %hu temperatures\nseconds", id,
+        count) < 0)
+    return 1;
+  if (channels == 1) return fputs(",celsius\n", fp) == EOF;
+  for (uint8_t c=0; c < channels; ++c)
+    if (fprintf(fp, ",celsius%hhu", c) < 0) return 1;
+  return fputc('\n', fp) == EOF;
+}
+
+static int _csv_sample(FILE *fp, temperature_id_t index, unsigned period,
+    temperature_t raw, uint8_t channels) {
+  const unsigned channel = index % channels;
+  if (channel == 0 &&
+      fprintf(fp, "%.3f", (double) (index / channels) * period / 1000) < 0)
+    return 1;
+  return fprintf(fp, ",%.1f%s", temperature_raw2float(raw),
+      channel == channels - 1 ? "\n" : "") < 0;
+}
+
+// End a truncated last record
+static int _csv_footer(FILE *fp, temperature_id_t written, uint8_t channels) {
+  return (written % channels) ? fputc('\n', fp) == EOF : 0;
+}
+
+static const sink_writer_t sink_writers[] = {
+  [SINK_FORMAT_BIN] = { "bin", _bin_header, _bin_sample, NULL },
+  [SINK_FORMAT_CSV] = { "csv", _csv_header, _csv_sample, _csv_footer }
+};
+
+
+// Flush the current file to the disk
+static int _sink_sync(sink_t *s) {
+  s->since_checkpoint = 0;
+  return (fflush(s->fp) != 0 || fsync(fileno(s->fp)) != 0) ? 1 : 0;
+}
+
+
+// [AUX] Callbacks for download_run(), dispatching to files or user callbacks
+static int _sink_db_begin(void *env, uint8_t id, temperature_id_t count,
+    uint16_t reg_resolution, uint16_t reg_interval, uint8_t channels) {
+  sink_t *s = env;
+  if (s->handler)
+    return s->handler->db_begin ? s->handler->db_begin(s->env, id, count,
+        reg_resolution, reg_interval, channels) : 0;
+
+  char part[PATH_MAX + 8];
+  snprintf(s->path, sizeof(s->path), "%s/%s-%hhu.%s", s->dir, s->prefix, id,
+      s->writer->ext);
+  snprintf(part, sizeof(part), "%s.part", s->path);
+
+  if (!(s->fp = fopen(part, "w"))) {
+    perror(part);
+    return 1;
+  }
+  setvbuf(s->fp, s->buf, _IOFBF, sizeof(s->buf));
+  s->period = (unsigned) reg_resolution * reg_interval;
+  s->channels = channels;
+  s->written = s->since_checkpoint = 0;
+
+  return s->writer->header(s->fp, id, count, reg_resolution, reg_interval,
+      channels);
+}
+
+static int _sink_db_data(void *env, const temperature_t *raw,
+    unsigned count) {
+  sink_t *s = env;
+  if (s->handler)
+    return s->handler->db_data ? s->handler->db_data(s->env, raw, count) : 0;
+
+  for (unsigned i=0; i < count; ++i)
+    if (s->writer->sample(s->fp, s->written++, s->period, raw[i],
+          s->channels) != 0)
+      return 1;
+
+  s->since_checkpoint += count;
+  if (s->checkpoint && s->since_checkpoint >= s->checkpoint)
+    return _sink_sync(s);
+  return 0;
+}
+
+static int _sink_db_end(void *env) {
+  sink_t *s = env;
+  if (s->handler) {
+    if (s->handler->db_end && s->handler->db_end(s->env) != 0)
+      return 1;
+    ++s->db_count;
+    return 0;
+  }
+
+  char part[PATH_MAX + 8];
+  snprintf(part, sizeof(part), "%s.part", s->path);
+
+  int err = s->writer->footer ?
+    s->writer->footer(s->fp, s->written, s->channels) : 0;
+  err |= _sink_sync(s);
+  err |= fclose(s->fp) != 0;
+  s->fp = NULL;
+  if (err || rename(part, s->path) != 0) {
+    perror(s->path);
+    return 1;
+  }
+  ++s->db_count;
+  return 0;
+}
+
+static const download_handler_t sink_handler = {
+  .db_begin = _sink_db_begin,
+  .db_data  = _sink_db_data,
+  .db_end   = _sink_db_end
+};
+
+
+// Create a sink writing every DB to '<dir>/<prefix>-<db_id>.<bin|csv>'
+// Returns a pointer to the new sink, or NULL on failure
+sink_t *sink_file_new(const char *dir, const char *prefix,
+    sink_format_t format, unsigned checkpoint) {
+  if (!dir || !prefix || format > SINK_FORMAT_CSV) return NULL;
+  sink_t *s = malloc(sizeof(sink_t));
+  err_check(!s, NULL, "Unable to use the memory allocator");
+
+  *s = (sink_t) {
+    .writer = sink_writers + format,
+    .dir = strdup(dir),
+    .prefix = strdup(prefix),
+    .checkpoint = checkpoint
+  };
+  if (!s->dir || !s->prefix) {
+    sink_delete(s);
+    error(NULL, "Unable to use the memory allocator");
+  }
+  return s;
+}
+
+
+// Create a sink handing every DB burst to user-defined callbacks
+// Returns a pointer to the new sink, or NULL on failure
+sink_t *sink_callback_new(const download_handler_t *handler, void *env) {
+  if (!handler) return NULL;
+  sink_t *s = malloc(sizeof(sink_t));
+  err_check(!s, NULL, "Unable to use the memory allocator");
+  *s = (sink_t) { .handler = handler, .env = env };
+  return s;
+}
+
+
+// Delete a sink. The file of an incomplete DB is left with its '.part' name
+void sink_delete(sink_t *s) {
+  if (!s) return;
+  if (s->fp) fclose(s->fp);
+  free(s->dir);
+  free(s->prefix);
+  free(s);
+}
+
+
+// Download all the DBs of a connected tmon into a sink
+// Returns a 'download_ret_t' code
+int sink_download(serial_context_t *ctx, sink_t *s) {
+  if (!s) return DOWNLOAD_E_HANDLER;
+  return download_run(ctx, &sink_handler, s);
+}
+
+
+// Get the number of DBs completely written by a sink
+unsigned sink_db_count(const sink_t *s) {
+  return s ? s->db_count : 0;
+}
+
+
+// Parse a format name (i.e. "bin" or "csv")
+// Returns 0 on success, 1 if the format is unknown
+int sink_format_parse(const char *str, sink_format_t *format) {
+  if (!str || !format) return 1;
+  for (size_t i=0; i < sizeof(sink_writers) / sizeof(*sink_writers); ++i)
+    if (strcmp(str, sink_writers[i].ext) == 0) {
+      *format = i;
+      return 0;
+    }
+  return 1;
+}
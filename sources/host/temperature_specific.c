@@ -67,6 +67,41 @@ void temperature_db_set_desc(temperature_db_t *db, const char *desc) {
   db->desc = desc ? strdup(desc) : NULL;
 }
 
+// Set the acquisition time of the first temperature of a database
+void temperature_db_set_anchor(temperature_db_t *db, time_t anchor) {
+  if (db) db->anchor = anchor;
+}
+
+// Get the time between two temperatures of a database, in milliseconds
+unsigned temperature_db_period(const temperature_db_t *db) {
+  return db ? db->reg_resolution * db->reg_interval : 0;
+}
+
+// Get the index of the first temperature registered at or after 't'
+// Returns the index, which is 'used' if there is no such temperature
+unsigned temperature_db_time_index(const temperature_db_t *db, time_t t) {
+  if (!db) return 0;
+  if (t <= db->anchor) return 0;
+
+  // Round up: a temperature registered before 't' is not part of the range
+  const unsigned long long period = temperature_db_period(db);
+  const unsigned long long elapsed_ms = (unsigned long long)(t - db->anchor)
+    * 1000;
+  const unsigned long long index = (elapsed_ms + period - 1) / period;
+  return MIN(index, db->used);
+}
+
+// Get the temperatures registered in the time range [from, to), by reference
+// Returns the number of temperatures in the slice (0 if none or on failure)
+unsigned temperature_db_slice(const temperature_db_t *db, time_t from,
+    time_t to, const float **slice) {
+  if (!db || !slice || from >= to) return 0;
+  const unsigned first = temperature_db_time_index(db, from);
+  const unsigned last = temperature_db_time_index(db, to);
+  *slice = db->items + first;
+  return last - first;
+}
+
 // Register a temperature, given its (wanted) id and its value
 // Returns 0 on success, 1 otherwise
 int temperature_register(temperature_db_t *db, float value) {
@@ -106,6 +141,27 @@ unsigned temperature_register_bulk(temperature_db_t *db,
   return to_reg;
 }
 
+// Register interleaved records into a DB for each channel
+// Returns the number of temperatures registered
+unsigned temperature_register_interleaved(temperature_db_t **dbs,
+    unsigned channels, unsigned *next, unsigned ntemps, const float *src) {
+  if (!dbs || !channels || !next || *next >= channels || !src) return 0;
+  unsigned i;
+  for (i=0; i < ntemps; ++i) {
+    if (temperature_register(dbs[*next], src[i]) != 0) break;
+    if (++*next == channels) *next = 0;
+  }
+  return i;
+}
+
+// Get the number of temperatures of a channel, given the total number of
+// temperatures in interleaved records of 'channels' temperatures
+unsigned temperature_channel_count(unsigned count, unsigned channels,
+    unsigned channel) {
+  if (!channels || channel >= channels) return 0;
+  return count / channels + (channel < count % channels ? 1 : 0);
+}
+
 
 // Export a temperature database as a text file containing newline separated
 // strings, representing the temperatures.
@@ -139,7 +195,10 @@ int temperature_db_export(const temperature_db_t *db, const char *fpath) {
 
 
 // Convert a raw temperature coming from the avrtmon to a float
-float temperature_raw2float(uint16_t raw) { return ((float) raw) / 10; }
+// One unit is 2560mV / 2^TEMPERATURE_RAW_BITS, and the LM35 gives 10mV/C
+float temperature_raw2float(uint16_t raw) {
+  return ((float) raw) * 256 / (1 << TEMPERATURE_RAW_BITS);
+}
 
 
 // Print a database
@@ -147,7 +206,8 @@ void temperature_db_print(const temperature_db_t *db) {
   if (!db)
     printf("Tried to print a NULL temperature database\n");
   else
-    printf("Database %u\n%s\nSize: %u\nUsed: %u\nInterval (ms): %u\n\n",
-        db->id, db->desc ? db->desc : "[No description]", db->size, db->used,
-        db->reg_resolution * db->reg_interval);
+    printf("Database %u\n%s\nSize: %u\nUsed: %u\nInterval (ms): %u\n"
+        "Start: %s\n", db->id, db->desc ? db->desc : "[No description]",
+        db->size, db->used, temperature_db_period(db),
+        db->anchor ? ctime(&db->anchor) : "[Unknown]\n");
 }
@@ -2,6 +2,7 @@
 // Packet-switched communication layer - Packet interface - Source file
 #include <string.h>
 #include "packet.h"
+#include "progmem.h"
 
 // Bit fields parameter for the downstainding base type
 #define BITFIELD_BASE_TYPE uint8_t
@@ -50,28 +51,47 @@ static inline void attach_header_parity(packet_t *p) {
 // Note that the passed data is sent 'as is', without caring about endianess
 uint8_t packet_craft(uint8_t id, packet_type_t type, const uint8_t *data,
     uint8_t data_size, packet_t *dest) {
+  const uint8_t base_type = type & ~PACKET_CRC_WIDE;
+  if ((base_type <= 2 && data) || !dest || (!data && data_size) ||
+      data_size > packet_data_max_size(type & PACKET_CRC_WIDE))
+    return 1;
+
+  // Fill data buffer (without CRC)
+  for (uint8_t i=0; i < data_size; ++i)
+    dest->data[i] = data[i];
+
+  return packet_seal(dest, id, type, data_size);
+}
+
+
+// Build a packet in place, with its data already in 'p->data'
+uint8_t packet_seal(packet_t *p, uint8_t id, packet_type_t type,
+    uint8_t data_size) {
+  const uint8_t wide = type & PACKET_CRC_WIDE;
+  type &= ~PACKET_CRC_WIDE;
 
   // Check against malformed parameters
-  if ((type <= 2 && (data || data_size)) || type > PACKET_TYPE_COUNT || !dest ||
-      (!data && data_size) || data_size > PACKET_DATA_MAX_SIZE ||
+  if ((type <= 2 && data_size) || type >= PACKET_TYPE_COUNT || !p ||
+      data_size > packet_data_max_size(wide) ||
       (type == PACKET_TYPE_HND && id != 0))
     return 1;
 
   // Initialize header
-  packet_set_type(dest, type);
-  packet_set_id(dest, id);
-  packet_set_size(dest, PACKET_HEADER_SIZE + data_size + sizeof(crc_t));
+  packet_set_type(p, type | wide);
+  packet_set_id(p, id);
+  packet_set_size(p, PACKET_HEADER_SIZE + data_size + packet_crc_size(p));
 
   // Compute packet header parity
-  attach_header_parity(dest);
-
-  // Fill data buffer (without CRC)
-  for (uint8_t i=0; i < data_size; ++i)
-    dest->data[i] = data[i];
-
-  // Attach the CRC
-  crc_t *crc_p = (crc_t*)(dest->data + data_size);
-  (*crc_p) = crc(dest, packet_get_size(dest) - sizeof(crc_t));
+  attach_header_parity(p);
+
+  // Attach the CRC, least significant byte first
+  const uint8_t covered = PACKET_HEADER_SIZE + data_size;
+  if (!wide) p->data[data_size] = crc(p, covered);
+  else {
+    crc_wide_t crc = crc_wide(p, covered);
+    for (uint8_t i=0; i < sizeof(crc_wide_t); ++i, crc >>= 8)
+      p->data[data_size + i] = crc & 0xFF;
+  }
 
   return 0;
 }
@@ -79,12 +99,14 @@ uint8_t packet_craft(uint8_t id, packet_type_t type, const uint8_t *data,
 
 // Same as above, but takes a packet instead of an id
 uint8_t packet_ack(const packet_t *p, packet_t *dest) {
-  return p ? packet_craft(packet_get_id(p), PACKET_TYPE_ACK, NULL, 0, dest) : 1;
+  return p ? packet_craft(packet_get_id(p), PACKET_TYPE_ACK |
+      packet_crc_wide(p), NULL, 0, dest) : 1;
 }
 
 // Send an error packet (relative to a packet_t structure)
 uint8_t packet_err(const packet_t *p, packet_t *dest) {
-  return p ? packet_craft(packet_get_id(p), PACKET_TYPE_ERR, NULL, 0, dest) : 1;
+  return p ? packet_craft(packet_get_id(p), PACKET_TYPE_ERR |
+      packet_crc_wide(p), NULL, 0, dest) : 1;
 }
 
 
@@ -92,15 +114,46 @@ uint8_t packet_err(const packet_t *p, packet_t *dest) {
 // Returns 0 if the packet is sane, 1 if it is corrupted
 // It is assumed that the header is sane
 uint8_t packet_check_crc(const packet_t *p) {
-  return (!p || crc_check(p, packet_get_size(p)) != 0) ? 1 : 0;
+  if (!p) return 1;
+  if (packet_crc_wide(p))
+    return crc_wide_check(p, packet_get_size(p)) != 0 ? 1 : 0;
+  return crc_check(p, packet_get_size(p)) != 0 ? 1 : 0;
+}
+
+// Correct a single flipped bit in a packet protected by the wide CRC
+// Returns 0 if the packet is sane, 1 if it could not be corrected
+uint8_t packet_correct(packet_t *p, uint8_t size) {
+  if (!p || size < PACKET_HEADER_SIZE + sizeof(crc_wide_t) ||
+      size > sizeof(packet_t))
+    return 1;
+
+  uint8_t *raw = (uint8_t*) p, flipped = 0, mask = 0;
+  const crc_wide_t syndrome = crc_wide_check(p, size);
+  if (syndrome) {
+    const int32_t bit = crc_wide_locate(syndrome, size);
+    if (bit < 0) return 1;
+    flipped = bit >> 3;
+    mask = 1 << (bit & 7);
+    raw[flipped] ^= mask;
+  }
+
+  // The corrected packet must be the one which was received
+  if (!packet_crc_wide(p) || packet_get_size(p) != size ||
+      packet_check_header(p) != 0) {
+    raw[flipped] ^= mask;
+    return 1;
+  }
+  return 0;
 }
 
 // Check the sanity of a packet header
 // Returns 0 if the packet is sane, 1 otherwise
 uint8_t packet_check_header(const packet_t *p) {
   const uint8_t size = packet_get_size(p);
-  if (p && size >= PACKET_MIN_SIZE && size <= PACKET_MAX_SIZE &&
-      (packet_brings_data(p) || size == PACKET_MIN_SIZE)
+  const uint8_t min_size = PACKET_HEADER_SIZE + packet_crc_size(p);
+  if (p && size >= min_size &&
+      size - min_size <= packet_data_max_size(packet_crc_wide(p)) &&
+      (packet_brings_data(p) || size == min_size)
       && packet_header_parity(p) == 0)
     return 0;
   return 1;
@@ -116,21 +169,22 @@ uint8_t packet_header_parity(const packet_t *packet) {
   const uint8_t *p = (const uint8_t*) packet;
 
   // Count set bits in a nibble in constant time
-  static const uint8_t nibble_bitcount_tab[] = {
+  static const uint8_t nibble_bitcount_tab[] PROGMEM = {
     0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
   };
+#define nibble_bitcount(n) pgm_read_byte(nibble_bitcount_tab + (n))
 
   // Compute parity - loop unrolled optimized if PACKET_HEADER_SIZE == 2
   uint8_t bits_set = 0;
 #if PACKET_HEADER_SIZE == 2
-  bits_set += nibble_bitcount_tab[p[0] & 0x0F];
-  bits_set += nibble_bitcount_tab[p[0] >> 4  ];
-  bits_set += nibble_bitcount_tab[p[1] & 0x0F];
-  bits_set += nibble_bitcount_tab[p[1] >> 4  ];
+  bits_set += nibble_bitcount(p[0] & 0x0F);
+  bits_set += nibble_bitcount(p[0] >> 4  );
+  bits_set += nibble_bitcount(p[1] & 0x0F);
+  bits_set += nibble_bitcount(p[1] >> 4  );
 #else
   for (uint8_t i=0; i < PACKET_HEADER_SIZE; ++i) {
-    bits_set += nibble_bitcount_tab[p[i] & 0x0F];
-    bits_set += nibble_bitcount_tab[p[i] >> 4  ];
+    bits_set += nibble_bitcount(p[i] & 0x0F);
+    bits_set += nibble_bitcount(p[i] >> 4  );
   }
 #endif
 
@@ -146,7 +200,10 @@ uint8_t packet_brings_data(const packet_t *p) {
 
 // Getters for packet header fields
 uint8_t packet_get_type(const packet_t *p) {
-  return p ? _bitfield_get(p->header[0], 4, 7) : 0;
+  return p ? _bitfield_get(p->header[0], 4, 6) : 0;
+}
+uint8_t packet_crc_wide(const packet_t *p) {
+  return (p && (p->header[0] & 0x80)) ? PACKET_CRC_WIDE : 0;
 }
 uint8_t packet_get_id(const packet_t *p) {
   return p ? _bitfield_get(p->header[0], 0, 3) : 0;
@@ -160,7 +217,12 @@ uint8_t packet_get_header_par(const packet_t *p) {
 
 // Compute the data size of a packet
 uint8_t packet_data_size(const packet_t *p) {
-  return p ? packet_get_size(p) - PACKET_HEADER_SIZE - sizeof(crc_t) : 0;
+  return p ? packet_get_size(p) - PACKET_HEADER_SIZE - packet_crc_size(p) : 0;
+}
+
+// Get the size of the trailing CRC of a packet
+uint8_t packet_crc_size(const packet_t *p) {
+  return packet_crc_wide(p) ? sizeof(crc_wide_t) : sizeof(crc_t);
 }
 
 
@@ -191,15 +253,15 @@ void packet_print(const packet_t *p) {
   const uint8_t type = packet_get_type(p);
 
   static const char type_str[PACKET_TYPE_COUNT][4] = {
-    "HND", "ACK", "ERR", "CMD", "CTR", "DAT" };
+    "HND", "ACK", "ERR", "CMD", "CTR", "DAT", "BLK" };
 
   printf("\nPrinting packet\n"
          "Type: %s\n"
          "ID  : %d\n"
          "Size: %d\n"
-         "CRC : %hhx\n",
+         "CRC : %s\n",
       type >= PACKET_TYPE_COUNT ? "UNKNOWN" : type_str[type], id, size,
-      ((uint8_t*) p)[size - 1]);
+      packet_crc_wide(p) ? CRC_WIDE_NAME : CRC_NAME);
 
   printf("Raw Data (hex):");
   for (uint8_t i=0; i < size; ++i)
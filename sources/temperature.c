@@ -6,6 +6,7 @@
 //   uint16_t reg_resolution;
 //   uint16_t reg_interval;
 //   uint8_t  id;
+//   uint8_t  channels;
 // } temperature_db_info_t;
 #define __TEMPERATURE_INDEPENDENT // Do not load specific implementations
 #include "temperature.h"
@@ -25,24 +26,30 @@
 #define ADDR_ID(info)\
   ((uint8_t*)(VOID(info)+sizeof(temperature_id_t)+2*sizeof(uint16_t)))
 
+#define ADDR_CHANNELS(info)\
+  ((uint8_t*)(VOID(info)+sizeof(temperature_id_t)+2*sizeof(uint16_t)+1))
+
 
 // Pack a data stucture of fixed, machine-independent size containing info on
 // a temperature database
 // Returns 0 on success, 1 if 'dest' is not valid
 uint8_t temperature_db_info_pack(temperature_db_info_t dest, uint8_t id,
-    temperature_id_t count, uint16_t reg_resolution, uint16_t reg_interval) {
+    temperature_id_t count, uint16_t reg_resolution, uint16_t reg_interval,
+    uint8_t channels) {
   if (!dest) return 1;
   *ADDR_COUNT(dest) = count;
   *ADDR_REG_RESOLUTION(dest) = reg_resolution;
   *ADDR_REG_INTERVAL(dest) = reg_interval;
   *ADDR_ID(dest) = id;
+  *ADDR_CHANNELS(dest) = channels;
   return 0;
 }
 
 // Extract data from a packet database info structure
 // Returns 0 on success, 1 if some pointer is not valid
 uint8_t temperature_db_info_extract(const temperature_db_info_t src, uint8_t *id,
-    temperature_id_t *count, uint16_t *reg_resolution, uint16_t *reg_interval) {
+    temperature_id_t *count, uint16_t *reg_resolution, uint16_t *reg_interval,
+    uint8_t *channels) {
   if (!src) return 1;
   if (count)
     *count = *ADDR_COUNT(src);
@@ -52,5 +59,7 @@ uint8_t temperature_db_info_extract(const temperature_db_info_t src, uint8_t *id
     *reg_interval = *ADDR_REG_INTERVAL(src);
   if (id)
     *id = *ADDR_ID(src);
+  if (channels)
+    *channels = *ADDR_CHANNELS(src);
   return 0;
 }
@@ -4,6 +4,7 @@
 #include "communication.h"
 
 // Command name -- You ought choose something in the form 'cmd_something'
+// The command lives in the program memory, add it to the table in 'command.c'
 #define COMMAND_NAME cmd_foo
 
 
@@ -46,12 +47,12 @@ static uint8_t _op_dat(const packet_t *p) {
 // Replace unrequired functions with NULL
 // WARNING: With NULL, the communication layer will fallback to a default
 // operation (which is good), but with an existent yet dummy function it won't!
-static const com_operation_f _opmode[] = {
+static const com_operation_f _opmode[] PROGMEM = {
   NULL, NULL, NULL, _op_cmd, _op_ctr, _op_dat
 };
 */
 
-static command_t COMMAND_NAME = {
+const command_t COMMAND_NAME PROGMEM = {
   .start   = /* _start   or NULL */;
   .iterate = /* _iterate or NULL */;
   .opmode  = /* _opmode  or NULL */;
@@ -18,3 +18,6 @@ nvm_image_t NVMMEM _nvm_image = {
 
 // Pointer to the memory image, relative to the .eeprom section
 nvm_image_t *_nvm_image_ptr = &_nvm_image;
+
+// NVM backend in use
+const nvm_backend_t *nvm_backend = NVM_BACKEND_DEFAULT;
@@ -0,0 +1,101 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperature aggregation - Test Unit
+#include <math.h>
+#include "test_framework.h"
+#include "temperature.h"
+#include "aggregate.h"
+
+#define DB_SIZE 100
+#define DB_COUNT 4
+#define DB_RESOLUTION 1000  // A temperature every second
+#define DB_INTERVAL 1
+#define DB_ANCHOR 1000000
+
+#define float_eq(a,b) (fabs((a) - (b)) < 0.001)
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - Temperature Aggregation Unit Test\n");
+  const float items[] = { 3, -1, 4, 1, 5, 9, 2, 6, 5, 3, 5 };
+  const unsigned nitems = sizeof(items) / sizeof(*items);
+  aggregate_t a;
+  unsigned window;
+  int ret;
+
+
+  printf("\nTesting aggregate_kernel()\n");
+  a = aggregate_kernel(items, nitems);
+  test_expr(a.count == nitems, "Count should be consistent");
+  test_expr(a.min == -1 && a.max == 9, "Min and max should be consistent "
+      "(%.1f, %.1f)", a.min, a.max);
+  test_expr(float_eq(a.mean, 42.0 / nitems), "Mean should be consistent");
+  a = aggregate_kernel(items + 5, 1);
+  test_expr(a.count == 1 && a.min == 9 && a.max == 9 && a.mean == 9,
+      "A single temperature should be min, max and mean");
+  a = aggregate_kernel(items, 0);
+  test_expr(a.count == 0, "No temperatures should give an empty summary");
+
+
+  printf("\nTesting aggregate_window_parse()\n");
+  ret = aggregate_window_parse("90", &window);
+  test_expr(ret == 0 && window == 90, "Plain seconds should be parsed");
+  ret = aggregate_window_parse("2h", &window);
+  test_expr(ret == 0 && window == 7200, "Hours should be parsed");
+  ret = aggregate_window_parse("1d", &window);
+  test_expr(ret == 0 && window == 86400, "Days should be parsed");
+  test_expr(aggregate_window_parse("0", &window) != 0,
+      "Empty window should be rejected");
+  test_expr(aggregate_window_parse("3x", &window) != 0,
+      "Unknown suffix should be rejected");
+  test_expr(aggregate_window_parse("1hh", &window) != 0,
+      "Trailing garbage should be rejected");
+
+
+  // Populate some databases, with temperatures equal to their index
+  temperature_db_t *dbs[DB_COUNT];
+  for (unsigned d=0; d < DB_COUNT; ++d) {
+    dbs[d] = temperature_db_new(d, DB_SIZE, DB_RESOLUTION, DB_INTERVAL, NULL);
+    for (unsigned i=0; i < DB_SIZE; ++i)
+      temperature_register(dbs[d], i + d);
+    temperature_db_set_anchor(dbs[d], DB_ANCHOR);
+  }
+
+  printf("\nTesting aggregate_db()\n");
+  aggregate_db_t agg;
+  ret = aggregate_db(dbs[0], 30, &agg);
+  test_expr(ret == 0, "Aggregation should be successful");
+  test_expr(agg.nbuckets == 4, "There should be 4 buckets (%u found)",
+      agg.nbuckets);
+  test_expr(agg.buckets[0].count == 30 && agg.buckets[3].count == 10,
+      "The last bucket should be partial");
+  test_expr(agg.buckets[1].min == 30 && agg.buckets[1].max == 59 &&
+      float_eq(agg.buckets[1].mean, 44.5), "Bucket summary should be "
+      "consistent");
+  test_expr(agg.buckets[2].start == DB_ANCHOR + 60,
+      "Bucket start time should be consistent");
+  aggregate_db_clear(&agg);
+
+  ret = aggregate_db(dbs[0], 1000, &agg);
+  test_expr(ret == 0 && agg.nbuckets == 1 && agg.buckets[0].count == DB_SIZE,
+      "A window longer than the database should give a single bucket");
+  aggregate_db_clear(&agg);
+
+
+  printf("\nTesting aggregate_db_parallel()\n");
+  aggregate_db_t aggs[DB_COUNT];
+  ret = aggregate_db_parallel(dbs, DB_COUNT, 50, aggs);
+  test_expr(ret == 0, "Parallel aggregation should be successful");
+  for (unsigned d=0; d < DB_COUNT; ++d) {
+    test_expr(aggs[d].db == dbs[d] && aggs[d].nbuckets == 2,
+        "Database %u should be aggregated in 2 buckets", d);
+    test_expr(aggs[d].buckets[1].min == 50 + d,
+        "Database %u buckets should be consistent", d);
+    aggregate_db_clear(aggs + d);
+  }
+
+
+  for (unsigned d=0; d < DB_COUNT; ++d)
+    temperature_db_delete(dbs[d]);
+  test_summary();
+  return 0;
+}
@@ -0,0 +1,106 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Temperature database (host side) - Test Unit
+#include "test_framework.h"
+#include "temperature.h"
+
+#define DB_SIZE 100
+#define DB_RESOLUTION 500  // A temperature every 500ms * 4 = 2 seconds
+#define DB_INTERVAL 4
+#define DB_ANCHOR 1000000
+#define CHANNELS 3
+#define RECORDS_SIZE 31  // Interleaved temperatures, the last record truncated
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - Host-side Temperature Database Unit Test\n");
+  const float *slice;
+  unsigned count;
+
+  // Populate a database
+  temperature_db_t *db = temperature_db_new(0, DB_SIZE, DB_RESOLUTION,
+      DB_INTERVAL, NULL);
+  test_expr(db != NULL, "New database should be created successfully");
+  for (unsigned i=0; i < DB_SIZE; ++i)
+    temperature_register(db, i);
+  temperature_db_set_anchor(db, DB_ANCHOR);
+
+
+  printf("\nTesting temperature_db_time_index()\n");
+  test_expr(temperature_db_period(db) == 2000,
+      "Sampling period should be of 2000ms");
+  test_expr(temperature_db_time_index(db, 0) == 0,
+      "A time before the anchor should give the first temperature");
+  test_expr(temperature_db_time_index(db, DB_ANCHOR) == 0,
+      "The anchor should give the first temperature");
+  test_expr(temperature_db_time_index(db, DB_ANCHOR + 1) == 1,
+      "A time between two temperatures should give the latter");
+  test_expr(temperature_db_time_index(db, DB_ANCHOR + 10) == 5,
+      "An exact time should give its temperature");
+  test_expr(temperature_db_time_index(db, DB_ANCHOR + 1000) == DB_SIZE,
+      "A time after the last temperature should give the number of them");
+
+
+  printf("\nTesting temperature_db_slice()\n");
+  count = temperature_db_slice(db, DB_ANCHOR + 10, DB_ANCHOR + 20, &slice);
+  test_expr(count == 5, "Slice [+10s, +20s) should have 5 temperatures "
+      "(%u found)", count);
+  test_expr(slice == db->items + 5,
+      "Slice should reference the database items (zero-copy)");
+  test_expr(slice[0] == 5 && slice[count-1] == 9,
+      "Slice bounds should be consistent");
+
+  count = temperature_db_slice(db, DB_ANCHOR + 150, DB_ANCHOR + 1000, &slice);
+  test_expr(count == DB_SIZE - 75, "Slice should be truncated at the end of "
+      "the database (%u found)", count);
+
+  count = temperature_db_slice(db, DB_ANCHOR - 100, DB_ANCHOR - 10, &slice);
+  test_expr(count == 0, "Slice before the anchor should be empty");
+  count = temperature_db_slice(db, DB_ANCHOR + 20, DB_ANCHOR + 10, &slice);
+  test_expr(count == 0, "Slice with reversed bounds should be empty");
+  count = temperature_db_slice(NULL, DB_ANCHOR, DB_ANCHOR + 10, &slice);
+  test_expr(count == 0, "Slice of a NULL database should be empty");
+
+
+  temperature_db_delete(db);
+
+
+  printf("\nTesting interleaved records\n");
+  temperature_db_t *dbs[CHANNELS];
+  float records[RECORDS_SIZE];
+  for (unsigned i=0; i < RECORDS_SIZE; ++i)
+    records[i] = (i % CHANNELS) * 100 + i / CHANNELS;  // Channel, record
+
+  int ret = 1;
+  for (unsigned c=0; c < CHANNELS; ++c) {
+    const unsigned size = temperature_channel_count(RECORDS_SIZE, CHANNELS, c);
+    if (size != RECORDS_SIZE / CHANNELS + (c == 0)) ret = 0;
+    dbs[c] = temperature_db_new(c, size, DB_RESOLUTION, DB_INTERVAL, NULL);
+  }
+  test_expr(ret, "Only the first channel should have the truncated record");
+  test_expr(temperature_channel_count(2, CHANNELS, 2) == 0 &&
+      temperature_channel_count(RECORDS_SIZE, CHANNELS, CHANNELS) == 0,
+      "Missing channels should have no temperatures");
+
+  // Split the records across bursts which do not end with a record
+  unsigned next = 0, registered = 0;
+  for (unsigned i=0; i < RECORDS_SIZE; i += 7)
+    registered += temperature_register_interleaved(dbs, CHANNELS, &next,
+        RECORDS_SIZE - i < 7 ? RECORDS_SIZE - i : 7, records + i);
+  test_expr(registered == RECORDS_SIZE && next == RECORDS_SIZE % CHANNELS,
+      "Every interleaved temperature should be registered (%u)", registered);
+
+  ret = 1;
+  for (unsigned c=0; c < CHANNELS; ++c) {
+    if (dbs[c]->used != dbs[c]->size) ret = 0;
+    for (unsigned i=0; i < dbs[c]->used; ++i)
+      if (dbs[c]->items[i] != c * 100 + i) ret = 0;
+  }
+  test_expr(ret, "Each channel DB should hold its own temperatures, in order");
+  test_expr(temperature_register_interleaved(dbs, CHANNELS, &next, 1,
+        records) == 0, "Registering should stop when a channel DB is full");
+
+  for (unsigned c=0; c < CHANNELS; ++c)
+    temperature_db_delete(dbs[c]);
+  test_summary();
+  return 0;
+}
@@ -10,24 +10,40 @@
 // EEMEM expands to nothing
 #define NVMMEM
 
-// Pointer to the (mock and emulated) NVM memory image
-nvm_image_t *nvm_image;
+// Size of the (mock and emulated) NVM memory
+#define NVM_MOCK_SIZE 4096
 
 
-// Initialize mock NVM module
+// Initialize mock NVM module, making it the NVM backend in use
 // Every bit of uninitialized NVM data is set to 1, as in a real EEPROM
+// As in a real EEPROM, 'update' writes only the bytes which differ, while
+// asynchronous writes are performed synchronously
 void nvm_mock_init(void);
 
-// Read/Write functions
-void _nvm_read(void *dest, const void *src, size_t size);
-void _nvm_write(void *dest, const void *src, size_t size);
-
-// Emulate the real NVM module, with out-of-the-box compatibility for your
-// application modules
-#define nvm_read _nvm_read
-#define nvm_write _nvm_write
-#define nvm_update _nvm_write
-#define nvm_ongoing() 0;
-#define nvm_busy_wait() do {} while (0)
+
+// Write-count histogram, to verify the wear of the NVM
+// Each byte keeps the number of times it was written, since the last reset
+
+// Get the number of writes of a single byte
+unsigned long nvm_mock_writes(const void *addr);
+
+// Get the maximum number of writes among the bytes in [addr, addr+size)
+unsigned long nvm_mock_writes_max(const void *addr, size_t size);
+
+// Get the total number of byte writes
+unsigned long nvm_mock_writes_total(void);
+
+// Reset the write-count histogram
+void nvm_mock_writes_reset(void);
+
+
+// Read counter, to measure the accesses needed by the application modules
+// Each call to 'nvm_read' counts as one, regardless of its size
+
+// Get the number of reads since the last reset
+unsigned long nvm_mock_reads(void);
+
+// Reset the read counter
+void nvm_mock_reads_reset(void);
 
 #endif    // __NVM_INTERFACE_MOCK_H
@@ -12,26 +12,117 @@
 #include "nvm.h"
 
 
-unsigned char mock_nvm[NVM_SIZE];
-nvm_image_t *nvm_image = (nvm_image_t*) mock_nvm;
+static unsigned char mock_nvm[NVM_MOCK_SIZE];
 
-// Initialize mock NVM module
+// Write-count histogram, one counter for each byte
+static unsigned long mock_nvm_writes[NVM_MOCK_SIZE];
+#define mock_nvm_offset(addr) ((const unsigned char*) (addr) - mock_nvm)
+
+// Number of 'nvm_read' calls
+static unsigned long mock_nvm_reads;
+
+static void _mock_read(void *dest, const void *src, size_t size);
+static void _mock_write(void *dest, const void *src, size_t size);
+static void _mock_update(void *dest, const void *src, size_t size);
+static uint8_t _mock_pending(void) { return 0; }
+static void _mock_wait(void) { }
+
+// Mock backend. Asynchronous writes are performed synchronously, so they are
+// never pending
+static const nvm_backend_t mock_backend = {
+  .base = mock_nvm,
+  .size = NVM_MOCK_SIZE,
+  .erase_block = 1,
+  .read = _mock_read,
+  .write = _mock_write,
+  .update = _mock_update,
+  .update_async = _mock_update,
+  .pending = _mock_pending,
+  .wait = _mock_wait
+};
+
+
+// Initialize mock NVM module, making it the NVM backend in use
 // Every bit of uninitialized NVM data is set to 1, as in a real EEPROM
 void nvm_mock_init(void) {
-  memset(mock_nvm, 0xFF, NVM_SIZE);
+  nvm_backend = &mock_backend;
+  memset(mock_nvm, 0xFF, NVM_MOCK_SIZE);
   memcpy(mock_nvm, _nvm_image_ptr, sizeof(nvm_image_t));
+  nvm_mock_writes_reset();
+  nvm_mock_reads_reset();
 }
 
-void nvm_read(void *dest, const void *src, size_t size) {
+static void _mock_read(void *dest, const void *src, size_t size) {
   if (src < ((void*) nvm_image) || src + size - 1 > NVM_LIMIT)
     printf("Mock NVM error at function %s with dest=%p src=%p size=%d\n",
         __func__, dest, src, size);
-  else memcpy(dest, src, size);
+  else {
+    memcpy(dest, src, size);
+    mock_nvm_reads++;
+  }
+}
+
+static void _mock_write(void *dest, const void *src, size_t size) {
+  if (dest < ((void*) nvm_image) || dest + size - 1 > NVM_LIMIT)
+    printf("Mock NVM error at function %s with dest=%p src=%p size=%d\n",
+        __func__, dest, src, size);
+  else {
+    memcpy(dest, src, size);
+    for (size_t i=0; i < size; ++i)
+      mock_nvm_writes[mock_nvm_offset(dest) + i]++;
+  }
 }
 
-void nvm_write(void *dest, const void *src, size_t size) {
+static void _mock_update(void *dest, const void *src, size_t size) {
   if (dest < ((void*) nvm_image) || dest + size - 1 > NVM_LIMIT)
     printf("Mock NVM error at function %s with dest=%p src=%p size=%d\n",
         __func__, dest, src, size);
-  else memcpy(dest, src, size);
+  else {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    for (size_t i=0; i < size; ++i)
+      if (d[i] != s[i]) {
+        d[i] = s[i];
+        mock_nvm_writes[mock_nvm_offset(d) + i]++;
+      }
+  }
+}
+
+
+// Get the number of writes of a single byte
+unsigned long nvm_mock_writes(const void *addr) {
+  return mock_nvm_writes[mock_nvm_offset(addr)];
+}
+
+// Get the maximum number of writes among the bytes in [addr, addr+size)
+unsigned long nvm_mock_writes_max(const void *addr, size_t size) {
+  unsigned long max = 0;
+  for (size_t i=0; i < size; ++i)
+    if (mock_nvm_writes[mock_nvm_offset(addr) + i] > max)
+      max = mock_nvm_writes[mock_nvm_offset(addr) + i];
+  return max;
+}
+
+// Get the total number of byte writes
+unsigned long nvm_mock_writes_total(void) {
+  unsigned long total = 0;
+  for (size_t i=0; i < NVM_MOCK_SIZE; ++i)
+    total += mock_nvm_writes[i];
+  return total;
+}
+
+// Reset the write-count histogram
+void nvm_mock_writes_reset(void) {
+  memset(mock_nvm_writes, 0, sizeof(mock_nvm_writes));
+}
+
+
+// Get the number of reads since the last reset
+unsigned long nvm_mock_reads(void) {
+  return mock_nvm_reads;
+}
+
+// Reset the read counter
+void nvm_mock_reads_reset(void) {
+  mock_nvm_reads = 0;
 }
@@ -1,22 +1,44 @@
 // AVR Temperature Monitor -- Paolo Lucchesi
 // Packet-switched communication layer - CRC - Test Unit
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "test_framework.h"
 
 #include "crc.h"
 
+#define BENCH_SIZE (4UL << 20)  // Bytes processed by the throughput benchmark
+#define BENCH_ROUNDS 8
+
+
+// Compute the wide CRC one byte at a time, i.e. as the AVR does
+static crc_wide_t crc_wide_bytewise(const uint8_t *data, size_t size) {
+  crc_wide_t running = CRC_WIDE_INIT;
+  for (size_t i=0; i < size; ++i)
+    running = crc_wide_update(running, data[i]);
+  return running ^ CRC_WIDE_XOROUT;
+}
+
+// Get a monotonic timestamp, in seconds
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 
 int main(int argc, const char *argv[]) {
   // Print informations about the CRC algorithm
   printf("avrtmon - CRC Unit Test\n\n"
          "CRC_NAME: %s\n"
          "CRC_POLY: 0x%2x\n"
-         "CRC_INIT: 0x%2x\n\n",
-         CRC_NAME, CRC_POLY, CRC_INIT);
+         "CRC_INIT: 0x%2x\n"
+         "CRC_WIDE: %s, %s kernel\n\n",
+         CRC_NAME, CRC_POLY, CRC_INIT, CRC_WIDE_NAME, crc_wide_kernel());
 
   // Leave room for trailing CRC (needed later)
-  char s[] = "123456789";
+  char s[16] = "123456789";
   size_t s_len = strlen(s);
 
   // Test CRC computation
@@ -27,11 +49,90 @@ int main(int argc, const char *argv[]) {
 
   // Test error checking
   s[s_len] = CRC_CHECK;
-  s[s_len+1] = '\0';
   crc_t crc_check_result = crc_check(s, s_len + 1);
   test_expr(crc_check_result == 0,
       "Error checking should work (crc_check returned %d)", crc_check_result);
 
+  // Test incremental computation and checking
+  crc_t running = CRC_INIT;
+  for (size_t i=0; i < s_len; ++i)
+    running = crc_update(running, s[i]);
+  test_expr(running == CRC_CHECK,
+      "Incremental CRC should match the expected one");
+  running = CRC_INIT;
+  for (size_t i=0; i <= s_len; ++i)
+    running = crc_update(running, s[i]);
+  test_expr(running == CRC_RESIDUE,
+      "Incremental error checking should match crc_check");
+
+
+  // Test the wide CRC, stored least significant byte first
+  printf("\nTesting the wide CRC\n");
+  const crc_wide_t wide = crc_wide(s, s_len);
+  test_expr(wide == CRC_WIDE_CHECK, "Wide CRC should match the expected one "
+      "(0x%lx computed, 0x%lx expected)", (unsigned long) wide,
+      (unsigned long) CRC_WIDE_CHECK);
+  for (uint8_t i=0; i < sizeof(crc_wide_t); ++i)
+    s[s_len + i] = (wide >> (8 * i)) & 0xFF;
+  test_expr(crc_wide_check(s, s_len + sizeof(crc_wide_t)) == 0,
+      "Wide error checking should work");
+  s[2] ^= 0x10;
+  test_expr(crc_wide_check(s, s_len + sizeof(crc_wide_t)) != 0,
+      "Wide error checking should detect a corrupted message");
+  s[2] ^= 0x10;
+
+  crc_wide_t running_wide = CRC_WIDE_INIT;
+  for (size_t i=0; i < s_len + sizeof(crc_wide_t); ++i)
+    running_wide = crc_wide_update(running_wide, s[i]);
+  test_expr(running_wide == CRC_WIDE_RESIDUE,
+      "Incremental wide error checking should end in the residue");
+
+
+  // The bulk kernel must agree with the byte-wise algorithm for any length
+  // and alignment, so it can check what the AVR computed
+  uint8_t *buf = malloc(BENCH_SIZE);
+  if (!buf) return 1;
+  srand(0xC4C);
+  for (size_t i=0; i < BENCH_SIZE; ++i)
+    buf[i] = rand();
+
+  int ret = 1;
+  for (size_t offset=0; offset < 8; ++offset)
+    for (size_t len=0; len < 80; ++len)
+      if (crc_wide(buf + offset, len) != crc_wide_bytewise(buf + offset, len))
+        ret = 0;
+  test_expr(ret, "The %s kernel should match the byte-wise algorithm",
+      crc_wide_kernel());
+
+
+  // Throughput benchmark
+  printf("\nThroughput over %lu MiB, %d rounds\n", BENCH_SIZE >> 20,
+      BENCH_ROUNDS);
+  volatile crc_wide_t sink = 0;
+  double start = now();
+  for (int r=0; r < BENCH_ROUNDS; ++r)
+    sink ^= crc(buf, BENCH_SIZE);
+  const double t_crc8 = now() - start;
+
+  start = now();
+  for (int r=0; r < BENCH_ROUNDS; ++r)
+    sink ^= crc_wide_bytewise(buf, BENCH_SIZE);
+  const double t_bytewise = now() - start;
+
+  start = now();
+  for (int r=0; r < BENCH_ROUNDS; ++r)
+    sink ^= crc_wide(buf, BENCH_SIZE);
+  const double t_kernel = now() - start;
+
+  const double mib = (double) BENCH_ROUNDS * BENCH_SIZE / (1 << 20);
+  printf("%-24s %10.1f MiB/s\n", CRC_NAME, mib / t_crc8);
+  printf("%-24s %10.1f MiB/s (byte-wise)\n", CRC_WIDE_NAME, mib / t_bytewise);
+  printf("%-24s %10.1f MiB/s (%s)\n", CRC_WIDE_NAME, mib / t_kernel,
+      crc_wide_kernel());
+  test_expr(t_kernel < t_bytewise,
+      "The bulk kernel should be faster than the byte-wise algorithm");
+
+  free(buf);
   test_summary();
   return 0;
 }
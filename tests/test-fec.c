@@ -0,0 +1,237 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Packet-switched communication layer - Forward error correction - Test Unit
+// Besides checking the correction itself, a fault-injection benchmark sends
+// jumbo frames over a simulated link flipping random bits, with the same
+// stop-and-wait scheme of the communication layer, and compares the
+// retransmissions and the latency with and without FEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test_framework.h"
+
+#include "packet.h"
+
+// Simulated link: 115200 baud, 10 bits per byte, tmon RTO
+#define BYTE_TIME_US (1e6 * 10 / 115200)
+#define RTO_US 150000.0
+#define BENCH_PACKETS 20000
+
+// Outcome of a benchmark run
+typedef struct _bench_s {
+  unsigned retransmissions;
+  unsigned undetected;  // Corrupted packets accepted as sane
+  double latency_mean, latency_p99, latency_p999, latency_max;  // In ms
+} bench_t;
+
+
+// Flip a bit of a packet, counted from the LSB of its first byte
+static void flip(packet_t *p, unsigned bit) {
+  ((uint8_t*) p)[bit / 8] ^= 1 << (bit % 8);
+}
+
+// Flip each bit of a frame with probability 'ber'
+// Returns the number of flipped bits
+static unsigned inject_errors(packet_t *p, uint8_t size, double ber);
+
+// Receive a (possibly corrupted) frame of 'size' bytes, as the communication
+// layer does, correcting it if 'fec' is set
+// Returns 1 if the frame is accepted, 0 if it is not
+static int receive(packet_t *p, uint8_t size, int fec);
+
+// Send BENCH_PACKETS jumbo frames over a link with a given bit error rate
+static bench_t bench_run(double ber, int fec);
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - Forward Error Correction Test Unit\n\n"
+         "Wide CRC: %s\n\n", CRC_WIDE_NAME);
+  packet_t sane, p[1];
+  uint8_t data[PACKET_JUMBO_DATA_MAX_SIZE];
+  srand(0xFEC);
+  for (uint8_t i=0; i < sizeof(data); ++i)
+    data[i] = rand();
+
+  // Every single flipped bit, header included, must be corrected
+  packet_craft(3, PACKET_TYPE_DAT | PACKET_CRC_WIDE, data, sizeof(data), &sane);
+  const uint8_t size = packet_get_size(&sane);
+  *p = sane;
+  test_expr(packet_correct(p, size) == 0 && memcmp(p, &sane, size) == 0,
+      "A sane packet should be left untouched");
+
+  int corrected = 1;
+  for (unsigned bit=0; bit < 8U * size; ++bit) {
+    *p = sane;
+    flip(p, bit);
+    if (packet_correct(p, size) != 0 || memcmp(p, &sane, size) != 0)
+      corrected = 0;
+  }
+  test_expr(corrected, "Every single flipped bit in a %hhu bytes packet "
+      "should be corrected", size);
+
+  *p = sane;
+  flip(p, 12);  // Size field, as it is read before the correction
+  test_expr(packet_correct(p, packet_get_size(p)) != 0,
+      "A packet should not be corrected to a size different from the received");
+
+  // Two flipped bits must be detected, not miscorrected
+  packet_craft(5, PACKET_TYPE_CTR | PACKET_CRC_WIDE, data, 34, &sane);
+  const uint8_t short_size = packet_get_size(&sane);
+  int detected = 1;
+  for (unsigned a=0; a < 8U * short_size; ++a)
+    for (unsigned b=a+1; b < 8U * short_size; ++b) {
+      *p = sane;
+      flip(p, a);
+      flip(p, b);
+      if (packet_correct(p, short_size) == 0) detected = 0;
+    }
+  test_expr(detected, "Every couple of flipped bits in a %hhu bytes packet "
+      "should be detected", short_size);
+
+#if CRC_WIDE == 32
+  // CRC-32C keeps detecting up to four flipped bits
+  packet_craft(3, PACKET_TYPE_DAT | PACKET_CRC_WIDE, data, sizeof(data), &sane);
+  detected = 1;
+  for (unsigned n=0; n < 100000; ++n) {
+    unsigned bits[4];
+    const unsigned flips = 3 + n % 2;
+    for (unsigned k=0; k < flips; ++k)  // Distinct bits
+      for (unsigned again=1; again; ) {
+        bits[k] = rand() % (8U * size);
+        again = 0;
+        for (unsigned j=0; j < k; ++j)
+          if (bits[j] == bits[k]) again = 1;
+      }
+    *p = sane;
+    for (unsigned k=0; k < flips; ++k)
+      flip(p, bits[k]);
+    if (packet_correct(p, size) == 0) detected = 0;
+  }
+  test_expr(detected, "Three or four flipped bits should be detected");
+#endif
+
+  // CRC-8 is too weak to correct anything
+  packet_craft(1, PACKET_TYPE_DAT, data, PACKET_DATA_MAX_SIZE, &sane);
+  *p = sane;
+  flip(p, 40);
+  test_expr(packet_correct(p, packet_get_size(p)) != 0,
+      "A packet protected by CRC-8 should not be corrected");
+
+
+  // Fault-injection benchmark
+  printf("\nFault injection: %d jumbo frames (%hhu bytes), RTO %.0f ms\n",
+      BENCH_PACKETS, size, RTO_US / 1000);
+  printf("%-8s %-4s %8s %8s %8s %8s %8s %8s\n", "BER", "FEC", "FER",
+      "retx", "mean", "p99", "p99.9", "max");
+
+  const double ber_values[] = { 1e-5, 2e-5, 5e-5, 1e-4 };
+  const unsigned ber_count = sizeof(ber_values) / sizeof(*ber_values);
+  int fewer_retx = 1, lower_p99 = 1, lower_p999 = 1, sound = 1;
+  for (unsigned i=0; i < ber_count; ++i) {
+    const double ber = ber_values[i];
+    const double fer = 1 - pow(1 - ber, 8 * size);  // Frame error rate
+    bench_t b[2];
+    for (int fec=0; fec < 2; ++fec) {
+      b[fec] = bench_run(ber, fec);
+      printf("%-8.0e %-4s %7.2f%% %8u %5.1f ms %5.1f ms %5.1f ms %5.1f ms\n",
+          ber, fec ? "yes" : "no", 100 * fer, b[fec].retransmissions,
+          b[fec].latency_mean, b[fec].latency_p99, b[fec].latency_p999,
+          b[fec].latency_max);
+      if (b[fec].undetected) sound = 0;
+    }
+    if (b[1].retransmissions * 4 > b[0].retransmissions) fewer_retx = 0;
+    if (b[1].latency_p99 > b[0].latency_p99) lower_p99 = 0;
+    if (b[1].latency_p999 >= b[0].latency_p999) lower_p999 = 0;
+  }
+  test_expr(sound, "No corrupted packet should ever be accepted");
+  test_expr(fewer_retx, "FEC should cut the retransmissions at least by 4");
+  test_expr(lower_p99, "FEC should not raise the 99th percentile latency");
+  test_expr(lower_p999, "FEC should lower the 99.9th percentile latency");
+
+  test_summary();
+  return 0;
+}
+
+
+
+// Auxiliary functions
+
+// Flip each bit of a frame with probability 'ber', drawing the distance from
+// one flipped bit to the next one (i.e. a geometric distribution)
+static unsigned inject_errors(packet_t *p, uint8_t size, double ber) {
+  unsigned flips = 0;
+  const double log_good = log(1 - ber);
+  for (double bit = -1; ; ) {
+    const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    bit += floor(log(u) / log_good) + 1;
+    if (bit >= 8.0 * size) return flips;
+    flip(p, (unsigned) bit);
+    ++flips;
+  }
+}
+
+
+// Receive a frame as the communication layer does
+// Without COBS framing the receiver reads as many bytes as the size field
+// says, so a corrupted size loses the frame anyway
+static int receive(packet_t *p, uint8_t size, int fec) {
+  if (packet_get_size(p) != size) return 0;
+  if (packet_check_header(p) == 0 && packet_check_crc(p) == 0) return 1;
+  return fec && packet_correct(p, size) == 0;
+}
+
+
+// [AUX] Compare two latencies, for qsort
+static int cmp_latency(const void *a, const void *b) {
+  const double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// Send BENCH_PACKETS jumbo frames, each one acknowledged by an ACK, over a
+// link with a given bit error rate. A frame which is not accepted is answered
+// with an ERR, and a frame or an ACK which is not accepted costs an RTO
+// before sending the frame again
+static bench_t bench_run(double ber, int fec) {
+  static double latency[BENCH_PACKETS];
+  bench_t b = { 0 };
+  uint8_t data[PACKET_JUMBO_DATA_MAX_SIZE];
+  packet_t frame, ack, rx[1];
+  srand(0xB0B);
+
+  for (unsigned n=0; n < BENCH_PACKETS; ++n) {
+    for (uint8_t i=0; i < sizeof(data); ++i)
+      data[i] = rand();
+    packet_craft(n % PACKET_ID_MAX_VAL, PACKET_TYPE_DAT | PACKET_CRC_WIDE,
+        data, sizeof(data), &frame);
+    packet_ack(&frame, &ack);
+    const uint8_t size = packet_get_size(&frame);
+    const uint8_t ack_size = packet_get_size(&ack);
+
+    double t = 0;
+    for (unsigned attempt=0; ; ++attempt) {
+      if (attempt) ++b.retransmissions;
+      t += size * BYTE_TIME_US;
+      *rx = frame;
+      inject_errors(rx, size, ber);
+      if (!receive(rx, size, fec)) {  // ERR, then wait for the RTO
+        t += ack_size * BYTE_TIME_US + RTO_US;
+        continue;
+      }
+      if (memcmp(rx, &frame, size) != 0) ++b.undetected;
+
+      t += ack_size * BYTE_TIME_US;
+      *rx = ack;
+      inject_errors(rx, ack_size, ber);
+      if (receive(rx, ack_size, fec)) break;
+      t += RTO_US;  // ACK lost, the frame is sent again
+    }
+    latency[n] = t / 1000;
+    b.latency_mean += latency[n] / BENCH_PACKETS;
+  }
+
+  qsort(latency, BENCH_PACKETS, sizeof(*latency), cmp_latency);
+  b.latency_p99 = latency[BENCH_PACKETS * 99 / 100];
+  b.latency_p999 = latency[BENCH_PACKETS * 999 / 1000];
+  b.latency_max = latency[BENCH_PACKETS - 1];
+  return b;
+}
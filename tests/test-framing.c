@@ -0,0 +1,134 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// Packet framing (COBS) - Test Unit
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_framework.h"
+
+#include "framing.h"
+#include "packet.h"
+
+#define FRAME_MAX_SIZE (sizeof(packet_t) + 2)
+
+
+// Decode a stream of frames, storing the data of the last complete one
+// Returns the number of frames which were over, i.e. delimited
+static unsigned decode_stream(const uint8_t *stream, size_t size,
+    uint8_t *dest, uint8_t *dest_size);
+
+// Compare a decoded frame with the expected data
+static int frame_equals(const uint8_t *frame, uint8_t frame_size,
+    const uint8_t *data, uint8_t data_size);
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - Packet Framing (COBS) Test Unit\n\n");
+  uint8_t data[sizeof(packet_t)], frame[FRAME_MAX_SIZE], decoded[FRAME_MAX_SIZE];
+  uint8_t decoded_size;
+
+  // Known encodings
+  const uint8_t known_data[] = { 0x11, 0x00, 0x22, 0x00, 0x00 };
+  const uint8_t known_frame[] = { 0x02, 0x11, 0x02, 0x22, 0x01, 0x01, 0x00 };
+  uint8_t size = framing_encode(frame, known_data, sizeof(known_data));
+  test_expr(size == sizeof(known_frame) &&
+      memcmp(frame, known_frame, size) == 0,
+      "A known chunk of data should be encoded as expected");
+  test_expr(framing_encode(frame, known_data, 0) == 2 && frame[0] == 0x01 &&
+      frame[1] == FRAMING_DELIMITER, "Empty data should be a single code byte");
+  test_expr(framing_encode(frame, data, 0xFE) == 0,
+      "Data longer than a single COBS block should be refused");
+
+
+  // Round trip of whole packets, zeros included, encoded in place too
+  srand(0xC0B5);
+  int round_trip = 1, no_delimiter = 1, in_place = 1;
+  for (unsigned n=0; n < 1000; ++n) {
+    const uint8_t data_size = rand() % sizeof(data);
+    for (uint8_t i=0; i < data_size; ++i)
+      data[i] = (rand() % 4) ? rand() : 0x00;
+
+    size = framing_encode(frame, data, data_size);
+    if (memchr(frame, FRAMING_DELIMITER, size - 1) ||
+        frame[size-1] != FRAMING_DELIMITER)
+      no_delimiter = 0;
+    if (decode_stream(frame, size, decoded, &decoded_size) != 1 ||
+        !frame_equals(decoded, decoded_size, data, data_size))
+      round_trip = 0;
+
+    memcpy(decoded, data, data_size);
+    if (framing_encode(decoded, decoded, data_size) != size ||
+        memcmp(decoded, frame, size) != 0)
+      in_place = 0;
+  }
+  test_expr(no_delimiter, "The delimiter should only end a frame");
+  test_expr(round_trip, "Decoding a frame should give back its data");
+  test_expr(in_place, "Encoding in place should give the same frame");
+
+
+  // Resynchronisation: whatever comes before a delimiter is a single (bad)
+  // frame, and the following one is decoded as if nothing happened
+  printf("\nTesting resynchronisation after corrupted frames\n");
+  uint8_t stream[3 * FRAME_MAX_SIZE];
+  const uint8_t data_size = sizeof(data) / 2;
+  for (uint8_t i=0; i < data_size; ++i)
+    data[i] = i % 5 ? i : 0;
+  size = framing_encode(frame, data, data_size);
+
+  size_t stream_size = 0;
+  memcpy(stream, frame + 7, size - 7);  // Truncated frame
+  stream_size += size - 7;
+  memcpy(stream + stream_size, frame, size);
+  stream_size += size;
+  test_expr(decode_stream(stream, stream_size, decoded, &decoded_size) == 2 &&
+      frame_equals(decoded, decoded_size, data, data_size),
+      "A frame following a truncated one should be decoded");
+
+  stream_size = 0;
+  memcpy(stream, frame, size);
+  stream[size - 1] = 0x55;  // Delimiter lost: two frames joined together
+  memcpy(stream + size, frame, size);
+  stream_size = 2 * size;
+  test_expr(decode_stream(stream, stream_size, decoded, &decoded_size) == 1 &&
+      !frame_equals(decoded, decoded_size, data, data_size),
+      "Two frames joined together should not give back any of them");
+
+  stream[size - 1] = FRAMING_DELIMITER;
+  stream[3] ^= 0x20;  // Corrupted (i.e. lost) code byte or data byte
+  test_expr(decode_stream(stream, stream_size, decoded, &decoded_size) == 2 &&
+      frame_equals(decoded, decoded_size, data, data_size),
+      "A frame following a corrupted one should be decoded");
+
+
+  test_summary();
+  return 0;
+}
+
+
+
+// Decode a stream of frames, storing the data of the last complete one
+static unsigned decode_stream(const uint8_t *stream, size_t size,
+    uint8_t *dest, uint8_t *dest_size) {
+  framing_decoder_t decoder[1];
+  framing_decoder_reset(decoder);
+  unsigned frames = 0;
+  uint8_t received = 0;
+
+  for (size_t i=0; i < size; ++i) {
+    const int16_t decoded = framing_decode(decoder, stream[i]);
+    if (decoded == FRAMING_END) {
+      *dest_size = received;
+      received = 0;
+      ++frames;
+    }
+    else if (decoded != FRAMING_NONE && received < FRAME_MAX_SIZE)
+      dest[received++] = decoded;
+  }
+  return frames;
+}
+
+
+// Compare a decoded frame with the expected data
+static int frame_equals(const uint8_t *frame, uint8_t frame_size,
+    const uint8_t *data, uint8_t data_size) {
+  return frame_size == data_size && memcmp(frame, data, data_size) == 0;
+}
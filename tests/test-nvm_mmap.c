@@ -0,0 +1,140 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// File-backed NVM backend - Test Unit
+// The temperature database is built with TEMP_LOG_WIDE and run against a
+// multi-megabyte NVM image, much larger than the AVR EEPROM
+#include <stdio.h>
+#include <stddef.h>  // offsetof macro
+#include <unistd.h>
+#include "test_framework.h"
+#include "temperature.h"
+#include "nvm.h"
+#include "nvm_mmap.h"
+
+#define IMAGE_PATH "tests/bin/test-nvm_mmap.img"
+#define IMAGE_SIZE (4UL << 20)
+#define REG_RESOLUTION 1000
+#define REG_INTERVAL 1
+#define READ_BURST 256
+#define DELTA_ITEMS 5000  // Temperatures registered after the reset
+
+// Words in the log of the image
+#define LOG_WORDS ((IMAGE_SIZE - offsetof(nvm_image_t, db_seq.words)) / \
+    sizeof(temperature_log_word_t))
+
+
+// Value of the i-th temperature of a DB
+static temperature_t sample(uint8_t db_id, unsigned long i) {
+  return (db_id * 7919 + i) & TEMP_LOG_VALUE;
+}
+
+// Value of the i-th temperature of a delta-compressed DB: a slow drift
+static temperature_t delta_sample(unsigned long i) {
+  return 500 + (i / 4) % 9;
+}
+
+// Check the temperatures of a DB, read in bursts
+// Returns 1 if they match 'sample' (or 'delta_sample'), 0 otherwise
+static int db_check(uint8_t db_id, unsigned long count, int delta) {
+  temperature_t buf[READ_BURST];
+  for (unsigned long i=0; i < count; i += READ_BURST) {
+    const unsigned long n = (count - i < READ_BURST) ? count - i : READ_BURST;
+    if (temperature_get_bulk(db_id, i, READ_BURST, buf) != n) return 0;
+    for (unsigned long j=0; j < n; ++j)
+      if (buf[j] != (delta ? delta_sample(i + j) : sample(db_id, i + j)))
+        return 0;
+  }
+  return 1;
+}
+
+// Close the image and open it again, then scan the log as on a reboot
+// Returns 0 on success, 1 otherwise
+static int reboot(void) {
+  if (nvm_mmap_close() != 0 || !(nvm_backend = nvm_mmap_open(IMAGE_PATH, 0)))
+    return 1;
+  temperature_init();
+  return 0;
+}
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - File-backed NVM Test Unit\n\n");
+  unlink(IMAGE_PATH);
+
+  nvm_backend = nvm_mmap_open(IMAGE_PATH, IMAGE_SIZE);
+  test_expr(nvm_backend != NULL, "A new NVM image should be created");
+  if (!nvm_backend) {
+    test_summary();
+    return 1;
+  }
+  test_expr(NVM_SIZE == IMAGE_SIZE, "The NVM image should be %lu bytes wide",
+      IMAGE_SIZE);
+  const unsigned char *bytes = nvm_backend->base;
+  test_expr(bytes[0] == 0xFF && bytes[IMAGE_SIZE - 1] == 0xFF,
+      "A new NVM image should be erased");
+
+  nvm_write(nvm_image, _nvm_image_ptr, sizeof(nvm_image_t));
+  temperature_init();
+  test_expr(temperature_count_all() == 0,
+      "A new NVM image should contain no temperatures");
+
+
+  printf("\nFilling the whole NVM image\n");
+  unsigned long counts[TEMP_DB_MAX] = { 0 }, total = 0;
+  uint8_t dbs = 0;
+  do {
+    while (temperature_register(sample(dbs, counts[dbs])) == 0)
+      counts[dbs]++;
+    total += counts[dbs++];
+  } while (temperature_db_new(REG_RESOLUTION, REG_INTERVAL) == 0);
+  temperature_flush();
+
+  const unsigned long log_used = total + dbs * TEMP_LOG_HEADER_WORDS;
+  printf("%lu temperatures registered in %hhu DBs, %lu of %lu log words used\n",
+      total, dbs, log_used, (unsigned long) LOG_WORDS);
+  test_expr(counts[0] == (temperature_id_t) -1,
+      "A DB should hold as many temperatures as a temperature_id_t counts");
+  test_expr(log_used < LOG_WORDS && log_used + TEMP_LOG_HEADER_WORDS + 1 >=
+      LOG_WORDS, "The whole NVM image should be used");
+
+  int ret = 1;
+  for (uint8_t id=0; id < dbs; ++id)
+    if (temperature_count(id) != counts[id] || !db_check(id, counts[id], 0))
+      ret = 0;
+  test_expr(ret, "Every temperature should be read back");
+
+
+  printf("\nTesting the log scan after a reboot\n");
+  test_expr(reboot() == 0, "The NVM image should be opened again");
+  test_expr(NVM_SIZE == IMAGE_SIZE, "The NVM image size should be kept");
+  ret = 1;
+  for (uint8_t id=0; id < dbs; ++id)
+    if (temperature_count(id) != counts[id] || !db_check(id, counts[id], 0))
+      ret = 0;
+  test_expr(ret && temperature_count(dbs) == 0,
+      "Every DB should be found again after a reboot");
+
+
+  printf("\nTesting a reset far from the start of the log\n");
+  temperature_db_reset();
+  test_expr(reboot() == 0 && temperature_count(0) == 0,
+      "The DBs should be reset across a reboot");
+
+  temperature_db_compression(1);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  ret = 1;
+  for (unsigned long i=0; i < DELTA_ITEMS; ++i)
+    if (temperature_register(delta_sample(i)) != 0)
+      ret = 0;
+  temperature_flush();
+  test_expr(ret, "Temperatures should be registered across the end of the log");
+  test_expr(reboot() == 0 && temperature_count(0) == DELTA_ITEMS &&
+      db_check(0, DELTA_ITEMS, 1), "A delta-compressed DB wrapping around "
+      "the end of the log should be found again after a reboot");
+
+
+  test_expr(nvm_mmap_close() == 0, "The NVM image should be closed");
+  unlink(IMAGE_PATH);
+
+  test_summary();
+  return 0;
+}
@@ -104,6 +104,83 @@ int main(int argc, const char *argv[]) {
   test_packet_integrity(PACKET_VALID, p);
 
 
+  // A packet built in place should equal a crafted one
+  printf("\nTesting packet_seal()\n");
+  packet_t _q, *q = &_q;
+  memcpy(q->data, data, data_size);
+  test_expr(packet_seal(q, PACKET_ID, PACKET_TYPE_DAT, data_size) == 0 &&
+      memcmp(p, q, packet_get_size(p)) == 0,
+      "A sealed packet should equal a crafted one");
+  test_expr(packet_seal(q, PACKET_ID, PACKET_TYPE_ACK, data_size) != 0 &&
+      packet_seal(q, PACKET_ID, PACKET_TYPE_DAT, PACKET_DATA_MAX_SIZE+1) != 0,
+      "packet_seal() should check its parameters");
+
+
+  // Packets protected by the wide CRC
+  printf("\nTesting packets protected by the wide CRC\n");
+  test_params(PACKET_VALID, PACKET_TYPE_DAT | PACKET_CRC_WIDE, data,
+      data_size, p);
+  test_expr(packet_crc_wide(p) && packet_get_type(p) == PACKET_TYPE_DAT &&
+      packet_data_size(p) == data_size && packet_get_size(p) ==
+      PACKET_HEADER_SIZE + data_size + sizeof(crc_wide_t),
+      "The wide CRC flag should not alter the packet type nor its data");
+  test_packet_integrity(PACKET_VALID, p);
+
+  int detected = 1;
+  for (uint8_t i=0; i < data_size + sizeof(crc_wide_t); ++i)
+    for (uint8_t bit=0; bit < 8; ++bit) {
+      p->data[i] ^= 1 << bit;
+      if (packet_check_crc(p) == 0) detected = 0;
+      p->data[i] ^= 1 << bit;
+    }
+  test_expr(detected, "Every single bit flip should be detected");
+
+  p->header[0] ^= 0x80;  // CRC-8 packet with the same header otherwise
+  test_packet_integrity(PACKET_INVALID, p);
+  p->header[0] ^= 0x80;
+
+  packet_ack(p, q);
+  test_expr(packet_crc_wide(q) && packet_get_type(q) == PACKET_TYPE_ACK &&
+      packet_check_header(q) == 0 && packet_check_crc(q) == 0,
+      "An ACK should be protected by the same CRC as the acknowledged packet");
+
+
+  // Jumbo frames, i.e. packets protected by the wide CRC filling the whole
+  // size field
+  printf("\nTesting jumbo frames\n");
+  uint8_t jumbo[PACKET_JUMBO_DATA_MAX_SIZE];
+  for (uint8_t i=0; i < sizeof(jumbo); ++i)
+    jumbo[i] = i * 7;
+  test_expr(sizeof(packet_t) == (1 << PACKET_SIZE_WIDTH_BIT) - 1,
+      "A packet should be as large as the largest size in its header");
+  test_params(PACKET_INVALID, PACKET_TYPE_DAT, jumbo, PACKET_DATA_MAX_SIZE+1, p);
+  test_params(PACKET_INVALID, PACKET_TYPE_DAT | PACKET_CRC_WIDE, jumbo,
+      PACKET_JUMBO_DATA_MAX_SIZE + 1, p);
+  test_params(PACKET_VALID, PACKET_TYPE_DAT | PACKET_CRC_WIDE, jumbo,
+      PACKET_JUMBO_DATA_MAX_SIZE, p);
+  test_expr(packet_get_size(p) == sizeof(packet_t) &&
+      packet_data_size(p) == PACKET_JUMBO_DATA_MAX_SIZE &&
+      memcmp(p->data, jumbo, sizeof(jumbo)) == 0,
+      "A jumbo frame should carry all of its data");
+  test_packet_integrity(PACKET_VALID, p);
+
+  p->header[0] ^= 0x80;  // A CRC-8 packet cannot be that large
+  p->header[1] ^= packet_header_parity(p);  // Even with a sane parity bit
+  test_expr(packet_check_header(p) != 0,
+      "A CRC-8 packet larger than PACKET_DATA_MAX_SIZE should be rejected");
+
+
+  // Bulk data and cumulative ACKs
+  printf("\nTesting BLK packets and packet IDs distance\n");
+  test_params(PACKET_VALID, PACKET_TYPE_BLK | PACKET_CRC_WIDE, jumbo,
+      PACKET_JUMBO_DATA_MAX_SIZE, p);
+  test_expr(packet_get_type(p) == PACKET_TYPE_BLK && packet_brings_data(p),
+      "A BLK packet should bring data");
+  test_expr(packet_id_distance(3, 3) == 0 && packet_id_distance(3, 5) == 2 &&
+      packet_id_distance(PACKET_ID_MAX_VAL - 1, 1) == 2,
+      "The distance between packet IDs should wrap around");
+
+
   test_summary();
   return 0;
 }
@@ -9,6 +9,69 @@
 #define TEST_ITEMS_MAX 3  // Avoid long iterations for repetitive tests
 #define REG_RESOLUTION 1000
 #define REG_INTERVAL 1
+#define WEAR_LAPS 4  // Times the whole NVM is filled when testing its wear
+#define DELTA_ITEMS 200  // Temperatures registered in delta-compressed DBs
+#define DOWNLOAD_BURST 14  // Temperatures sent in a single packet
+#define CHANNELS 3  // Channels of the multi-channel DBs
+
+
+// Value of the i-th temperature when testing the delta encoding: a slow drift
+// with some mid-sized steps and some jumps which need a new keyframe
+static temperature_t delta_sample(temperature_id_t i) {
+  if (i % 50 == 49) return (i % 100 == 49) ? TEMP_LOG_KEY_VALUE : 0;
+  return 300 + (i / 3) % 5 + ((i % 10 == 9) ? 60 : 0);
+}
+
+// Check the temperatures of a delta-compressed DB, read in bursts of 'burst'
+// Returns 1 if they match 'delta_sample', 0 otherwise
+static int delta_check(uint8_t db_id, temperature_id_t count,
+    temperature_id_t burst) {
+  temperature_t buf[burst];
+  for (temperature_id_t i=0; i < count; i += burst) {
+    const temperature_id_t got = temperature_get_bulk(db_id, i, burst, buf);
+    if (got != (count - i < burst ? count - i : burst)) return 0;
+    for (temperature_id_t j=0; j < got; ++j)
+      if (buf[j] != delta_sample(i + j)) return 0;
+  }
+  return 1;
+}
+
+// Value of the i-th temperature of a multi-channel DB: every channel follows
+// 'delta_sample' with its own offset, so consecutive temperatures are far apart
+static temperature_t channel_sample(temperature_id_t i) {
+  return (delta_sample(i / CHANNELS) + (i % CHANNELS) * 1000) &
+    TEMP_LOG_KEY_VALUE;
+}
+
+// Check the temperatures of a multi-channel DB, read in bursts of 'burst'
+// Returns 1 if they match 'channel_sample', 0 otherwise
+static int channel_check(uint8_t db_id, temperature_id_t count,
+    temperature_id_t burst) {
+  temperature_t buf[burst];
+  for (temperature_id_t i=0; i < count; i += burst) {
+    const temperature_id_t got = temperature_get_bulk(db_id, i, burst, buf);
+    if (got != (count - i < burst ? count - i : burst)) return 0;
+    for (temperature_id_t j=0; j < got; ++j)
+      if (buf[j] != channel_sample(i + j)) return 0;
+  }
+  return 1;
+}
+
+// Read all the DBs as the download command does, in bursts
+// Returns the number of NVM reads it took
+static unsigned long download_reads(void) {
+  temperature_db_info_t info;
+  temperature_t burst[DOWNLOAD_BURST];
+  nvm_mock_reads_reset();
+
+  for (uint8_t id=0; temperature_db_info(id, info) == 0; ++id) {
+    temperature_id_t count;
+    temperature_db_info_extract(info, NULL, &count, NULL, NULL, NULL);
+    for (temperature_id_t i=0; i < count; i += DOWNLOAD_BURST)
+      temperature_get_bulk(id, i, DOWNLOAD_BURST, burst);
+  }
+  return nvm_mock_reads();
+}
 
 
 int main(int argc, const char *argv[]) {
@@ -72,9 +135,233 @@ int main(int argc, const char *argv[]) {
       "Second created DB should contain a new temperature");
 
 
+  printf("\nTesting DBs recovery after a reboot\n");
+  temperature_flush();
+  temperature_init();
+  test_expr(temperature_count(0) == test_items_limit &&
+      temperature_count(1) == 1, "DBs should be found by scanning the log");
+  test_expr(temperature_count_all() == test_items_limit + 1,
+      "Total number of temperatures should be consistent");
+  test_expr(temperature_register(1) == 0 && temperature_count(1) == 2,
+      "Registering should go on in the last DB");
+
+
   printf("\nTesting temperature_db_reset routine\n");
   temperature_db_reset();
   test_expr(temperature_count_all() == 0, "DBs should have been emptied");
+  temperature_init();
+  test_expr(temperature_count_all() == 0,
+      "DBs should be still empty after a reboot");
+
+
+  printf("\nTesting the RAM staging of temperatures\n");
+  nvm_mock_writes_reset();
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  for (temperature_id_t i=0; i < TEMP_STAGE_WORDS - TEMP_LOG_HEADER_WORDS - 1;
+      ++i)
+    temperature_register(i);
+  test_expr(nvm_mock_writes_total() == 0,
+      "Staged temperatures should not be written to the NVM");
+  ret = temperature_get(0, 3, temps_buf) == 0 && temps_buf[0] == 3;
+  test_expr(ret && temperature_count(0) == TEMP_STAGE_WORDS -
+      TEMP_LOG_HEADER_WORDS - 1, "Staged temperatures should be readable");
+  temperature_register(0);
+  test_expr(nvm_mock_writes_total() > 0,
+      "A full stage should be committed to the NVM");
+  temperature_register(0);
+  temperature_flush();
+  temperature_init();
+  test_expr(temperature_count(0) == TEMP_STAGE_WORDS - TEMP_LOG_HEADER_WORDS + 1,
+      "Flushed temperatures should be found after a reboot");
+  temperature_db_reset();
+
+
+  printf("\nTesting delta-compressed DBs\n");
+  temperature_db_compression(1);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  for (temperature_id_t i=0; i < DELTA_ITEMS; ++i)
+    temperature_register(delta_sample(i));
+  test_expr(temperature_count(0) == DELTA_ITEMS,
+      "Every compressed temperature should be counted");
+  test_expr(delta_check(0, DELTA_ITEMS, 14) && delta_check(0, DELTA_ITEMS, 1),
+      "Compressed temperatures should be decoded in bulk");
+  ret = 1;
+  for (temperature_id_t i = DELTA_ITEMS; i > 0; --i)
+    if (temperature_get(0, i - 1, temps_buf) != 0 ||
+        temps_buf[0] != delta_sample(i - 1))
+      ret = 0;
+  test_expr(ret, "Compressed temperatures should be decoded in any order");
+
+  // Commit partially filled words, then go on registering
+  temperature_register(delta_sample(DELTA_ITEMS));
+  temperature_flush();
+  temperature_register(delta_sample(DELTA_ITEMS + 1));
+  temperature_register(delta_sample(DELTA_ITEMS + 2));
+  temperature_flush();
+  temperature_init();
+  test_expr(temperature_count(0) == DELTA_ITEMS + 3 &&
+      delta_check(0, DELTA_ITEMS + 3, 14),
+      "Compressed temperatures should be found after a reboot");
+  test_expr(temperature_register(delta_sample(DELTA_ITEMS + 3)) == 0 &&
+      delta_check(0, DELTA_ITEMS + 4, 14),
+      "Registering should go on in a compressed DB after a reboot");
+
+  temperature_db_compression(0);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  temperature_register(TEMP_LOG_VALUE);
+  test_expr(temperature_get(1, 0, temps_buf) == 0 &&
+      temps_buf[0] == TEMP_LOG_VALUE && delta_check(0, DELTA_ITEMS + 4, 14),
+      "Compressed and uncompressed DBs should coexist");
+  temperature_db_reset();
+
+  // Fill the whole NVM with slowly changing temperatures, with and without
+  // compression
+  temperature_id_t raw_count = 0, delta_count = 0;
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  while (temperature_register(512 + (raw_count / 4) % 8) == 0)
+    ++raw_count;
+  temperature_db_reset();
+  temperature_db_compression(1);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  while (temperature_register(512 + (delta_count / 4) % 8) == 0)
+    ++delta_count;
+  printf("NVM capacity: %u temperatures, %u compressed\n", raw_count,
+      delta_count);
+  test_expr(delta_count >= 2 * raw_count,
+      "Compression should at least double the capacity of the NVM");
+  ret = temperature_count(0) == delta_count;
+  for (temperature_id_t i=0; i < delta_count; ++i)
+    if (temperature_get(0, i, temps_buf) != 0 ||
+        temps_buf[0] != 512 + (i / 4) % 8)
+      ret = 0;
+  test_expr(ret, "A full compressed DB should be decoded correctly");
+  temperature_db_reset();
+  temperature_db_compression(0);
+
+
+  printf("\nTesting multi-channel DBs\n");
+  test_expr(temperature_db_channels(0) != 0 &&
+      temperature_db_channels(TEMPERATURE_CHANNELS_MAX + 1) != 0,
+      "Channel counts out of range should be rejected");
+  temperature_db_channels(CHANNELS);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  for (temperature_id_t i=0; i < CHANNELS * 4; ++i)
+    temperature_register(channel_sample(i));
+  temperature_db_compression(1);
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  for (temperature_id_t i=0; i < CHANNELS * DELTA_ITEMS + 1; ++i)
+    temperature_register(channel_sample(i));
+
+  temperature_db_info_t info;
+  uint8_t info_channels = 0;
+  temperature_db_info(1, info);
+  temperature_db_info_extract(info, NULL, NULL, NULL, NULL, &info_channels);
+  test_expr(info_channels == CHANNELS,
+      "The DB info should report the channels (%hhu)", info_channels);
+  test_expr(channel_check(0, CHANNELS * 4, 5),
+      "Uncompressed records should be stored interleaved");
+  test_expr(channel_check(1, CHANNELS * DELTA_ITEMS + 1, 14) &&
+      channel_check(1, CHANNELS * DELTA_ITEMS + 1, 1),
+      "Compressed records should be decoded in bulk");
+  ret = 1;
+  for (temperature_id_t i = CHANNELS * DELTA_ITEMS + 1; i > 0; --i)
+    if (temperature_get(1, i - 1, temps_buf) != 0 ||
+        temps_buf[0] != channel_sample(i - 1))
+      ret = 0;
+  test_expr(ret, "Compressed records should be decoded in any order");
+
+  temperature_flush();
+  temperature_init();
+  temperature_register(channel_sample(CHANNELS * DELTA_ITEMS + 1));
+  test_expr(temperature_count(1) == CHANNELS * DELTA_ITEMS + 2 &&
+      channel_check(1, CHANNELS * DELTA_ITEMS + 2, 14),
+      "Records should go on from the right channel after a reboot");
+  temperature_db_reset();
+
+  // Channels far apart from each other should compress as a single one
+  temperature_id_t channel_count = 0;
+  temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+  while (temperature_register(512 + (channel_count % CHANNELS) * 1000 +
+        (channel_count / CHANNELS / 4) % 8) == 0)
+    ++channel_count;
+  printf("NVM capacity: %u compressed temperatures in %d channels\n",
+      channel_count, CHANNELS);
+  test_expr(channel_count >= 2 * raw_count,
+      "Compression should be per channel");
+  temperature_db_reset();
+  temperature_db_compression(0);
+  temperature_db_channels(1);
+
+
+  printf("\nTesting the DB directory\n");
+  for (uint8_t id=0; id < TEMP_DB_MAX; ++id) {
+    temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+    for (temperature_t t=0; t < 3; ++t)
+      temperature_register(id + t);
+  }
+  test_expr(temperature_db_new(REG_RESOLUTION, REG_INTERVAL) != 0,
+      "No more than %d DBs should be created", TEMP_DB_MAX);
+  temperature_flush();
+  temperature_init();
+  ret = temperature_count_all() == TEMP_DB_MAX * 3;
+  for (uint8_t id=0; id < TEMP_DB_MAX; ++id)
+    if (temperature_count(id) != 3 || temperature_get(id, 2, temps_buf) != 0 ||
+        temps_buf[0] != id + 2)
+      ret = 0;
+  test_expr(ret, "Every DB should be found in the directory after a reboot");
+
+  const unsigned long reads = download_reads();
+  printf("Downloading %d DBs takes %lu NVM reads\n", TEMP_DB_MAX, reads);
+  test_expr(reads <= 4 * TEMP_DB_MAX,
+      "NVM reads should grow linearly with the number of DBs");
+  temperature_db_reset();
+
+
+  // Fill the whole NVM many times, resetting the DBs each time
+  printf("\nTesting the NVM wear across %d laps\n", WEAR_LAPS);
+  nvm_mock_writes_reset();
+  unsigned long registered = 0;
+  for (int lap=0; lap < WEAR_LAPS; ++lap) {
+    temperature_id_t count = 0;
+    temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+    while (temperature_register((count * 7) & 0x3FF) == 0)
+      if (++count % 500 == 0)  // Some DBs for each lap
+        temperature_db_new(REG_RESOLUTION, REG_INTERVAL);
+    registered += count;
+
+    temperature_flush();
+    temperature_init();  // Reboot
+    if (lap == WEAR_LAPS - 1) {
+      test_expr(temperature_count_all() == count,
+          "All the temperatures should be found after a reboot (%u, %u "
+          "registered)", temperature_count_all(), count);
+
+      // Check the values of the last DB, which likely wraps around
+      uint8_t last_id = (count - 1) / 500;
+      temperature_id_t last_count = temperature_count(last_id);
+      temperature_t t;
+      ret = 1;
+      for (temperature_id_t i=0; i < last_count; ++i)
+        if (temperature_get(last_id, i, &t) != 0 ||
+            t != (((last_id * 500 + i) * 7) & 0x3FF))
+          ret = 0;
+      test_expr(last_count > 0 && ret, "Temperatures should be consistent "
+          "across the end of the NVM");
+    }
+    temperature_db_reset();
+  }
+
+  const unsigned long ctl_writes = nvm_mock_writes_max(&nvm_image->db_seq,
+      sizeof(temperature_log_t));
+  const unsigned long log_writes = nvm_mock_writes_max(
+      nvm_image->db_seq.words,  // Up to the last byte, where the log wraps
+      (void*) nvm_image + NVM_SIZE - (void*) nvm_image->db_seq.words);
+  printf("%lu temperatures registered, max writes per byte: %lu in the log, "
+      "%lu in its control block\n", registered, log_writes, ctl_writes);
+  test_expr(ctl_writes <= WEAR_LAPS,
+      "The log control block should be written only on reset");
+  test_expr(log_writes <= WEAR_LAPS + 1,
+      "Each byte of the log should be written about once per lap");
 
 
   test_summary();
@@ -0,0 +1,90 @@
+// AVR Temperature Monitor -- Paolo Lucchesi
+// 16-bit timers prescaler computation - Test Unit
+#include <stdio.h>
+#include "test_framework.h"
+
+#include "timer_prescaler.h"
+
+#define CYCLES_PER_MSEC (F_CPU / 1000)
+#define TICKS_MAX 65536ULL
+#define PERIOD_MAX ((uint32_t) UINT16_MAX * UINT16_MAX)
+
+// Failures counter, in order not to report each one of millions of periods
+static unsigned long failures;
+
+
+// Check the setup computed for a period, returning 0 if it is sound
+static int check_period(uint32_t period) {
+  timer_setup_t setup;
+  if (timer_prescaler_compute(period, &setup) != 0) return 1;
+
+  const uint64_t psc = timer_prescaler_value(setup.cs);
+  const uint64_t cycles = (uint64_t) period * CYCLES_PER_MSEC;
+  const uint64_t covered = (setup.ocr + 1ULL) * psc * setup.matches;
+  const uint64_t error = covered > cycles ? covered - cycles : cycles - covered;
+
+  if (!psc || !setup.matches) return 1;
+
+  // One match with the finest fitting prescaler, or the fewest matches
+  if (setup.matches == 1) {
+    if (cycles > TICKS_MAX * psc + psc / 2) return 1;
+    const uint64_t finer = timer_prescaler_value(setup.cs - 1);
+    if (setup.cs > 1 && cycles + finer / 2 <= TICKS_MAX * finer) return 1;
+  }
+  else if (psc != 1024 || (setup.matches - 1) * TICKS_MAX * psc >= cycles)
+    return 1;
+
+  // Rounding error of at most half a tick for each compare match
+  return error > setup.matches * psc / 2 + psc / 2;
+}
+
+
+int main(int argc, const char *argv[]) {
+  printf("avrtmon - Timer Prescaler Unit Test\n\nF_CPU: %lu\n\n",
+      (unsigned long) F_CPU);
+  timer_setup_t setup;
+
+  test_expr(timer_prescaler_compute(0, &setup) != 0,
+      "A period of 0 milliseconds should be rejected");
+  test_expr(timer_prescaler_value(0) == 0 && timer_prescaler_value(6) == 0,
+      "A stopped or invalid clock select should have no prescaler");
+
+  // Default configuration (1000ms x 2): a single wakeup every 2 seconds
+  timer_prescaler_compute(2000, &setup);
+  test_expr(setup.matches == 1 && setup.cs == 5 && setup.ocr == 31249,
+      "2000ms should take one match of 31250 ticks at 1024 (cs=%hhu, ocr=%hu, "
+      "matches=%lu)", setup.cs, setup.ocr, (unsigned long) setup.matches);
+
+  timer_prescaler_compute(50, &setup);
+  test_expr(setup.matches == 1 && setup.cs == 3 && setup.ocr == 12499,
+      "50ms should take one match of 12500 ticks at 64 (cs=%hhu, ocr=%hu)",
+      setup.cs, setup.ocr);
+
+  timer_prescaler_compute(PERIOD_MAX, &setup);
+  test_expr(setup.cs == 5 && setup.matches == 1023969,
+      "The longest period should be split in the fewest matches (%lu)",
+      (unsigned long) setup.matches);
+
+  // Every period up to a minute, where the prescaler changes
+  failures = 0;
+  for (uint32_t period=1; period <= 60000; ++period)
+    if (check_period(period) != 0 && failures++ < 8)
+      printf("Unsound setup for a period of %lu ms\n", (unsigned long) period);
+  test_expr(failures == 0,
+      "Periods up to a minute should be covered soundly (%lu failures)", failures);
+
+  // The whole configurable range (resolution x interval), sparsely
+  failures = 0;
+  for (uint32_t res=1; res <= UINT16_MAX; res += res / 16 + 1)
+    for (uint32_t intv=1; intv <= UINT16_MAX; intv += intv / 16 + 1)
+      if (check_period(res * intv) != 0 && failures++ < 8)
+        printf("Unsound setup for %lu x %lu ms\n", (unsigned long) res,
+            (unsigned long) intv);
+  if (check_period(PERIOD_MAX) != 0) ++failures;
+  test_expr(failures == 0,
+      "The whole configurable range should be covered soundly (%lu failures)",
+      failures);
+
+  test_summary();
+  return 0;
+}